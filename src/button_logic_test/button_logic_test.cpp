@@ -0,0 +1,191 @@
+// ButtonLogic のホストテスト: デバウンス・OK の短押し/長押し・RUN 進入時の抑止
+#include "ButtonLogic.h"
+
+#include <cstdio>
+#include <vector>
+
+using Btn = ButtonLogic::Btn;
+using Act = ButtonLogic::Act;
+using Ctx = ButtonLogic::Ctx;
+
+static int g_fail = 0;
+
+#define CHECK(cond)                                                          \
+  do {                                                                       \
+    if (!(cond)) {                                                           \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+                   #cond);                                                   \
+      g_fail++;                                                              \
+    }                                                                        \
+  } while (0)
+
+static constexpr int64_t MS = 1000;
+
+static ButtonLogic make(Ctx ctx, const bool* levels = nullptr) {
+  static const bool kUp[Btn::COUNT] = {};
+  ButtonLogic bl;
+  bl.configure(ButtonLogic::Config{});          // debounce 20 ms, long 300 ms, suppress 100 ms
+  bl.reset(levels ? levels : kUp);
+  bl.setContext(ctx, 0);
+  return bl;
+}
+
+static std::vector<ButtonLogic::Action> drain(ButtonLogic& bl) {
+  std::vector<ButtonLogic::Action> v;
+  ButtonLogic::Action a;
+  while (bl.pop(a)) v.push_back(a);
+  return v;
+}
+
+/* ロック中のチャタリングは無視。押下は最初のエッジで即確定、離しはロック明けに確定 */
+static void test_debounce_chatter() {
+  ButtonLogic bl = make(Ctx::HOME);
+  const int64_t t0 = 1000 * MS;
+  bl.onEdge(Btn::PREV, true, t0);
+  bl.onEdge(Btn::PREV, false, t0 + 1 * MS);
+  bl.onEdge(Btn::PREV, true, t0 + 2 * MS);
+  bl.onEdge(Btn::PREV, false, t0 + 5 * MS);
+  bl.onEdge(Btn::PREV, true, t0 + 6 * MS);
+  auto v = drain(bl);
+  CHECK(v.size() == 1);
+  CHECK(v.size() == 1 && v[0].act == Act::PREV && v[0].press_us == t0);
+  CHECK(bl.pressed(Btn::PREV));
+  CHECK(bl.nextDeadlineUs() == t0 + 20 * MS);
+
+  /* 離しのチャタリングが押下側で終わった → ロック明けでも押したまま */
+  bl.poll(t0 + 20 * MS);
+  CHECK(bl.pressed(Btn::PREV));
+  CHECK(bl.nextDeadlineUs() == ButtonLogic::NO_DEADLINE);
+
+  /* 離しも先行エッジで確定。ロック中の揺れは離したままで終われば何も起きない */
+  const int64_t t1 = t0 + 100 * MS;
+  bl.onEdge(Btn::PREV, false, t1);
+  bl.onEdge(Btn::PREV, true, t1 + 1 * MS);
+  bl.onEdge(Btn::PREV, false, t1 + 3 * MS);
+  CHECK(!bl.pressed(Btn::PREV));                // 最初の離しで確定、以降はロック中
+  bl.poll(t1 + 20 * MS);
+  CHECK(!bl.pressed(Btn::PREV));
+  CHECK(drain(bl).empty());                     // 離しではアクションを出さない
+
+  /* ロック中に押下で終わったチャタリングはロック明けに押下として確定する */
+  const int64_t t2 = t1 + 200 * MS;
+  bl.onEdge(Btn::NEXT, true, t2);
+  bl.onEdge(Btn::NEXT, false, t2 + 2 * MS);
+  bl.onEdge(Btn::NEXT, true, t2 + 4 * MS);
+  bl.onEdge(Btn::NEXT, false, t2 + 6 * MS);
+  bl.poll(t2 + 20 * MS);                        // 離しで確定（アクションなし）
+  CHECK(!bl.pressed(Btn::NEXT));
+  bl.onEdge(Btn::NEXT, true, t2 + 30 * MS);     // 離しのロック中（〜40 ms）に押下
+  bl.poll(t2 + 40 * MS);
+  CHECK(bl.pressed(Btn::NEXT));
+  v = drain(bl);
+  CHECK(v.size() == 2);
+  CHECK(v.size() == 2 && v[0].act == Act::NEXT && v[0].press_us == t2);
+  CHECK(v.size() == 2 && v[1].act == Act::NEXT && v[1].press_us == t2 + 40 * MS);
+}
+
+/* long_us 未満の離しは OK_SHORT、long_us ちょうどで OK_LONG（以降の離しは何も出さない） */
+static void test_ok_short_long() {
+  ButtonLogic bl = make(Ctx::HOME);
+  const int64_t L = ButtonLogic::Config{}.long_us;
+
+  const int64_t t0 = 1000 * MS;
+  bl.onEdge(Btn::OK, true, t0);
+  bl.poll(t0 + L - 1);
+  bl.onEdge(Btn::OK, false, t0 + L - 1);
+  auto v = drain(bl);
+  CHECK(v.size() == 2);
+  CHECK(v.size() == 2 && v[0].act == Act::OK_DOWN && v[0].press_us == t0);
+  CHECK(v.size() == 2 && v[1].act == Act::OK_SHORT && v[1].press_us == t0 && v[1].at_us == t0 + L - 1);
+
+  /* 押したまま long_us: リリースを待たずに OK_LONG（確定時刻は押下+long_us） */
+  const int64_t t1 = t0 + 1000 * MS;
+  bl.onEdge(Btn::OK, true, t1);
+  bl.poll(t1 + 20 * MS);
+  CHECK(bl.nextDeadlineUs() == t1 + L);
+  bl.poll(t1 + L - 1);
+  v = drain(bl);
+  CHECK(v.size() == 1 && v[0].act == Act::OK_DOWN);
+  bl.poll(t1 + L);
+  v = drain(bl);
+  CHECK(v.size() == 1 && v[0].act == Act::OK_LONG && v[0].press_us == t1 && v[0].at_us == t1 + L);
+  bl.onEdge(Btn::OK, false, t1 + 2 * L);
+  CHECK(drain(bl).empty());
+
+  /* poll が遅れてもちょうど long_us の離しは OK_LONG（onEdge が先に期限を処理する） */
+  const int64_t t2 = t1 + 1000 * MS;
+  bl.onEdge(Btn::OK, true, t2);
+  bl.onEdge(Btn::OK, false, t2 + L);
+  v = drain(bl);
+  CHECK(v.size() == 2);
+  CHECK(v.size() == 2 && v[1].act == Act::OK_LONG && v[1].at_us == t2 + L);
+
+  /* IDLE では何も出さない */
+  bl.setContext(Ctx::IDLE, t2 + 1000 * MS);
+  bl.onEdge(Btn::OK, true, t2 + 1000 * MS);
+  bl.poll(t2 + 1000 * MS + 2 * L);
+  CHECK(drain(bl).empty());
+}
+
+/* RUN 進入から suppress_us の間の押下は無視、以降は押下で OK_PRESS */
+static void test_run_suppress() {
+  ButtonLogic bl = make(Ctx::HOME);
+  const int64_t S = ButtonLogic::Config{}.suppress_us;
+  const int64_t t0 = 1000 * MS;
+  bl.setContext(Ctx::RUN, t0);
+
+  bl.onEdge(Btn::OK, true, t0 + S - 1);
+  bl.onEdge(Btn::OK, false, t0 + S + 30 * MS);
+  CHECK(drain(bl).empty());
+
+  bl.onEdge(Btn::OK, true, t0 + S + 60 * MS);
+  auto v = drain(bl);
+  CHECK(v.size() == 1 && v[0].act == Act::OK_PRESS && v[0].press_us == t0 + S + 60 * MS);
+
+  /* RUN では長押しの判定はしない */
+  bl.poll(t0 + S + 60 * MS + 2 * ButtonLogic::Config{}.long_us);
+  CHECK(drain(bl).empty());
+  CHECK(bl.nextDeadlineUs() == ButtonLogic::NO_DEADLINE);
+}
+
+/* 進入時に押されていた OK は離すまで無視（suppress_us を過ぎても） */
+static void test_run_ok_held_across_entry() {
+  ButtonLogic bl = make(Ctx::HOME);
+  const int64_t S = ButtonLogic::Config{}.suppress_us;
+  const int64_t t0 = 1000 * MS;
+  bl.onEdge(Btn::OK, true, t0);
+  CHECK(drain(bl).size() == 1);                 // OK_DOWN
+
+  bl.setContext(Ctx::RUN, t0 + 50 * MS);        // 長押しで RUN へ入った想定
+  bl.poll(t0 + 50 * MS + 3 * S);
+  CHECK(drain(bl).empty());
+  bl.onEdge(Btn::OK, false, t0 + 50 * MS + 3 * S);
+  CHECK(drain(bl).empty());
+
+  bl.onEdge(Btn::OK, true, t0 + 50 * MS + 4 * S);
+  auto v = drain(bl);
+  CHECK(v.size() == 1 && v[0].act == Act::OK_PRESS);
+
+  /* 起動時に押されていた OK も同じ扱い */
+  bool levels[Btn::COUNT] = {};
+  levels[Btn::OK] = true;
+  ButtonLogic b2 = make(Ctx::RUN, levels);
+  b2.poll(10 * S);
+  b2.onEdge(Btn::OK, false, 10 * S);
+  b2.onEdge(Btn::OK, true, 11 * S);
+  v = drain(b2);
+  CHECK(v.size() == 1 && v[0].act == Act::OK_PRESS && v[0].press_us == 11 * S);
+}
+
+int main() {
+  test_debounce_chatter();
+  test_ok_short_long();
+  test_run_suppress();
+  test_run_ok_held_across_entry();
+  if (g_fail) {
+    std::printf("FAILED: %d check(s)\n", g_fail);
+    return 1;
+  }
+  std::printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,235 @@
+/**
+ * copy_bench.cpp – 映像送出経路のフレームあたりコピー量を比べるホスト側ベンチマーク
+ * ---------------------------------------------------------------------------
+ *  • RTP/JPEG : packetize の payload を別バッファへ詰め直す従来の emit と、
+ *               headroom（rtpjpeg::PKT_HEADROOM）に RTP ヘッダを書く現在の emit
+ *  • WS 多重化: チャンクバッファへコピー + ライブラリの mask（従来）と、
+ *               WS ヘッダを別に作って iovec で繋ぐ現在の送出
+ *  • RTP 先読み: PacketPool の 2 面を交互に使い AsyncCopy でスキャン片を運ぶ packetize
+ *               （ホストでは GDMA が無いので memcpy。先読みの段取りの手間だけが見える）
+ *  • WS 単独  : sendBIN（コピー + mask）と、mask キー 0 で fb から直接送る現在の送出
+ *  ソケットには書かず、コピー（と mask の書き換え）バイト数と 1 フレームの処理時間だけを測る。
+ *  packetize はファームウェアと同じ rtp_jpeg.cpp をリンクする。
+ *
+ *  build: g++ -std=c++17 -O2 -I../../with_cross_device \
+ *           copy_bench.cpp ../../with_cross_device/rtp_jpeg.cpp \
+ *           ../../with_cross_device/AsyncCopy.cpp ../../with_cross_device/PacketPool.cpp \
+ *           -o copy_bench
+ */
+#include "rtp_jpeg.h"
+#include "AsyncCopy.h"
+#include "PacketPool.h"
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+using Frame = std::vector<uint8_t>;
+
+static uint64_t nowNs(){
+  timespec t; clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000ull + (uint64_t)t.tv_nsec;
+}
+
+struct Options {
+  std::string frame;                  // JPEG ファイル（省略時は合成）
+  size_t      scan  = 12000;          // 合成フレームのスキャン長
+  int         iters = 2000;
+  size_t      mtu   = RTP_PAYLOAD_MTU;
+  size_t      chunk = WS_MUX_CHUNK;
+};
+
+static void usage(const char* argv0){
+  fprintf(stderr,
+    "usage: %s [options]\n"
+    "  --frame FILE   測定に使う JPEG（省略時は合成フレーム）\n"
+    "  --scan N       合成フレームのスキャン長 [B] (default 12000)\n"
+    "  --iters N      繰り返し回数 (default 2000)\n"
+    "  --mtu N        RTP payload 上限 (default %u)\n"
+    "  --chunk N      WS 多重化のチャンク長 (default %u)\n",
+    argv0, (unsigned)RTP_PAYLOAD_MTU, (unsigned)WS_MUX_CHUNK);
+}
+
+static bool parseArgs(int argc, char** argv, Options& o){
+  for (int i = 1; i < argc; ++i){
+    std::string a = argv[i];
+    const char* v = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    if (a == "-h" || a == "--help") return false;
+    if (!v) { fprintf(stderr, "missing value for %s\n", a.c_str()); return false; }
+    ++i;
+    if      (a == "--frame") o.frame = v;
+    else if (a == "--scan")  o.scan  = (size_t)atol(v);
+    else if (a == "--iters") o.iters = atoi(v);
+    else if (a == "--mtu")   o.mtu   = (size_t)atol(v);
+    else if (a == "--chunk") o.chunk = (size_t)atol(v);
+    else { fprintf(stderr, "unknown option %s\n", a.c_str()); return false; }
+  }
+  return o.iters > 0 && o.chunk > 0 && o.chunk < 65534;
+}
+
+static bool readFile(const std::string& p, Frame& out){
+  FILE* f = fopen(p.c_str(), "rb");
+  if (!f) return false;
+  uint8_t b[4096]; size_t n;
+  while ((n = fread(b, 1, sizeof(b), f)) > 0) out.insert(out.end(), b, b + n);
+  fclose(f);
+  return !out.empty();
+}
+
+// packetize が必要とする DQT / SOF0 / SOS..EOI だけを持つ合成フレーム（swarm_loadgen と同じ）
+static Frame synthFrame(size_t scan_bytes){
+  std::mt19937 rng(1);
+  Frame f = { 0xFF, 0xD8 };
+  auto put16 = [&](uint16_t v){ f.push_back(uint8_t(v >> 8)); f.push_back(uint8_t(v)); };
+  for (uint8_t tq = 0; tq < 2; ++tq){
+    f.push_back(0xFF); f.push_back(0xDB); put16(2 + 65); f.push_back(tq);
+    for (int k = 0; k < 64; ++k) f.push_back(uint8_t(8 + k / 4 + tq * 4));
+  }
+  f.push_back(0xFF); f.push_back(0xC0); put16(17); f.push_back(8); put16(240); put16(240); f.push_back(3);
+  const uint8_t comp[3][3] = { {1, 0x21, 0}, {2, 0x11, 1}, {3, 0x11, 1} };
+  for (auto& c : comp) f.insert(f.end(), c, c + 3);
+  f.push_back(0xFF); f.push_back(0xDA); put16(12); f.push_back(3);
+  const uint8_t sos[6] = { 1, 0x00, 2, 0x11, 3, 0x11 };
+  f.insert(f.end(), sos, sos + 6); f.push_back(0); f.push_back(63); f.push_back(0);
+  std::uniform_int_distribution<int> byte(0, 0xFE);
+  for (size_t i = 0; i < scan_bytes; ++i) f.push_back(uint8_t(byte(rng)));
+  f.push_back(0xFF); f.push_back(0xD9);
+  return f;
+}
+
+/* ===== 計測 ============================================================= */
+struct Result { const char* name; uint64_t bytes = 0; double ns = 0; };
+static volatile uint32_t gSink;       // 最適化で消されないように
+
+template<class F>
+static Result run(const char* name, int iters, F body){
+  Result r; r.name = name;
+  r.bytes = body();                                  // 1 回目でバイト数を数える
+  uint64_t t0 = nowNs();
+  for (int i = 0; i < iters; ++i) body();
+  r.ns = double(nowNs() - t0) / iters;
+  return r;
+}
+
+/* RTP: 従来は payload を datagram バッファへ memcpy してからヘッダを付けていた */
+static PacketPool gPool;
+
+static uint64_t rtpCopy(const Frame& f, size_t mtu){
+  uint64_t copied = 0;
+  uint8_t  dg[rtpjpeg::RTP_HDR_LEN + 1800];
+  uint16_t seq = 0;
+  rtpjpeg::packetize(f.data(), f.size(), 240, 240, rtpjpeg::JpegType::YUV422, 0, 0, mtu,
+    [&](uint8_t* p, size_t n, bool last)->bool {
+      copied += n;                                   // packetize 内の組み立て
+      rtpjpeg::write_rtp_header(dg, last, RTP_PT_JPEG, seq++, 0, 1);
+      memcpy(dg + rtpjpeg::RTP_HDR_LEN, p, n); copied += n;
+      gSink += dg[rtpjpeg::RTP_HDR_LEN + n - 1];
+      return true;
+    }, gPool);
+  return copied;
+}
+
+static uint64_t rtpHeadroom(const Frame& f, size_t mtu){
+  uint64_t copied = 0;
+  uint16_t seq = 0;
+  rtpjpeg::packetize(f.data(), f.size(), 240, 240, rtpjpeg::JpegType::YUV422, 0, 0, mtu,
+    [&](uint8_t* p, size_t n, bool last)->bool {
+      copied += n;                                   // packetize 内の組み立てのみ
+      uint8_t* dg = p - rtpjpeg::RTP_HDR_LEN;
+      rtpjpeg::write_rtp_header(dg, last, RTP_PT_JPEG, seq++, 0, 1);
+      gSink += dg[rtpjpeg::RTP_HDR_LEN + n - 1];
+      return true;
+    }, gPool);
+  return copied;
+}
+
+static uint64_t rtpPrefetch(const Frame& f, size_t mtu, AsyncCopy& cp){
+  uint64_t copied = 0;
+  uint16_t seq = 0;
+  rtpjpeg::packetize(f.data(), f.size(), 240, 240, rtpjpeg::JpegType::YUV422, 0, 0, mtu,
+    [&](uint8_t* p, size_t n, bool last)->bool {
+      copied += n;
+      uint8_t* dg = p - rtpjpeg::RTP_HDR_LEN;
+      rtpjpeg::write_rtp_header(dg, last, RTP_PT_JPEG, seq++, 0, 1);
+      gSink += dg[rtpjpeg::RTP_HDR_LEN + n - 1];
+      return true;
+    }, gPool, &cp);
+  return copied;
+}
+
+/* WebSocketsClient の client 送信: payload をコピーして 4B キーで mask する */
+static uint64_t maskInPlace(uint8_t* p, size_t n){
+  const uint8_t key[4] = { 0x12, 0x34, 0x56, 0x78 };
+  for (size_t i = 0; i < n; ++i) p[i] ^= key[i & 3];
+  return n;
+}
+
+static uint64_t wsMuxCopy(const Frame& f, size_t chunk, std::vector<uint8_t>& buf){
+  uint64_t copied = 0;
+  buf.resize(14 + 2 + chunk);
+  for (size_t off = 0; off < f.size(); off += chunk){
+    size_t n = std::min(chunk, f.size() - off);
+    uint8_t* h = buf.data() + 14;
+    h[0] = 0; h[1] = 0;
+    memcpy(h + 2, f.data() + off, n); copied += n;
+    copied += maskInPlace(h, n + 2);
+    gSink += h[n + 1];
+  }
+  return copied;
+}
+
+static uint64_t wsMuxIovec(const Frame& f, size_t chunk){
+  for (size_t off = 0; off < f.size(); off += chunk){
+    size_t n = std::min(chunk, f.size() - off);
+    uint8_t h[10] = { 0x82, 0x80 | 126, uint8_t((n + 2) >> 8), uint8_t(n + 2), 0, 0, 0, 0, 0, 0 };
+    gSink += h[3] + f[off + n - 1];                  // iovec = {h, 10} + {fb + off, n}
+  }
+  return 0;
+}
+
+static uint64_t wsSendBin(const Frame& f, std::vector<uint8_t>& buf){
+  buf.resize(14 + f.size());
+  memcpy(buf.data() + 14, f.data(), f.size());
+  uint64_t copied = f.size() + maskInPlace(buf.data() + 14, f.size());
+  gSink += buf.back();
+  return copied;
+}
+
+int main(int argc, char** argv){
+  Options o;
+  if (!parseArgs(argc, argv, o)) { usage(argv[0]); return 2; }
+
+  Frame f;
+  if (!o.frame.empty()) {
+    if (!readFile(o.frame, f)) { fprintf(stderr, "cannot read %s\n", o.frame.c_str()); return 1; }
+  } else {
+    f = synthFrame(o.scan);
+  }
+  printf("[copy_bench] frame=%zu B mtu=%zu chunk=%zu iters=%d\n", f.size(), o.mtu, o.chunk, o.iters);
+
+  std::vector<uint8_t> buf;
+  AsyncCopy cp;
+  cp.begin();                                        // ホストでは常に memcpy
+  if (!gPool.begin(RTP_POOL_PKTS, rtpjpeg::pkt_buf_size(o.mtu), PacketPool::Mem::DMA)) return 1;
+  Result rs[] = {
+    run("rtp  copy-to-datagram", o.iters, [&]{ return rtpCopy(f, o.mtu); }),
+    run("rtp  headroom",         o.iters, [&]{ return rtpHeadroom(f, o.mtu); }),
+    run("rtp  headroom+prefetch",o.iters, [&]{ return rtpPrefetch(f, o.mtu, cp); }),
+    run("ws   mux chunk+mask",   o.iters, [&]{ return wsMuxCopy(f, o.chunk, buf); }),
+    run("ws   mux iovec",        o.iters, [&]{ return wsMuxIovec(f, o.chunk); }),
+    run("ws   sendBIN+mask",     o.iters, [&]{ return wsSendBin(f, buf); }),
+    run("ws   direct (mask=0)",  o.iters, [&]{ gSink += f.back(); return (uint64_t)0; }),
+  };
+  printf("%-24s %14s %10s %12s\n", "path", "copied B/frame", "x frame", "ns/frame");
+  for (auto& r : rs)
+    printf("%-24s %14llu %10.2f %12.0f\n", r.name, (unsigned long long)r.bytes,
+           double(r.bytes) / f.size(), r.ns);
+  return 0;
+}
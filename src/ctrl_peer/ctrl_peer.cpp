@@ -0,0 +1,183 @@
+/**
+ * ctrl_peer.cpp – UDP 制御チャネル（CtrlProto）のホスト側参照実装
+ * ---------------------------------------------------------------------------
+ *  • 端末の HELLO から宛先アドレスを学習し、MODE / BUTTON を表示して ACK を返す
+ *  • 標準入力の 1 / 0 でモータ ON / OFF を送る（ACK で RTT を表示）
+ *  • --loss で送受とも擬似的に落とし、再送と重複排除を確かめられる
+ *  • 再送・重複排除はファームウェアと同じ CtrlProto.cpp を使う
+ *
+ *  build: g++ -std=c++17 -O2 -I../../with_cross_device \
+ *           ctrl_peer.cpp ../../with_cross_device/CtrlProto.cpp -o ctrl_peer
+ */
+#include "CtrlProto.h"
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <random>
+#include <string>
+
+using namespace ctrlproto;
+
+static uint32_t nowUs(){
+  timespec t; clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint32_t)((uint64_t)t.tv_sec * 1000000ull + (uint64_t)t.tv_nsec / 1000);
+}
+
+struct Options {
+  uint16_t    port = CTRL_UDP_PORT;
+  std::string device;                 // 省略時は HELLO から学習
+  double      loss = 0;               // 擬似ロス率 [%]
+  uint32_t    rto_ms = CTRL_UDP_RTO_MS;
+  uint32_t    auto_motor_ms = 0;      // >0 なら周期的に ON/OFF を送る
+};
+
+static void usage(const char* argv0){
+  fprintf(stderr,
+    "usage: %s [options]\n"
+    "  --port N             bind / 宛先ポート (default %u)\n"
+    "  --device IP          端末 IP（省略時は HELLO から学習）\n"
+    "  --loss P             送受とも P %% を捨てる（再送・重複排除の確認用）\n"
+    "  --rto MS             再送タイムアウト (default %u)\n"
+    "  --auto-motor MS      MS ごとにモータ ON/OFF を交互に送る\n"
+    "stdin: 1=motor ON, 0=motor OFF, q=quit\n",
+    argv0, (unsigned)CTRL_UDP_PORT, (unsigned)CTRL_UDP_RTO_MS);
+}
+
+static bool parseArgs(int argc, char** argv, Options& o){
+  for (int i = 1; i < argc; ++i){
+    std::string a = argv[i];
+    auto val = [&]()->const char* { return (i + 1 < argc) ? argv[++i] : nullptr; };
+    const char* v = nullptr;
+    if (a == "-h" || a == "--help") return false;
+    if (!(v = val())) { fprintf(stderr, "missing value for %s\n", a.c_str()); return false; }
+
+    if      (a == "--port")       o.port = (uint16_t)atoi(v);
+    else if (a == "--device")     o.device = v;
+    else if (a == "--loss")       o.loss = atof(v);
+    else if (a == "--rto")        o.rto_ms = (uint32_t)atoi(v);
+    else if (a == "--auto-motor") o.auto_motor_ms = (uint32_t)atoi(v);
+    else { fprintf(stderr, "unknown option %s\n", a.c_str()); return false; }
+  }
+  return true;
+}
+
+static const char* actStr(uint8_t a){
+  static const char* s[] = { "PREV", "NEXT", "BACK", "OK_SHORT", "OK_LONG", "OK_PRESS" };
+  return a < 6 ? s[a] : "?";
+}
+
+int main(int argc, char** argv){
+  Options o;
+  if (!parseArgs(argc, argv, o)) { usage(argv[0]); return 1; }
+
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in local{};
+  local.sin_family = AF_INET; local.sin_port = htons(o.port); local.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(sock, (sockaddr*)&local, sizeof(local)) < 0) { perror("bind"); return 1; }
+
+  sockaddr_in dev{};
+  bool known = false;
+  if (!o.device.empty()) {
+    dev.sin_family = AF_INET; dev.sin_port = htons(o.port);
+    known = inet_pton(AF_INET, o.device.c_str(), &dev.sin_addr) == 1;
+  }
+
+  std::mt19937 rng(nowUs());
+  std::uniform_real_distribution<double> U(0, 100);
+  auto lost = [&]{ return o.loss > 0 && U(rng) < o.loss; };
+
+  CtrlPeer cp;
+  uint32_t nonce = nowUs() ^ (uint32_t)rng();
+  cp.begin([&](const uint8_t* d, size_t n){
+             if (!known || lost()) return;
+             sendto(sock, d, n, 0, (sockaddr*)&dev, sizeof(dev));
+           },
+           o.rto_ms * 1000, CTRL_UDP_MAX_TRIES, nonce);
+  {
+    uint8_t b[4] = { uint8_t(nonce >> 24), uint8_t(nonce >> 16), uint8_t(nonce >> 8), uint8_t(nonce) };
+    if (known) cp.send(Type::HELLO, b, 4, nowUs());
+  }
+  fprintf(stderr, "listening udp :%u%s\n", (unsigned)o.port, known ? "" : " (waiting HELLO)");
+
+  CtrlPeer::Stats last;
+  uint32_t tAuto = nowUs();
+  bool motor = false;
+  uint16_t modeSeq = 0; bool modeSeen = false; uint32_t modeEpoch = 0;
+  for (;;) {
+    uint32_t now = nowUs();
+    uint32_t w = cp.nextDeadlineUs(now);
+    int timeout = (w == UINT32_MAX) ? 100 : (int)(w / 1000) + 1;
+    pollfd pf[2] = { { sock, POLLIN, 0 }, { 0, POLLIN, 0 } };
+    poll(pf, 2, timeout);
+    now = nowUs();
+
+    if (pf[0].revents & POLLIN) {
+      uint8_t buf[256];
+      sockaddr_in from{}; socklen_t fl = sizeof(from);
+      ssize_t n = recvfrom(sock, buf, sizeof(buf), 0, (sockaddr*)&from, &fl);
+      if (n > 0 && !lost()) {
+        if (!known) {
+          dev = from; known = true;
+          char ip[32]; inet_ntop(AF_INET, &from.sin_addr, ip, sizeof(ip));
+          printf("device %s:%u\n", ip, (unsigned)ntohs(from.sin_port));
+        }
+        Msg m;
+        if (cp.onDatagram(buf, (size_t)n, now, m)) {
+          switch (m.type) {
+            case Type::MODE: {
+              // 再送で順序が入れ替わることがある。モードは状態なので新しい seq だけ採用
+              if (m.epoch != modeEpoch) { modeEpoch = m.epoch; modeSeen = false; }   // 端末の再起動
+              bool stale = modeSeen && (int16_t)(m.seq - modeSeq) < 0;
+              if (!stale) { modeSeq = m.seq; modeSeen = true; }
+              printf("MODE   0x%04X  seq=%u dev_ts=%u%s\n", m.u16(), m.seq, m.ts_us, stale ? " (stale, ignored)" : "");
+            } break;
+            case Type::BUTTON: {
+              uint32_t press = m.len >= 5 ? (uint32_t(m.payload[1]) << 24 | uint32_t(m.payload[2]) << 16 |
+                                             uint32_t(m.payload[3]) << 8 | m.payload[4]) : 0;
+              unsigned ev = m.len >= 7 ? (unsigned)(m.payload[5] << 8 | m.payload[6]) : 0;
+              printf("BUTTON %-8s seq=%u press_us=%u event=%u (sent %u us later)\n",
+                     actStr(m.payload[0]), m.seq, press, ev, m.ts_us - press);
+            } break;
+            case Type::HELLO:  printf("HELLO  seq=%u\n", m.seq); break;
+            default:           printf("type=%u seq=%u\n", (unsigned)m.type, m.seq); break;
+          }
+        }
+      }
+    }
+
+    auto sendMotor = [&](bool on){
+      if (!known) { fprintf(stderr, "device unknown yet\n"); return; }
+      motor = on;
+      if (!cp.sendU16(Type::MOTOR, on ? 0x0001 : 0x0000, nowUs())) fprintf(stderr, "pending full\n");
+    };
+    if (pf[1].revents & POLLIN) {
+      char line[64];
+      if (!fgets(line, sizeof(line), stdin) || line[0] == 'q') break;
+      if (line[0] == '1') sendMotor(true);
+      else if (line[0] == '0') sendMotor(false);
+    }
+    if (o.auto_motor_ms && known && now - tAuto >= o.auto_motor_ms * 1000) {
+      tAuto = now;
+      sendMotor(!motor);
+    }
+
+    cp.tick(nowUs());
+    const auto& st = cp.stats();
+    if (st.acked != last.acked) printf("ACK    rtt=%u us\n", st.rtt_last_us);
+    if (st.retransmits != last.retransmits) printf("RETX   total=%u\n", st.retransmits);
+    if (st.gave_up != last.gave_up) printf("GAVEUP total=%u\n", st.gave_up);
+    if (st.dups != last.dups) printf("DUP    total=%u\n", st.dups);
+    last = st;
+    fflush(stdout);
+  }
+  return 0;
+}
@@ -0,0 +1,137 @@
+"""with_cross_device のバイナリログ（LOG_OUTPUT_BINARY=1）を復号して表示する。
+
+frame: A5 5A | type(1) | len(1) | payload(len)   （数値は little-endian）
+  0x01 STR  : id(u16) + 文字列（tag / fmt の辞書）
+  0x02 REC  : ts_us(u64) level(1) core(1) tag_id(u16) fmt_id(u16) flags(1) + args
+  0x03 DROP : core(1) count(u32)
+args の詰め方は NetDebug.h と同じ（整数≤32bit→4B, %ll/%j→8B, 浮動小数→8B double,
+文字列→長さ1B+本体）。
+"""
+import argparse
+import re
+import struct
+import sys
+
+LEVELS = "DIWE"
+SPEC = re.compile(r"%(%|[-+ #0-9.]*)([hlzjt]*)([a-zA-Z%])")
+
+
+def format_args(fmt, args, truncated):
+    """fmt の変換指定子を順に読みながら args を取り出して整形する"""
+    pos = 0
+    out = []
+    last = 0
+    missing = False
+
+    def take(n):
+        nonlocal pos, missing
+        if pos + n > len(args):
+            missing = True
+            return None
+        b = args[pos:pos + n]
+        pos += n
+        return b
+
+    for m in SPEC.finditer(fmt):
+        out.append(fmt[last:m.start()])
+        last = m.end()
+        flags, length, conv = m.group(1), m.group(2), m.group(3)
+        if flags == "%" or conv == "%":
+            out.append("%")
+            continue
+        wide = length.count("l") >= 2 or "j" in length
+        if conv == "s":
+            n = take(1)
+            s = take(n[0]).decode("utf-8", "replace") if n else ""
+            out.append(("%" + flags + "s") % (s or ""))
+        elif conv in "fFeEgG":
+            b = take(8)
+            out.append(("%" + flags + conv) % (struct.unpack("<d", b)[0] if b else 0.0))
+        elif conv in "diuxXoc":
+            b = take(8 if wide else 4)
+            signed = conv in "di"
+            if b is None:
+                v = 0
+            elif wide:
+                v = struct.unpack("<q" if signed else "<Q", b)[0]
+            else:
+                v = struct.unpack("<i" if signed else "<I", b)[0]
+            py = "d" if conv == "u" else conv
+            out.append(("%" + flags + py) % v)
+        elif conv == "p":
+            b = take(4)
+            out.append("0x%08x" % (struct.unpack("<I", b)[0] if b else 0))
+        else:
+            out.append(m.group(0))
+    out.append(fmt[last:])
+    s = "".join(out)
+    if truncated or missing:
+        s += " <trunc>"
+    return s
+
+
+class Decoder:
+    def __init__(self, out):
+        self.strings = {}
+        self.buf = bytearray()
+        self.out = out
+
+    def feed(self, data):
+        self.buf += data
+        while True:
+            i = self.buf.find(b"\xa5\x5a")
+            if i < 0:
+                del self.buf[:-1]
+                return
+            if i:
+                del self.buf[:i]
+            if len(self.buf) < 4 or len(self.buf) < 4 + self.buf[3]:
+                return
+            typ, n = self.buf[2], self.buf[3]
+            payload = bytes(self.buf[4:4 + n])
+            del self.buf[:4 + n]
+            self.frame(typ, payload)
+
+    def s(self, sid):
+        return self.strings.get(sid, "<#%d>" % sid)
+
+    def frame(self, typ, p):
+        if typ == 0x01 and len(p) >= 2:
+            self.strings[struct.unpack_from("<H", p)[0]] = p[2:].decode("utf-8", "replace")
+        elif typ == 0x02 and len(p) >= 15:
+            ts, lvl, core, tid, fid, flags = struct.unpack_from("<QBBHHB", p)
+            fmt = self.strings.get(fid)
+            if fmt is None:
+                msg = "<fmt#%d> args=%s" % (fid, p[15:].hex())
+            else:
+                msg = format_args(fmt, p[15:], flags & 0x01)
+            lv = LEVELS[lvl] if lvl < len(LEVELS) else "?"
+            self.out.write("[%d us][%s][%s][core:%d] %s\n" % (ts, lv, self.s(tid), core, msg))
+        elif typ == 0x03 and len(p) >= 5:
+            core, cnt = struct.unpack_from("<BI", p)
+            self.out.write("[W][NetDebug][core:%d] dropped %d records\n" % (core, cnt))
+        self.out.flush()
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("source", help="シリアルポート（例: /dev/ttyACM0）またはキャプチャ済みファイル")
+    ap.add_argument("--baud", type=int, default=115200)
+    args = ap.parse_args()
+
+    dec = Decoder(sys.stdout)
+    if args.source.startswith("/dev/") or args.source.upper().startswith("COM"):
+        import serial  # pyserial
+        with serial.Serial(args.source, args.baud, timeout=0.1) as port:
+            try:
+                while True:
+                    dec.feed(port.read(4096))
+            except KeyboardInterrupt:
+                pass
+    else:
+        with open(args.source, "rb") as f:
+            dec.feed(f.read())
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,136 @@
+"""with_cross_device が送る RTCP APP "WXMT"（Metrics）を受信して表示する。
+
+payload（big-endian）:
+  ver(1)=1 | n(1) | uptime_ms(4) | entries...
+    entry: id(1) kind(1) +
+      kind 0 COUNTER / 1 GAUGE : value(4)
+      kind 2 HIST : count(4) sum(4) max(4) mask(4) + 非ゼロバケット値(4)×popcount(mask)
+  バケット k: 2^(k-1) <= v < 2^k（k=0 は v=0）。count/sum/バケットは累積、max は前回送出以降。
+"""
+import argparse
+import socket
+import struct
+import sys
+import time
+
+# Metrics.h の Id と同じ順番
+NAMES = [
+    "rtp_pkts", "rtp_drops", "rtp_frames",
+    "ws_frames", "ws_drops", "ws_reconnects", "wifi_disconnects", "ctrl_cmds", "ctrl_retx",
+    "ws_stalls", "pkt_pool_fails", "stream_switches", "cam_stale_drops", "fetch_chunks", "history_misses",
+    "ws_q_depth", "ws_inflight", "heap_free", "heap_min_free", "psram_free", "pkt_pool_hwm",
+    "stream_active", "stream_loss_permille", "history_span_ms",
+    "capture_us", "packetize_us", "send_us", "frame_bytes",
+    "btn_to_action_us", "cmd_to_wire_us", "frame_to_wire_us", "ctrl_to_motor_us", "ctrl_rtt_us",
+    "ws_reconnect_ms", "cam_switch_us", "mode_first_frame_us", "snap_us", "snap_gap_us",
+    "history_lag_us",
+]
+
+
+def name(i):
+    return NAMES[i] if i < len(NAMES) else "id%d" % i
+
+
+def parse_wxmt(data):
+    ver, n, uptime = struct.unpack_from(">BBI", data)
+    if ver != 1:
+        return None
+    p = 6
+    out = {}
+    for _ in range(n):
+        mid, kind = data[p], data[p + 1]
+        p += 2
+        if kind in (0, 1):
+            out[mid] = (kind, struct.unpack_from(">I", data, p)[0])
+            p += 4
+        else:
+            count, total, vmax, mask = struct.unpack_from(">IIII", data, p)
+            p += 16
+            buckets = {}
+            for k in range(32):
+                if mask & (1 << k):
+                    buckets[k] = struct.unpack_from(">I", data, p)[0]
+                    p += 4
+            out[mid] = (kind, (count, total, vmax, buckets))
+    return uptime, out
+
+
+def iter_rtcp(pkt):
+    """compound RTCP から (pt, ssrc, name, app_data) を取り出す"""
+    p = 0
+    while p + 4 <= len(pkt):
+        b0, pt, words = struct.unpack_from(">BBH", pkt, p)
+        size = (words + 1) * 4
+        if (b0 >> 6) != 2 or p + size > len(pkt):
+            return
+        if pt == 204 and size >= 12:
+            ssrc = struct.unpack_from(">I", pkt, p + 4)[0]
+            yield ssrc, pkt[p + 8:p + 12], pkt[p + 12:p + size]
+        p += size
+
+
+def quantile(buckets, q):
+    total = sum(buckets.values())
+    if not total:
+        return 0
+    acc = 0
+    for k in sorted(buckets):
+        acc += buckets[k]
+        if acc >= q * total:
+            return (1 << k) - 1 if k else 0     # バケット上限
+    return 0
+
+
+def report(ssrc, addr, prev, cur):
+    t0, m0 = prev
+    t1, m1 = cur
+    dt = max((t1 - t0) / 1000.0, 1e-3)
+    cols = []
+    for mid in sorted(m1):
+        kind, v = m1[mid]
+        if kind == 0:
+            d = (v - m0.get(mid, (0, v))[1]) & 0xFFFFFFFF
+            cols.append("%s=%.1f/s" % (name(mid), d / dt))
+        elif kind == 1:
+            cols.append("%s=%d" % (name(mid), v))
+        else:
+            count, total, vmax, b = v
+            pc, ps, _, pb = m0.get(mid, (2, (0, 0, 0, {})))[1]
+            dc = (count - pc) & 0xFFFFFFFF
+            ds = (total - ps) & 0xFFFFFFFF
+            db = {k: b[k] - pb.get(k, 0) for k in b if b[k] - pb.get(k, 0) > 0}
+            if dc:
+                cols.append("%s avg=%d p50<%d p99<%d max=%d" % (
+                    name(mid), ds // dc, quantile(db, 0.5), quantile(db, 0.99), vmax))
+    print("[%s ssrc=%08x up=%.1fs] %s" % (addr, ssrc, t1 / 1000.0, "  ".join(cols)))
+    sys.stdout.flush()
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("--port", type=int, default=5541, help="RTCP port (RTP_PORT+1, default 5541)")
+    args = ap.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("0.0.0.0", args.port))
+    print("[INFO] Listening RTCP APP 'WXMT' on UDP %d ..." % args.port)
+    last = {}
+    while True:
+        pkt, addr = sock.recvfrom(2048)
+        for ssrc, nm, data in iter_rtcp(pkt):
+            if nm != b"WXMT":
+                continue
+            cur = parse_wxmt(data)
+            if cur is None:
+                continue
+            key = (addr[0], ssrc)
+            if key in last:
+                report(ssrc, addr[0], last[key], cur)
+            last[key] = cur
+
+
+if __name__ == "__main__":
+    try:
+        sys.exit(main())
+    except KeyboardInterrupt:
+        pass
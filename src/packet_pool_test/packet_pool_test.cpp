@@ -0,0 +1,201 @@
+// PacketPool のホストテスト: 枯渇・不正な free・high-water・2 スレッドでの alloc/free
+#include "PacketPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <thread>
+#include <vector>
+
+static int g_fail = 0;
+
+#define CHECK(cond)                                                          \
+  do {                                                                       \
+    if (!(cond)) {                                                           \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+                   #cond);                                                   \
+      g_fail++;                                                              \
+    }                                                                        \
+  } while (0)
+
+static void test_begin_args() {
+  PacketPool p;
+  CHECK(!p.begin(0, 100, PacketPool::Mem::DMA));
+  CHECK(!p.begin(PacketPool::kMaxCount + 1, 100, PacketPool::Mem::DMA));
+  CHECK(!p.begin(4, 0, PacketPool::Mem::DMA));
+  CHECK(!p.begin(4, 100, PacketPool::Mem::DMA, 24));        // align は 2 の冪
+  CHECK(!p.ready());
+  CHECK(p.alloc() == nullptr);
+}
+
+/* count 個までは別々のバッファ、その先は nullptr と fails() */
+static void test_exhaustion() {
+  constexpr size_t N = 8;
+  PacketPool p;
+  CHECK(p.begin(N, 100, PacketPool::Mem::DMA, 16));
+  CHECK(p.count() == N && p.bufSize() == 100);
+
+  std::set<uint8_t*> got;
+  for (size_t i = 0; i < N; ++i) {
+    uint8_t* b = p.alloc();
+    CHECK(b != nullptr);
+    CHECK(((uintptr_t)b & 15) == 0);
+    CHECK(p.owns(b));
+    memset(b, (int)i, p.bufSize());             // bufSize まで書ける（隣を壊さない）
+    got.insert(b);
+  }
+  CHECK(got.size() == N);
+  CHECK(p.inUse() == N);
+  CHECK(p.fails() == 0);
+
+  CHECK(p.alloc() == nullptr);
+  CHECK(p.alloc() == nullptr);
+  CHECK(p.fails() == 2);
+  CHECK(p.inUse() == N);
+
+  for (uint8_t* b : got) CHECK(b[0] == b[p.bufSize() - 1]);
+  for (uint8_t* b : got) p.free(b);
+  CHECK(p.inUse() == 0);
+  uint8_t* b = p.alloc();                       // 戻したものは再び使える
+  CHECK(b != nullptr);
+  p.free(b);
+}
+
+/* alloc() で得ていないポインタの free は無視（空きリストを壊さない） */
+static void test_foreign_free() {
+  constexpr size_t N = 4;
+  PacketPool p, other;
+  CHECK(p.begin(N, 64, PacketPool::Mem::DMA, 16));
+  CHECK(other.begin(N, 64, PacketPool::Mem::DMA, 16));
+
+  uint8_t* a = p.alloc();
+  uint8_t  stack[64];
+  uint8_t* o = other.alloc();
+  p.free(stack);
+  p.free(o);                                    // 別プールのもの
+  p.free(a + 1);                                // 境界からずれている
+  p.free(a + 64 + 16);                          // 隣のバッファの途中
+  p.free(nullptr);
+  CHECK(p.inUse() == 1);
+  CHECK(!p.owns(stack) && !p.owns(o) && !p.owns(a + 1) && p.owns(a));
+
+  /* 壊れていなければ残りちょうど N-1 個が別々に取れる */
+  std::set<uint8_t*> rest;
+  for (uint8_t* b; (b = p.alloc()) != nullptr;) rest.insert(b);
+  CHECK(rest.size() == N - 1);
+  CHECK(rest.count(a) == 0);
+  for (uint8_t* b : rest) p.free(b);
+  p.free(a);
+  other.free(o);
+  CHECK(p.inUse() == 0 && other.inUse() == 0);
+}
+
+/* high-water は最大同時使用数。free しても下がらない */
+static void test_high_water() {
+  PacketPool p;
+  CHECK(p.begin(16, 32, PacketPool::Mem::PSRAM));
+  CHECK(p.highWater() == 0);
+  std::vector<uint8_t*> v;
+  for (int i = 0; i < 5; ++i) v.push_back(p.alloc());
+  CHECK(p.highWater() == 5);
+  for (int i = 0; i < 3; ++i) { p.free(v.back()); v.pop_back(); }
+  CHECK(p.inUse() == 2 && p.highWater() == 5);
+  for (int i = 0; i < 2; ++i) v.push_back(p.alloc());
+  CHECK(p.inUse() == 4 && p.highWater() == 5);
+  for (int i = 0; i < 4; ++i) v.push_back(p.alloc());
+  CHECK(p.highWater() == 8);
+  for (uint8_t* b : v) p.free(b);
+  CHECK(p.inUse() == 0 && p.highWater() == 8);
+}
+
+/* 2 スレッドで alloc/free を繰り返す。同じバッファを 2 か所に渡したら owner 表で分かる。
+ * バッファには持ち主の印を書き、free の直前に書き換えられていないことも見る */
+static void test_two_threads() {
+  constexpr size_t N = 32, ROUNDS = 2000000, HOLD = 20;   // 2 x HOLD > N で枯渇も起こす
+  PacketPool p;
+  CHECK(p.begin(N, 48, PacketPool::Mem::DMA, 16));
+
+  /* バッファ → 番号（先に全部取って並べる） */
+  std::vector<uint8_t*> bufs;
+  for (uint8_t* b; (b = p.alloc()) != nullptr;) bufs.push_back(b);
+  CHECK(bufs.size() == N);
+  std::sort(bufs.begin(), bufs.end());
+  for (uint8_t* b : bufs) p.free(b);
+  auto index = [&](uint8_t* b) {
+    return (size_t)(std::lower_bound(bufs.begin(), bufs.end(), b) - bufs.begin());
+  };
+
+  std::vector<std::atomic<int>> owner(N);
+  for (auto& o : owner) o.store(0);
+  std::atomic<uint32_t> dup{0}, corrupt{0}, unknown{0}, allocs{0}, nulls{0};
+
+  std::atomic<int> ready{0};
+  auto worker = [&](int id) {
+    std::vector<uint8_t*> held;
+    ready++;
+    while (ready.load() < 2) {}                 // 同時に走らせる
+    uint32_t rng = 0x9E3779B9u * (uint32_t)id;
+    for (size_t r = 0; r < ROUNDS; ++r) {
+      rng = rng * 1664525u + 1013904223u;
+      bool doAlloc = held.empty() || (held.size() < HOLD && ((rng >> 16) & 1));
+      if (doAlloc) {
+        uint8_t* b = p.alloc();
+        if (!b) { nulls++; continue; }
+        allocs++;
+        size_t i = index(b);
+        if (i >= N || bufs[i] != b) { unknown++; continue; }
+        if (owner[i].exchange(id) != 0) dup++;
+        memset(b, id, p.bufSize());
+        held.push_back(b);
+      } else {
+        size_t k = (rng >> 8) % held.size();
+        uint8_t* b = held[k];
+        held[k] = held.back();
+        held.pop_back();
+        for (size_t j = 0; j < p.bufSize(); ++j)
+          if (b[j] != (uint8_t)id) { corrupt++; break; }
+        if (owner[index(b)].exchange(0) != id) dup++;
+        p.free(b);
+      }
+    }
+    for (uint8_t* b : held) {
+      owner[index(b)].store(0);
+      p.free(b);
+    }
+  };
+  std::thread t1(worker, 1), t2(worker, 2);
+  t1.join();
+  t2.join();
+
+  std::printf("two threads: %u allocs, %u empty, hwm %u\n", (unsigned)allocs.load(),
+              (unsigned)nulls.load(), (unsigned)p.highWater());
+  CHECK(dup == 0);
+  CHECK(corrupt == 0);
+  CHECK(unknown == 0);
+  CHECK(p.inUse() == 0);
+  CHECK(p.highWater() <= N);
+  CHECK(p.fails() == nulls + 1);                // + 番号付けのときの 1 回
+
+  /* 終わった後も空きリストは N 個ちょうど（重複も欠けも無い） */
+  std::set<uint8_t*> rest;
+  for (uint8_t* b; (b = p.alloc()) != nullptr;) rest.insert(b);
+  CHECK(rest.size() == N);
+  CHECK(p.inUse() == N);
+  for (uint8_t* b : rest) p.free(b);
+}
+
+int main() {
+  test_begin_args();
+  test_exhaustion();
+  test_foreign_free();
+  test_high_water();
+  test_two_threads();
+  if (g_fail) {
+    std::printf("FAILED: %d check(s)\n", g_fail);
+    return 1;
+  }
+  std::printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,223 @@
+"""with_cross_device の FetchServer（UDP, 既定 5544）から静止画・過去のフレームを取り出す。
+
+メッセージ（big-endian，先頭 'W' 'F' type(1) 0(1)）:
+  SNAP  req(4)                                  → 端末が高解像度の静止画を 1 枚撮る
+  AT    req(4) ts_us(4)                         → 履歴から ts_us 以前で最も新しいフレーム
+  EVENT req(4) event(2)                         → 履歴からボタンイベントの押下時刻のフレーム
+  META  req(4) status(1) blob(4) size(4) w(2) h(2) cap_us(4)
+  GET   blob(4) offset(4) count(1)              → offset から count チャンク
+  DATA  blob(4) offset(4) | bytes
+status: 0=OK 1=PENDING 2=FAILED 3=GONE
+
+取り出しは GET を繰り返して抜けを埋める．途中で止めたときは <out>.part / <out>.part.json に
+受信済みの分を残し，`get BLOB --out <out>` で続きから取り直せる（端末に blob が残っている間）．
+"""
+import argparse
+import json
+import os
+import random
+import socket
+import struct
+import sys
+import time
+
+T_SNAP, T_META, T_GET, T_DATA, T_AT, T_EVENT = 1, 2, 3, 4, 5, 6
+ST_NAMES = {0: "OK", 1: "PENDING", 2: "FAILED", 3: "GONE"}
+HDR = b"WF"
+
+
+class Meta:
+    def __init__(self, req, status, blob, size, w, h, cap_us):
+        self.req, self.status, self.blob, self.size = req, status, blob, size
+        self.w, self.h, self.cap_us = w, h, cap_us
+
+
+def parse(pkt):
+    if len(pkt) < 4 or pkt[:2] != HDR:
+        return None
+    t = pkt[2]
+    if t == T_META and len(pkt) >= 25:
+        return t, Meta(*struct.unpack_from(">IBIIHHI", pkt, 4))
+    if t == T_DATA and len(pkt) >= 12:
+        blob, off = struct.unpack_from(">II", pkt, 4)
+        return t, (blob, off, pkt[12:])
+    return None
+
+
+class Fetcher:
+    def __init__(self, host, port, chunk, window, inflight, timeout):
+        self.addr = (host, port)
+        self.chunk, self.window, self.inflight, self.timeout = chunk, window, inflight, timeout
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 20)
+        self.sock.settimeout(0.2)
+
+    def recv(self):
+        try:
+            pkt, _ = self.sock.recvfrom(2048)
+        except socket.timeout:
+            return None
+        return parse(pkt)
+
+    def request(self, body):
+        """SNAP などを送り，OK / FAILED / GONE の META が返るまで再送する"""
+        t0 = time.time()
+        last = 0
+        req = struct.unpack_from(">I", body, 4)[0]
+        while time.time() - t0 < self.timeout:
+            if time.time() - last > 0.5:
+                self.sock.sendto(body, self.addr)
+                last = time.time()
+            m = self.recv()
+            if not m or m[0] != T_META or m[1].req != req:
+                continue
+            meta = m[1]
+            if meta.status == 1:
+                continue
+            return meta
+        return None
+
+    def ask(self, t, key=b""):
+        """SNAP / AT / EVENT を送って META を待つ"""
+        req = random.getrandbits(32) or 1
+        t0 = time.time()
+        meta = self.request(HDR + bytes([t, 0]) + struct.pack(">I", req) + key)
+        if meta:
+            print("META %s blob=0x%08x %uB %ux%u (%.0f ms)" % (
+                ST_NAMES.get(meta.status, meta.status), meta.blob, meta.size, meta.w, meta.h,
+                (time.time() - t0) * 1000))
+        return meta
+
+    def fetch(self, blob, size, part):
+        """part: {off: bytes}。抜けている範囲を window ずつ GET する"""
+        t0 = time.time()
+        rx = 0
+        idle = 0
+        while True:
+            missing = [o for o in range(0, size, self.chunk) if o not in part]
+            if not missing:
+                break
+            # 抜けの先頭から，連続する範囲ごとに GET（同時に inflight 本まで）
+            gets = []
+            i = 0
+            while i < len(missing) and len(gets) < self.inflight:
+                start, n = missing[i], 1
+                while (i + n < len(missing) and n < self.window
+                       and missing[i + n] == start + n * self.chunk):
+                    n += 1
+                gets.append((start, n))
+                i += n
+            for start, n in gets:
+                self.sock.sendto(HDR + bytes([T_GET, 0]) + struct.pack(">IIB", blob, start, n), self.addr)
+            got, want = 0, sum(n for _, n in gets)
+            while got < want:
+                m = self.recv()
+                if m is None:
+                    break
+                if m[0] == T_META and m[1].status == 3:
+                    raise RuntimeError("blob 0x%08x is gone" % blob)
+                if m[0] != T_DATA or m[1][0] != blob:
+                    continue
+                _, off, data = m[1]
+                if off + len(data) < size and len(data) != self.chunk:
+                    self.chunk = len(data)           # 端末の FETCH_CHUNK に合わせる
+                if off not in part:
+                    part[off] = data
+                    got += 1
+                    rx += len(data)
+            idle = 0 if got else idle + 1
+            if idle * 0.2 > self.timeout:
+                raise TimeoutError("no data for %.0f s" % self.timeout)
+        dt = time.time() - t0
+        print("fetched %uB in %.0f ms (%.0f kB/s)" % (rx, dt * 1000, rx / 1024 / max(dt, 1e-3)))
+        return b"".join(part[o] for o in sorted(part))
+
+
+def load_part(out):
+    try:
+        with open(out + ".part.json") as f:
+            st = json.load(f)
+        with open(out + ".part", "rb") as f:
+            raw = f.read()
+    except OSError:
+        return None, {}
+    part = {}
+    for off, n in st["have"]:
+        part[off] = raw[off:off + n]
+    return st, part
+
+
+def save_part(out, meta, part):
+    raw = bytearray(meta["size"])
+    for off, data in part.items():
+        raw[off:off + len(data)] = data
+    with open(out + ".part", "wb") as f:
+        f.write(raw)
+    with open(out + ".part.json", "w") as f:
+        json.dump(dict(meta, have=[[o, len(d)] for o, d in sorted(part.items())]), f)
+
+
+def run(fx, meta, out, part):
+    info = dict(blob=meta.blob, size=meta.size, w=meta.w, h=meta.h, cap_us=meta.cap_us)
+    try:
+        jpg = fx.fetch(meta.blob, meta.size, part)
+    except (KeyboardInterrupt, TimeoutError) as e:
+        save_part(out, info, part)
+        print("interrupted (%s): %u/%uB kept, resume with: get 0x%08x --out %s" % (
+            type(e).__name__, sum(len(d) for d in part.values()), meta.size, meta.blob, out))
+        return 1
+    except RuntimeError as e:
+        print(e)
+        return 1
+    with open(out, "wb") as f:
+        f.write(jpg)
+    for ext in (".part", ".part.json"):
+        if os.path.exists(out + ext):
+            os.remove(out + ext)
+    print("saved %s (%ux%u, cap_us=%u)" % (out, meta.w, meta.h, meta.cap_us))
+    return 0
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("--host", required=True, help="device IP")
+    ap.add_argument("--port", type=int, default=5544, help="FETCH_UDP_PORT (default 5544)")
+    ap.add_argument("--chunk", type=int, default=1200, help="FETCH_CHUNK (learned from DATA)")
+    ap.add_argument("--window", type=int, default=16, help="chunks per GET (<= FETCH_WINDOW)")
+    ap.add_argument("--inflight", type=int, default=4, help="GETs sent at once")
+    ap.add_argument("--timeout", type=float, default=5.0, help="give up after this many idle seconds")
+    ap.add_argument("--out", default="snap.jpg")
+    sub = ap.add_subparsers(dest="cmd", required=True)
+    sub.add_parser("snap", help="take a high-resolution still and fetch it")
+    a = sub.add_parser("at", help="fetch the history frame shown at a device timestamp")
+    a.add_argument("ts_us", type=lambda s: int(s, 0), help="device esp_timer us (low 32 bits)")
+    e = sub.add_parser("event", help="fetch the history frame shown at a button event")
+    e.add_argument("event", type=lambda s: int(s, 0), help="event id from a BUTTON message (WS CTRL or CtrlProto)")
+    g = sub.add_parser("get", help="fetch (or resume) an existing blob")
+    g.add_argument("blob", type=lambda s: int(s, 0))
+    args = ap.parse_args()
+
+    fx = Fetcher(args.host, args.port, args.chunk, args.window, args.inflight, args.timeout)
+    if args.cmd in ("snap", "at", "event"):
+        if args.cmd == "snap":
+            meta = fx.ask(T_SNAP)
+        elif args.cmd == "at":
+            meta = fx.ask(T_AT, struct.pack(">I", args.ts_us & 0xFFFFFFFF))
+        else:
+            meta = fx.ask(T_EVENT, struct.pack(">H", args.event & 0xFFFF))
+        if not meta or meta.status != 0:
+            print("%s failed" % args.cmd)
+            return 1
+        return run(fx, meta, args.out, {})
+
+    st, part = load_part(args.out)
+    if not st or st["blob"] != args.blob:
+        print("no partial file for blob 0x%08x; need the size from META (use snap / at / event)" % args.blob)
+        return 1
+    print("resume blob=0x%08x %u/%uB" % (args.blob, sum(len(d) for d in part.values()), st["size"]))
+    meta = Meta(0, 0, st["blob"], st["size"], st["w"], st["h"], st["cap_us"])
+    return run(fx, meta, args.out, part)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
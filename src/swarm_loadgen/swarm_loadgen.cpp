@@ -0,0 +1,433 @@
+/**
+ * swarm_loadgen.cpp – 多数の仮想デバイスから RTP/JPEG を送る負荷生成ツール
+ * ---------------------------------------------------------------------------
+ *  • 送出ロジックはファームウェアと同一（rtpjpeg::packetize + RTP ヘッダ）
+ *  • 仮想デバイスごとに SSRC / fps / フレームコーパス / クロックドリフトを持つ
+ *  • 送出タイミングはハッシュ式タイマホイールで管理（1 スレッド）
+ *  • 1 フレームのパケットは sendmmsg でまとめて送る（ファームウェアの RTP_BATCH_SEND 相当。
+ *    --batch 0 でパケットごとの sendto）
+ *  • 1 秒ごと + 終了時に達成パケットレートを表示
+ *
+ *  build: g++ -std=c++17 -O2 -I../../with_cross_device \
+ *           swarm_loadgen.cpp ../../with_cross_device/rtp_jpeg.cpp \
+ *           ../../with_cross_device/AsyncCopy.cpp ../../with_cross_device/PacketPool.cpp \
+ *           -o swarm_loadgen
+ */
+#include "rtp_jpeg.h"
+#include "PacketPool.h"
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <random>
+#include <string>
+#include <vector>
+
+using Frame  = std::vector<uint8_t>;
+using Corpus = std::vector<Frame>;
+
+/* ===== 時刻 ============================================================ */
+static uint64_t nowUs(){
+  timespec t; clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000ull + (uint64_t)t.tv_nsec / 1000;
+}
+static uint64_t nowNs(){
+  timespec t; clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000ull + (uint64_t)t.tv_nsec;
+}
+static void sleepUntilUs(uint64_t us){
+  timespec t; t.tv_sec = (time_t)(us / 1000000ull); t.tv_nsec = (long)(us % 1000000ull) * 1000;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, nullptr) == EINTR) {}
+}
+
+/* ===== 設定 ============================================================ */
+struct Options {
+  std::string dst_ip   = "127.0.0.1";
+  uint16_t    dst_port = RTP_PORT;
+  uint16_t    port_stride = 0;        // デバイス i → dst_port + i*stride
+  int         devices  = 100;
+  double      fps_min  = CAM_FPS, fps_max = CAM_FPS;
+  double      drift_ppm = 50;         // ±drift_ppm の一様分布
+  double      duration_s = 10;
+  size_t      mtu      = RTP_PAYLOAD_MTU;
+  uint16_t    width    = 240, height = 240;
+  size_t      synth_bytes = 12000;    // コーパス無し時の合成 JPEG サイズ
+  uint32_t    ssrc_base = 0x57580000u;
+  uint32_t    seed     = 1;
+  std::string corpus;
+  bool        batch    = true;        // sendmmsg でまとめ送り
+};
+
+static void usage(const char* argv0){
+  fprintf(stderr,
+    "usage: %s [options]\n"
+    "  --dst IP:PORT        送信先 (default 127.0.0.1:%u)\n"
+    "  --port-stride N      デバイスごとに宛先ポートを N ずつずらす (default 0)\n"
+    "  --devices N          仮想デバイス数 (default 100)\n"
+    "  --fps F | F1:F2      fps（範囲指定時はデバイスごとに一様乱数）\n"
+    "  --drift-ppm P        クロックドリフト ±P ppm (default 50)\n"
+    "  --duration S         実行秒数 (default 10)\n"
+    "  --mtu N              RTP ペイロード上限 (default %u)\n"
+    "  --size WxH           RTP/JPEG ヘッダに載せる解像度 (default 240x240)\n"
+    "  --corpus DIR         JPEG コーパス（サブディレクトリがあればデバイスごとに割当）\n"
+    "  --synth-bytes N      コーパス無し時の合成フレームサイズ (default 12000)\n"
+    "  --ssrc-base X        SSRC 先頭値 (default 0x57580000)\n"
+    "  --seed N             乱数シード\n"
+    "  --batch 0|1          1: sendmmsg で最大 %u パケットずつまとめ送り / 0: sendto (default 1)\n",
+    argv0, (unsigned)RTP_PORT, (unsigned)RTP_PAYLOAD_MTU, (unsigned)RTP_BATCH_PKTS);
+}
+
+static bool parseArgs(int argc, char** argv, Options& o){
+  for (int i = 1; i < argc; ++i){
+    std::string a = argv[i];
+    auto val = [&]()->const char* { return (i + 1 < argc) ? argv[++i] : nullptr; };
+    const char* v = nullptr;
+    if (a == "-h" || a == "--help") return false;
+    if (!(v = val())) { fprintf(stderr, "missing value for %s\n", a.c_str()); return false; }
+
+    if (a == "--dst"){
+      std::string s = v; size_t c = s.rfind(':');
+      if (c == std::string::npos) return false;
+      o.dst_ip = s.substr(0, c); o.dst_port = (uint16_t)atoi(s.c_str() + c + 1);
+    } else if (a == "--port-stride") o.port_stride = (uint16_t)atoi(v);
+    else if (a == "--devices")       o.devices = atoi(v);
+    else if (a == "--fps"){
+      const char* c = strchr(v, ':');
+      o.fps_min = atof(v); o.fps_max = c ? atof(c + 1) : o.fps_min;
+    } else if (a == "--drift-ppm")   o.drift_ppm = atof(v);
+    else if (a == "--duration")      o.duration_s = atof(v);
+    else if (a == "--mtu")           o.mtu = (size_t)atoi(v);
+    else if (a == "--size"){
+      if (sscanf(v, "%hux%hu", &o.width, &o.height) != 2) return false;
+    } else if (a == "--corpus")      o.corpus = v;
+    else if (a == "--synth-bytes")   o.synth_bytes = (size_t)atoi(v);
+    else if (a == "--ssrc-base")     o.ssrc_base = (uint32_t)strtoul(v, nullptr, 0);
+    else if (a == "--seed")          o.seed = (uint32_t)atoi(v);
+    else if (a == "--batch")         o.batch = atoi(v) != 0;
+    else { fprintf(stderr, "unknown option %s\n", a.c_str()); return false; }
+  }
+  return o.devices > 0 && o.fps_min > 0 && o.fps_max >= o.fps_min;
+}
+
+/* ===== コーパス ======================================================== */
+static bool readFile(const std::string& path, Frame& out){
+  FILE* f = fopen(path.c_str(), "rb");
+  if (!f) return false;
+  fseek(f, 0, SEEK_END); long n = ftell(f); fseek(f, 0, SEEK_SET);
+  out.resize(n > 0 ? (size_t)n : 0);
+  bool ok = n > 0 && fread(out.data(), 1, out.size(), f) == out.size();
+  fclose(f);
+  return ok;
+}
+
+static bool isDir(const std::string& p){
+  struct stat st; return stat(p.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static std::vector<std::string> listDir(const std::string& dir){
+  std::vector<std::string> v;
+  if (DIR* d = opendir(dir.c_str())){
+    while (dirent* e = readdir(d)) if (e->d_name[0] != '.') v.push_back(dir + "/" + e->d_name);
+    closedir(d);
+  }
+  std::sort(v.begin(), v.end());
+  return v;
+}
+
+static Corpus loadCorpus(const std::string& dir){
+  Corpus c;
+  for (auto& p : listDir(dir)){
+    if (isDir(p)) continue;
+    Frame f;
+    const uint8_t* scan; size_t scan_len; rtpjpeg::Qtables qt;
+    if (readFile(p, f) && rtpjpeg::extract_qtables_and_scan(f.data(), f.size(), scan, scan_len, qt))
+      c.push_back(std::move(f));
+    else
+      fprintf(stderr, "[corpus] skip %s (not a baseline JPEG with DQT)\n", p.c_str());
+  }
+  return c;
+}
+
+// packetize が必要とする DQT / SOF0 / SOS..EOI だけを持つ合成フレーム。
+// スキャンは 0xFF を含まない乱数（デコードは不可だが送出負荷は同じ）。
+static Frame synthFrame(size_t scan_bytes, uint16_t w, uint16_t h, std::mt19937& rng){
+  Frame f = { 0xFF, 0xD8 };
+  auto put16 = [&](uint16_t v){ f.push_back(uint8_t(v >> 8)); f.push_back(uint8_t(v)); };
+  for (uint8_t tq = 0; tq < 2; ++tq){
+    f.push_back(0xFF); f.push_back(0xDB); put16(2 + 65); f.push_back(tq);
+    for (int k = 0; k < 64; ++k) f.push_back(uint8_t(8 + k / 4 + tq * 4));
+  }
+  f.push_back(0xFF); f.push_back(0xC0); put16(17); f.push_back(8); put16(h); put16(w); f.push_back(3);
+  const uint8_t comp[3][3] = { {1, 0x21, 0}, {2, 0x11, 1}, {3, 0x11, 1} };
+  for (auto& c : comp) f.insert(f.end(), c, c + 3);
+  f.push_back(0xFF); f.push_back(0xDA); put16(12); f.push_back(3);
+  const uint8_t sos[6] = { 1, 0x00, 2, 0x11, 3, 0x11 };
+  f.insert(f.end(), sos, sos + 6); f.push_back(0); f.push_back(63); f.push_back(0);
+  std::uniform_int_distribution<int> byte(0, 0xFE);
+  for (size_t i = 0; i < scan_bytes; ++i) f.push_back(uint8_t(byte(rng)));
+  f.push_back(0xFF); f.push_back(0xD9);
+  return f;
+}
+
+/* ===== 仮想デバイス ==================================================== */
+struct VDev {
+  uint32_t     ssrc;
+  double       fps;
+  double       drift;          // 実時間/デバイス時間 - 1（ppm×1e-6）
+  const Corpus* corpus;
+  size_t       frame_idx;
+  uint16_t     seq;
+  uint32_t     ts0;            // 90kHz の初期値（乱数）
+  uint32_t     ts;             // 90kHz, デバイスクロック基準（ts0 + frame_no / fps）
+  uint64_t     frame_no = 0;
+  uint64_t     t0_us    = 0;   // 初回送出の実時刻
+  uint64_t     due_us   = 0;
+  sockaddr_in  peer{};
+  int          next = -1;      // タイマホイール内の連結
+};
+
+/* ===== タイマホイール ==================================================
+ * 固定刻み（TICK_US）× SLOTS のハッシュ式ホイール。各スロットは
+ * デバイス index の片方向リスト。1 周を超える期限は発火時に再登録する。
+ * _cur はまだ処理していない tick（tick は終わってから処理する）。 */
+class TimerWheel {
+public:
+  static constexpr uint64_t TICK_US = 250;
+  static constexpr size_t   SLOTS   = 4096;          // ≒ 1.02 s / 周
+
+  explicit TimerWheel(std::vector<VDev>& devs) : _devs(devs) { _head.fill(-1); }
+
+  void start(uint64_t t0){ _cur = t0 / TICK_US; }
+  uint64_t nextTickUs() const { return (_cur + 1) * TICK_US; }
+
+  void insert(int idx){
+    uint64_t tick = std::max<uint64_t>(_devs[idx].due_us / TICK_US, _cur);
+    size_t s = tick & (SLOTS - 1);
+    _devs[idx].next = _head[s]; _head[s] = idx;
+  }
+
+  // 終わった tick を処理し、期限切れのデバイスを fire(idx) する。
+  // tick が終わっているので、スロットに残る期限前のものは次の周回の分。
+  template <class F> void advance(uint64_t now, F&& fire){
+    while ((_cur + 1) * TICK_US <= now){
+      size_t s = _cur & (SLOTS - 1);
+      int idx = _head[s]; _head[s] = -1;
+      ++_cur;                                                    // fire 中の再登録は次の tick 以降へ
+      while (idx >= 0){
+        int nxt = _devs[idx].next;
+        if (_devs[idx].due_us <= now) fire(idx);
+        else { _devs[idx].next = _head[s]; _head[s] = idx; }     // 次の周回へ
+        idx = nxt;
+      }
+    }
+  }
+
+private:
+  std::vector<VDev>&          _devs;
+  std::array<int, SLOTS>      _head;
+  uint64_t                    _cur = 0;
+};
+
+/* ===== 統計 ============================================================ */
+struct Stats {
+  uint64_t pkts = 0, bytes = 0, frames = 0, errors = 0, pkt_fail = 0;
+  uint64_t lag_max_us = 0, lag_sum_us = 0;
+  uint64_t send_ns = 0, syscalls = 0;  // 送出システムコールの所要時間と回数
+  void reset(){ *this = Stats{}; }
+};
+
+int main(int argc, char** argv){
+  Options o;
+  if (!parseArgs(argc, argv, o)) { usage(argv[0]); return 2; }
+
+  std::mt19937 rng(o.seed);
+
+  // ---- コーパス
+  std::vector<Corpus> corpora;
+  if (!o.corpus.empty()){
+    std::vector<std::string> subdirs;
+    for (auto& p : listDir(o.corpus)) if (isDir(p)) subdirs.push_back(p);
+    if (subdirs.empty()) subdirs.push_back(o.corpus);
+    for (auto& d : subdirs){
+      Corpus c = loadCorpus(d);
+      if (!c.empty()) corpora.push_back(std::move(c));
+    }
+    if (corpora.empty()) { fprintf(stderr, "no usable JPEG in %s\n", o.corpus.c_str()); return 1; }
+  } else {
+    // デバイス間でフレームサイズが揃わないよう ±30% でばらつかせた 8 種類
+    std::uniform_real_distribution<double> var(0.7, 1.3);
+    for (int k = 0; k < 8; ++k){
+      Corpus c;
+      for (int j = 0; j < 4; ++j) c.push_back(synthFrame(size_t(o.synth_bytes * var(rng)), o.width, o.height, rng));
+      corpora.push_back(std::move(c));
+    }
+  }
+
+  // ---- ソケット
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock < 0) { perror("socket"); return 1; }
+  int sndbuf = 4 << 20;
+  setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+  in_addr dst{};
+  if (inet_pton(AF_INET, o.dst_ip.c_str(), &dst) != 1) { fprintf(stderr, "bad ip %s\n", o.dst_ip.c_str()); return 2; }
+
+  // ---- 仮想デバイス
+  std::vector<VDev> devs(o.devices);
+  std::uniform_real_distribution<double> fpsD(o.fps_min, o.fps_max);
+  std::uniform_real_distribution<double> driftD(-o.drift_ppm, o.drift_ppm);
+  std::uniform_real_distribution<double> phaseD(0.0, 1.0);
+  std::uniform_int_distribution<uint32_t> u32;
+  uint64_t t0 = nowUs() + 100000;   // 100ms 後に開始
+  for (int i = 0; i < o.devices; ++i){
+    VDev& d = devs[i];
+    d.ssrc   = o.ssrc_base + (uint32_t)i;
+    d.fps    = fpsD(rng);
+    d.drift  = driftD(rng) * 1e-6;
+    d.corpus = &corpora[i % corpora.size()];
+    d.frame_idx = (size_t)i % d.corpus->size();
+    d.seq    = (uint16_t)u32(rng);
+    d.ts0    = u32(rng);
+    d.ts     = d.ts0;
+    d.peer.sin_family = AF_INET;
+    d.peer.sin_addr   = dst;
+    d.peer.sin_port   = htons((uint16_t)(o.dst_port + i * o.port_stride));
+    // 送出位相を 1 フレーム周期内に散らす（全台同時バーストを避ける）
+    d.t0_us  = t0 + (uint64_t)(phaseD(rng) * 1e6 / d.fps);
+    d.due_us = d.t0_us;
+  }
+
+  double target_fps = 0;
+  for (auto& d : devs) target_fps += d.fps;
+  printf("[loadgen] devices=%d dst=%s:%u corpora=%zu target=%.1f frames/s mtu=%zu\n",
+         o.devices, o.dst_ip.c_str(), (unsigned)o.dst_port, corpora.size(), target_fps, o.mtu);
+
+  TimerWheel wheel(devs);
+  wheel.start(t0);
+  for (int i = 0; i < o.devices; ++i) wheel.insert(i);
+
+  // パケットバッファは実機と同じく固定プールから（全仮想デバイスで共用、単一スレッド）
+  PacketPool pool;
+  if (!pool.begin(RTP_POOL_PKTS, rtpjpeg::pkt_buf_size(o.mtu), PacketPool::Mem::DMA)) return 1;
+  std::array<mmsghdr, RTP_BATCH_PKTS> msgs_;
+  std::array<iovec,   RTP_BATCH_PKTS> iov_;
+  mmsghdr* msgs = msgs_.data();
+  iovec*   iov  = iov_.data();
+
+  Stats sec, total;
+
+  auto fire = [&](int idx){
+    VDev& d = devs[idx];
+    uint64_t lag = nowUs() - d.due_us;
+    sec.lag_sum_us += lag; sec.lag_max_us = std::max(sec.lag_max_us, lag);
+
+    const Frame& f = (*d.corpus)[d.frame_idx];
+    d.frame_idx = (d.frame_idx + 1) % d.corpus->size();
+
+    // UdpAgent::sendRtpJpegFrame と同じ emit（headroom に RTP ヘッダを書いて 1 datagram）
+    auto emit = [&](uint8_t* payload, size_t paylen, bool marker_last)->bool {
+      uint8_t* pkt = payload - rtpjpeg::RTP_HDR_LEN;
+      rtpjpeg::write_rtp_header(pkt, marker_last, RTP_PT_JPEG, d.seq, d.ts, d.ssrc);
+      uint64_t t = nowNs();
+      ssize_t n = sendto(sock, pkt, rtpjpeg::RTP_HDR_LEN + paylen, 0, (sockaddr*)&d.peer, sizeof(d.peer));
+      sec.send_ns += nowNs() - t; sec.syscalls++;
+      if (n < 0) { sec.pkt_fail++; return false; }
+      d.seq++; sec.pkts++; sec.bytes += (uint64_t)n; return true;
+    };
+    // まとめ送り: emit で RTP ヘッダを書いて溜め、flush で sendmmsg 1 回
+    size_t nb = 0;
+    auto hold = [&](uint8_t* payload, size_t paylen, bool marker_last)->bool {
+      if (nb >= RTP_BATCH_PKTS) return false;
+      uint8_t* pkt = payload - rtpjpeg::RTP_HDR_LEN;
+      rtpjpeg::write_rtp_header(pkt, marker_last, RTP_PT_JPEG, (uint16_t)(d.seq + nb), d.ts, d.ssrc);
+      iov[nb] = { pkt, rtpjpeg::RTP_HDR_LEN + paylen };
+      msgs[nb] = {};
+      msgs[nb].msg_hdr.msg_name    = &d.peer;
+      msgs[nb].msg_hdr.msg_namelen = sizeof(d.peer);
+      msgs[nb].msg_hdr.msg_iov     = &iov[nb];
+      msgs[nb].msg_hdr.msg_iovlen  = 1;
+      nb++;
+      return true;
+    };
+    auto flush = [&]()->bool {
+      size_t done = 0;
+      while (done < nb) {
+        uint64_t t = nowNs();
+        int r = sendmmsg(sock, msgs + done, (unsigned)(nb - done), 0);
+        sec.send_ns += nowNs() - t; sec.syscalls++;
+        if (r <= 0) { sec.pkt_fail += nb - done; break; }
+        for (int k = 0; k < r; ++k) sec.bytes += msgs[done + k].msg_len;
+        done += (size_t)r;
+      }
+      d.seq += (uint16_t)nb; sec.pkts += done;   // 失敗分も seq は進める（受信側からは欠落に見える）
+      bool ok = done > 0;
+      nb = 0;
+      return ok;
+    };
+    bool ok = o.batch
+      ? rtpjpeg::packetize(f.data(), f.size(), o.width, o.height, rtpjpeg::JpegType::YUV422,
+                           0, d.ts, o.mtu, hold, pool, nullptr, flush)
+      : rtpjpeg::packetize(f.data(), f.size(), o.width, o.height, rtpjpeg::JpegType::YUV422,
+                           0, d.ts, o.mtu, emit, pool);
+    if (ok) sec.frames++;
+    else sec.errors++;
+
+    // 次フレーム: デバイスクロックでは 1/fps 周期、実時間ではドリフト分ずれる
+    d.frame_no++;
+    d.ts     = d.ts0 + (uint32_t)llround((double)d.frame_no * 90000.0 / d.fps);   // 端数を累積させない
+    d.due_us = d.t0_us + (uint64_t)((double)d.frame_no * 1e6 / d.fps * (1.0 + d.drift));
+    wheel.insert(idx);
+  };
+
+  const uint64_t t_end = t0 + (uint64_t)(o.duration_s * 1e6);
+  uint64_t t_report = t0 + 1000000;
+  auto report = [&](const Stats& s, double secs, const char* label){
+    printf("[%s] %.1fs frames/s=%.1f pkt/s=%.0f Mbps=%.2f send=%.2fus/pkt (%.1f pkt/call) lag_avg=%.0fus lag_max=%lluus err=%llu sendfail=%llu\n",
+           label, secs, s.frames / secs, s.pkts / secs, s.bytes * 8.0 / secs / 1e6,
+           s.pkts ? s.send_ns / 1e3 / (double)s.pkts : 0.0,
+           s.syscalls ? (double)s.pkts / (double)s.syscalls : 0.0,
+           (s.frames + s.errors) ? (double)s.lag_sum_us / (double)(s.frames + s.errors) : 0.0,
+           (unsigned long long)s.lag_max_us,
+           (unsigned long long)s.errors, (unsigned long long)s.pkt_fail);
+    fflush(stdout);
+  };
+  auto accumulate = [&](){
+    total.pkts += sec.pkts; total.bytes += sec.bytes; total.frames += sec.frames;
+    total.errors += sec.errors; total.pkt_fail += sec.pkt_fail;
+    total.send_ns += sec.send_ns; total.syscalls += sec.syscalls;
+    total.lag_sum_us += sec.lag_sum_us; total.lag_max_us = std::max(total.lag_max_us, sec.lag_max_us);
+  };
+
+  sleepUntilUs(t0);
+  for (;;){
+    uint64_t now = nowUs();
+    if (now >= t_end) break;
+    wheel.advance(now, fire);
+    if (now >= t_report){
+      report(sec, 1.0 + (now - t_report) / 1e6, "1s");
+      accumulate(); sec.reset();
+      t_report = now + 1000000;
+    }
+    sleepUntilUs(wheel.nextTickUs());
+  }
+  accumulate();
+
+  double secs = o.duration_s;
+  report(total, secs, "total");
+  printf("[loadgen] achieved %.0f pkt/s aggregate (%.1f%% of target frame rate)\n",
+         total.pkts / secs, 100.0 * total.frames / secs / target_fps);
+  close(sock);
+  return 0;
+}
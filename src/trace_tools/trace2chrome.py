@@ -0,0 +1,133 @@
+"""with_cross_device の Trace ダンプを Chrome Trace Event 形式（JSON）へ変換する。
+
+入力（Trace.cpp の dump() 出力、1 行 1 レコード）:
+  #TRACE v1 events=<n>
+  #TASK <handle hex> <name>
+  E,<ts_us>,<ph>,<core>,<task hex>,<arg>,<name>
+  #END
+ts_us は esp_timer の下位 32bit なので折り返しを補正する。
+Serial ログと混在していても #TRACE〜#END の間の E/#TASK 行だけを拾う。
+
+出力: pid = コア番号, tid = タスク。chrome://tracing / ui.perfetto.dev で開く。
+"""
+import argparse
+import json
+import socket
+import sys
+
+
+def parse(lines):
+    tasks, events = {}, []
+    inside = False
+    for raw in lines:
+        line = raw.strip()
+        if line.startswith("#TRACE"):
+            inside, tasks, events = True, {}, []   # 最後のダンプを採用
+            continue
+        if not inside:
+            continue
+        if line.startswith("#END"):
+            inside = False
+            continue
+        if line.startswith("#TASK"):
+            _, h, name = line.split(" ", 2)
+            tasks[int(h, 16)] = name
+            continue
+        if not line.startswith("E,"):
+            continue
+        f = line.split(",", 6)
+        if len(f) != 7:
+            continue
+        events.append((int(f[1]), f[2], int(f[3]), int(f[4], 16), int(f[5]), f[6]))
+    return tasks, events
+
+
+def unwrap(events):
+    out, base, prev = [], 0, None
+    for ts, *rest in events:
+        if prev is not None and ts < prev and prev - ts > 0x80000000:
+            base += 1 << 32
+        prev = ts
+        out.append((ts + base, *rest))
+    return out
+
+
+def to_chrome(tasks, events):
+    events = unwrap(events)
+    if not events:
+        return {"traceEvents": []}
+    t0 = events[0][0]
+    te = []
+    open_ = {}                                     # (core, task) -> 開いている B の深さ
+    for ts, ph, core, task, arg, name in events:
+        key = (core, task)
+        if ph == "E":
+            if open_.get(key, 0) == 0:             # リングの先頭で B が上書きされた
+                continue
+            open_[key] -= 1
+        elif ph == "B":
+            open_[key] = open_.get(key, 0) + 1
+        ev = {"name": name, "ph": ph, "ts": ts - t0, "pid": core, "tid": task}
+        if ph == "i":
+            ev["s"] = "t"
+        if arg:
+            ev["args"] = {"arg": arg}
+        te.append(ev)
+    t_end = events[-1][0] - t0
+    for (core, task), depth in open_.items():      # 閉じていない区間は末尾で閉じる
+        for _ in range(depth):
+            te.append({"name": "", "ph": "E", "ts": t_end, "pid": core, "tid": task})
+
+    seen = {(c, t) for _, _, c, t, _, _ in events}
+    for core in sorted({c for c, _ in seen}):
+        te.append({"name": "process_name", "ph": "M", "pid": core, "args": {"name": "core %d" % core}})
+    for core, task in sorted(seen):
+        te.append({"name": "thread_name", "ph": "M", "pid": core, "tid": task,
+                   "args": {"name": tasks.get(task, "%08x" % task)}})
+    return {"traceEvents": te, "displayTimeUnit": "ms"}
+
+
+def recv_udp(port, timeout):
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4 << 20)
+    s.bind(("0.0.0.0", port))
+    print("waiting trace on udp :%d (press 'u' on device serial)" % port, file=sys.stderr)
+    buf = b""
+    s.settimeout(None)
+    while b"#END" not in buf:
+        try:
+            data, _ = s.recvfrom(65535)
+        except socket.timeout:
+            # 届いた分だけ変換する（途中で切れた最後の行は捨てる）
+            print("timeout: #END not received (partial trace)", file=sys.stderr)
+            buf = buf[:buf.rfind(b"\n") + 1]
+            break
+        buf += data
+        s.settimeout(timeout)
+    return buf.decode("utf-8", "replace").splitlines()
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("input", nargs="?", help="Serial キャプチャ（省略時 stdin）")
+    ap.add_argument("--udp", type=int, help="UDP で受信するポート（TRACE_UDP_PORT）")
+    ap.add_argument("--timeout", type=float, default=3.0, help="UDP 受信の無通信タイムアウト [s]")
+    ap.add_argument("-o", "--output", default="trace.json")
+    a = ap.parse_args()
+
+    if a.udp:
+        lines = recv_udp(a.udp, a.timeout)
+    elif a.input:
+        with open(a.input, "r", errors="replace") as f:
+            lines = f.readlines()
+    else:
+        lines = sys.stdin.readlines()
+
+    tasks, events = parse(lines)
+    with open(a.output, "w") as f:
+        json.dump(to_chrome(tasks, events), f)
+    print("%d events -> %s" % (len(events), a.output), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
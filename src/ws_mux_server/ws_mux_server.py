@@ -0,0 +1,310 @@
+"""with_cross_device の多重化 WebSocket（WS_MUX=1, パス /mux）の参照サーバ。
+
+各 BIN メッセージ = chan(1) | flags(1) | payload
+  chan 0 STREAM : JPEG を WS_MUX_CHUNK ごとに分割。flags bit0=FIRST, bit1=LAST
+                  サーバ→端末は CREDIT(0xCD 0x01 | 受信済みフレーム数(4) | window(2))
+                  WS_JPEG_ELIDE=1 の端末は JPEG の代わりに JF メッセージを送る（unelide 参照）
+                  経路選択: サーバ→端末 CAPS(0xCD 0x02 | caps(1) | prefer(1)),
+                  LOSS(0xCD 0x03 | 損失率‰(2))。端末→サーバ OFFER（CAPS と同形、flags=0）
+  chan 1 CTRL   : サーバ→端末 cmd(2)[+token(4)] / 端末→サーバ ACK(0xAC 0x4B ...),
+                  BUTTON(0xAC 0x42 | act(1) press_us(4) event(2))
+  chan 2 MODE   : 端末→サーバ mode(2)
+標準ライブラリのみで WebSocket（RFC6455）の最小限を実装している。
+"""
+import argparse
+import asyncio
+import base64
+import hashlib
+import os
+import struct
+import sys
+import time
+
+GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+MUX_STREAM, MUX_CTRL, MUX_MODE = 0, 1, 2
+MUX_FIRST, MUX_LAST = 0x01, 0x02
+CREDIT_MAGIC = b"\xCD\x01"
+CAPS_MAGIC = b"\xCD\x02"
+LOSS_MAGIC = b"\xCD\x03"
+PATHS = ["rtp", "ws", "rtsp", "raw"]                   # CAPS のビット位置 = 経路の番号
+JF_HAS_HDR = 0x01
+RUN_MODES = (0x1001, 0x1010, 0x1011)                   # SIG / STRAIGHT / OBJ 開始
+BUTTON_ACTS = ["PREV", "NEXT", "BACK", "OK_SHORT", "OK_LONG", "OK_PRESS"]   # ButtonLogic::Act
+
+
+def ws_frame(opcode, payload):
+    n = len(payload)
+    if n < 126:
+        hdr = struct.pack(">BB", 0x80 | opcode, n)
+    elif n < 65536:
+        hdr = struct.pack(">BBH", 0x80 | opcode, 126, n)
+    else:
+        hdr = struct.pack(">BBQ", 0x80 | opcode, 127, n)
+    return hdr + payload
+
+
+async def read_frame(r):
+    b0, b1 = await r.readexactly(2)
+    fin, op = b0 & 0x80, b0 & 0x0F
+    n = b1 & 0x7F
+    if n == 126:
+        n = struct.unpack(">H", await r.readexactly(2))[0]
+    elif n == 127:
+        n = struct.unpack(">Q", await r.readexactly(8))[0]
+    mask = await r.readexactly(4) if b1 & 0x80 else None
+    data = await r.readexactly(n)
+    if mask:
+        data = bytes(c ^ mask[i & 3] for i, c in enumerate(data))
+    return fin, op, data
+
+
+class Session:
+    def __init__(self, w, args):
+        self.w, self.args = w, args
+        self.buf = None
+        self.frames = self.bytes = 0
+        self.received = 0                               # 接続以降の受信フレーム数
+        self.jpeg_hdr = {}                              # hdr_ver -> SOI..SOS
+        self.t_stat = time.monotonic()
+        self.sent_at = {}
+        self.token = 0
+        self.mode_at = None                             # 実行モード開始の MODE を受けた時刻
+
+    def send_ctrl(self, cmd):
+        self.token = (self.token + 1) & 0xFFFFFFFF
+        self.sent_at[self.token] = time.monotonic()
+        msg = struct.pack(">BBHI", MUX_CTRL, 0, cmd, self.token)
+        self.w.write(ws_frame(0x2, msg))
+
+    def send_credit(self):
+        if self.args.credits <= 0:
+            return                                      # 従来サーバとして振る舞う
+        msg = struct.pack(">BB", MUX_STREAM, 0) + CREDIT_MAGIC + \
+            struct.pack(">IH", self.received & 0xFFFFFFFF, self.args.credits)
+        self.w.write(ws_frame(0x2, msg))
+
+    def send_caps(self):
+        if self.args.caps is None:
+            return                                      # 従来サーバ（端末は既定の経路のみ）
+        msg = struct.pack(">BB", MUX_STREAM, 0) + CAPS_MAGIC + \
+            struct.pack(">BB", self.args.caps, self.args.prefer)
+        self.w.write(ws_frame(0x2, msg))
+
+    def send_loss(self, permille):
+        msg = struct.pack(">BB", MUX_STREAM, 0) + LOSS_MAGIC + struct.pack(">H", min(permille, 1000))
+        self.w.write(ws_frame(0x2, msg))
+
+    def on_message(self, data):
+        if len(data) < 2:
+            return
+        chan, flags, p = data[0], data[1], data[2:]
+        if chan == MUX_STREAM and not flags and p[:2] == CAPS_MAGIC and len(p) >= 4:
+            print("OFFER %s default=%s" % (path_names(p[2]), PATHS[p[3]] if p[3] < len(PATHS) else p[3]))
+        elif chan == MUX_STREAM:
+            if flags & MUX_FIRST:
+                self.buf = bytearray()
+            if self.buf is None:
+                return                                  # 途中から受けた / 欠けたフレーム
+            self.buf += p
+            if flags & MUX_LAST:
+                self.on_frame(bytes(self.buf))
+                self.buf = None
+        elif chan == MUX_MODE and len(p) >= 2:
+            mode, = struct.unpack(">H", p[:2])
+            print("MODE 0x%04X" % mode)
+            if mode in RUN_MODES:
+                self.mode_at = (mode, time.monotonic())
+        elif chan == MUX_CTRL and len(p) >= 12 and p[0] == 0xAC and p[1] == 0x4B:
+            cmd, token, dev_us = struct.unpack(">HII", p[2:12])
+            t = self.sent_at.pop(token, None)
+            rtt = "%.1f ms" % ((time.monotonic() - t) * 1000) if t else "?"
+            print("ACK  cmd=0x%04X rtt=%s device=%u us" % (cmd, rtt, dev_us))
+        elif chan == MUX_CTRL and len(p) >= 9 and p[0] == 0xAC and p[1] == 0x42:
+            act, press_us, event = struct.unpack(">BIH", p[2:9])
+            name = BUTTON_ACTS[act] if act < len(BUTTON_ACTS) else str(act)
+            print("BUTTON %-8s press_us=%u event=%u" % (name, press_us, event))
+
+    def unelide(self, msg):
+        """JF メッセージ → JPEG（ヘッダ未受信なら None）
+
+        'J' 'F' fmt flags hdr_ver(2) seq(4) ts_us(4) w(2) h(2) hdr_len(2) | data
+        """
+        if len(msg) < 20 or msg[2] != 1:
+            return None
+        flags, ver, seq, ts, w, h, hl = struct.unpack_from(">BHIIHHH", msg, 3)
+        data = msg[20:]
+        if flags & JF_HAS_HDR:
+            self.jpeg_hdr = {ver: data[:hl]}            # 古い版は不要
+            return data
+        hdr = self.jpeg_hdr.get(ver)
+        if hdr is None:
+            print("JF seq=%u: header v%u not received" % (seq, ver))
+            return None
+        return hdr + data
+
+    def on_frame(self, jpg):
+        self.received += 1
+        self.send_credit()                              # 受け取ったらすぐ次を許可
+        if self.mode_at:
+            mode, t = self.mode_at
+            print("FIRST frame %.1f ms after MODE 0x%04X" % ((time.monotonic() - t) * 1000, mode))
+            self.mode_at = None
+        if jpg[:2] == b"JF":
+            jpg = self.unelide(jpg)
+            if jpg is None:
+                return
+        self.frames += 1
+        self.bytes += len(jpg)
+        if self.args.save_dir:
+            with open(os.path.join(self.args.save_dir, "latest.jpg"), "wb") as f:
+                f.write(jpg)
+        now = time.monotonic()
+        if now - self.t_stat >= 1.0:
+            el = now - self.t_stat
+            print("STREAM %.1f fps %.0f kbps" % (self.frames / el, self.bytes * 8 / el / 1000))
+            self.frames = self.bytes = 0
+            self.t_stat = now
+
+
+SESSIONS = set()
+
+
+def path_names(caps):
+    return ",".join(n for i, n in enumerate(PATHS) if caps & (1 << i)) or "-"
+
+
+def parse_caps(text):
+    caps = 0
+    for n in text.split(","):
+        if n not in PATHS:
+            raise argparse.ArgumentTypeError("unknown path: %s" % n)
+        caps |= 1 << PATHS.index(n)
+    return caps
+
+
+class RtpLoss(asyncio.DatagramProtocol):
+    """RTP のシーケンス番号の飛びから損失率を数える（SSRC ごと、並べ替え・重複は数えない）"""
+
+    def __init__(self):
+        self.last = {}
+        self.recv = self.lost = 0
+
+    def datagram_received(self, d, addr):
+        if len(d) < 12 or d[0] >> 6 != 2:
+            return
+        seq, = struct.unpack_from(">H", d, 2)
+        ssrc, = struct.unpack_from(">I", d, 8)
+        prev = self.last.get(ssrc)
+        if prev is not None:
+            gap = (seq - prev) & 0xFFFF
+            if gap == 0 or gap >= 0x8000:
+                if 0x10000 - gap > 100:
+                    self.last[ssrc] = seq                # 大きく戻った = 送り手の再開
+                return
+            self.lost += gap - 1
+        self.last[ssrc] = seq
+        self.recv += 1
+
+    def take(self):
+        """前回からの損失率 [‰]。受信が無ければ None（送っていないのか失われたのか区別できない）"""
+        n = self.recv + self.lost
+        permille = self.lost * 1000 // n if n else None
+        self.recv = self.lost = 0
+        return permille
+
+
+async def report_loss(meter):
+    while True:
+        await asyncio.sleep(1.0)
+        permille = meter.take()
+        if permille is None:
+            continue
+        print("RTP  loss %u permille" % permille)
+        for s in SESSIONS:
+            s.send_loss(permille)
+
+
+async def handle(r, w, args):
+    req = await r.readuntil(b"\r\n\r\n")
+    lines = req.decode("latin-1").split("\r\n")
+    path = lines[0].split(" ")[1] if len(lines[0].split(" ")) > 1 else ""
+    hdr = {k.strip().lower(): v.strip() for k, v in (l.split(":", 1) for l in lines[1:] if ":" in l)}
+    key = hdr.get("sec-websocket-key")
+    if path != args.path or not key:
+        w.write(b"HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n")
+        await w.drain()
+        w.close()
+        print("reject %s" % path)
+        return
+    acc = base64.b64encode(hashlib.sha1((key + GUID).encode()).digest()).decode()
+    w.write(("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+             "Sec-WebSocket-Accept: %s\r\n\r\n" % acc).encode())
+    peer = w.get_extra_info("peername")
+    print("connected %s:%d" % peer[:2])
+    s = Session(w, args)
+    SESSIONS.add(s)
+    s.send_credit()                                     # 最初の window を与える
+    s.send_caps()                                       # 受けられる経路（端末は OFFER で応える）
+    msg = bytearray()
+    try:
+        while True:
+            fin, op, data = await read_frame(r)
+            if op == 0x8:
+                break
+            if op == 0x9:
+                w.write(ws_frame(0xA, data))
+                continue
+            if op in (0x1, 0x2, 0x0):
+                msg += data
+                if fin:
+                    s.on_message(bytes(msg))
+                    msg = bytearray()
+    except (asyncio.IncompleteReadError, ConnectionError):
+        pass
+    finally:
+        SESSIONS.discard(s)
+        w.close()
+        print("disconnected")
+
+
+def on_stdin():
+    line = sys.stdin.readline().strip()
+    if line in ("1", "0"):
+        for s in SESSIONS:
+            s.send_ctrl(1 if line == "1" else 0)
+
+
+async def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("--host", default="0.0.0.0")
+    ap.add_argument("--port", type=int, default=8080)
+    ap.add_argument("--path", default="/mux")
+    ap.add_argument("--credits", type=int, default=2,
+                    help="同時に送ってよいフレーム数（0 で CREDIT を送らない）")
+    ap.add_argument("--save-dir", help="最新フレームを latest.jpg として保存")
+    ap.add_argument("--caps", type=parse_caps,
+                    help="受けられる映像経路 rtp,ws,rtsp,raw（省略時は CAPS を送らない従来サーバ）")
+    ap.add_argument("--prefer", choices=PATHS, help="優先する経路（省略時は端末に任せる）")
+    ap.add_argument("--rtp-port", type=int,
+                    help="この UDP ポートで RTP を受けて損失率を数え，1 秒ごとに LOSS を返す")
+    args = ap.parse_args()
+    args.prefer = PATHS.index(args.prefer) if args.prefer else 0xFF
+
+    srv = await asyncio.start_server(lambda r, w: handle(r, w, args), args.host, args.port)
+    try:
+        asyncio.get_running_loop().add_reader(sys.stdin, on_stdin)
+    except (PermissionError, ValueError):
+        pass                                        # stdin がファイル等（モータ指令なし）
+    print("listening ws://%s:%d%s (stdin: 1=motor ON, 0=motor OFF)" % (args.host, args.port, args.path))
+    if args.rtp_port:
+        meter = RtpLoss()
+        await asyncio.get_running_loop().create_datagram_endpoint(
+            lambda: meter, local_addr=(args.host, args.rtp_port))
+        asyncio.ensure_future(report_loss(meter))
+        print("counting RTP loss on udp/%d" % args.rtp_port)
+    async with srv:
+        await srv.serve_forever()
+
+
+if __name__ == "__main__":
+    asyncio.run(main())
@@ -3,11 +3,22 @@
 #include "NetDebug.h"
 #include <esp_wifi.h>
 #include "config.h"
+#include "Metrics.h"
+#include "Trace.h"
 
 /* ===== 初期化 ======================================================== */
 void AppStateMachine::begin() {
     initHardware();
-    buttons.begin(kBtnPins, 4);
+    buttons.begin(kBtnPins, ButtonLogic::COUNT);
+    {
+        ButtonLogic::Config bc;
+        bc.long_us     = OK_LONG_MS * 1000;
+        bc.suppress_us = OK_SUPPRESS_MS * 1000;
+        btnLogic.configure(bc);
+        bool lv[ButtonLogic::COUNT];
+        for (size_t i = 0; i < ButtonLogic::COUNT; ++i) lv[i] = buttons.level(i);
+        btnLogic.reset(lv);
+    }
     LOGI("FSM","begin()");
 
 #if !AUTO_STREAM_NO_BLE
@@ -22,28 +33,60 @@ void AppStateMachine::begin() {
     bleActive = false;   // BLE 不使用
 #endif
 
-    bool ok = cam.begin();
+    bool ok = cam.begin(*profileFor(st));
     LOGI("FSM","camera init=%d", ok);
+    /* 送出経路: 撮像 1 回を active な sink へ配る。経路は streams.tick() が選ぶ */
+    cam.addSink(&rtpSink);   streams.add(&rtpSink);       // RTP/UDP, Legacy RAW UDP
+#if !AUTO_STREAM_NO_BLE
+    cam.addSink(&wsSink);    streams.add(&wsSink);        // Legacy WS
+#if RTSP_ENABLE
+    cam.addSink(&rtspSink);  streams.add(&rtspSink);      // RTSP（PLAY 中のみ）
+#endif
+    ws.setStreamOffer((STREAM_MODE == 3 ? STREAM_CAP_RAW : STREAM_CAP_RTP) | STREAM_CAP_WS |
+                      (RTSP_ENABLE ? STREAM_CAP_RTSP : 0), (uint8_t)kDefaultStream);
+    ws.onStreamFeedback([this](uint8_t type, const uint8_t* p, size_t l){ onStreamFeedback(type, p, l); });
+#endif
+    streams.setDefault(AUTO_STREAM_NO_BLE ? StreamSink::Kind::RTP : kDefaultStream);
+    fetch.onSnapshot([this]{ cam.requestSnapshot(); });
+    fetch.onLookup([this](uint32_t id, FetchServer::Blob& b){
+        return cam.snapshot(id, b) || cam.history().lookup(id, b);
+    });
+    fetch.onFind([this](FetchServer::Type t, uint32_t key, FetchServer::Blob& b){
+        return t == FetchServer::Type::AT ? cam.history().findAt(FrameHistory::widenUs(key), b)
+                                          : cam.history().findEvent((uint16_t)key, b);
+    });
 
-    wsQ = xQueueCreate(WS_Q_LEN, sizeof(WsCmd));
+    Trace::begin();
+    wsQ   = xQueueCreate(WS_Q_LEN, sizeof(WsCmd));
+    evNet = xEventGroupCreate();
     xTaskCreatePinnedToCore(uiTask,    "uiTask",    4096, this, 2, &hUiTask, 0);
     xTaskCreatePinnedToCore(netcamTask,"netcamTask",6144, this, 2, &hNetTask, 1);
+    xTaskCreatePinnedToCore(sockWatchTask,"sockWatch",2048, this, 3, &hSockTask, 1);
+    xTaskCreatePinnedToCore(ctrlTask,  "ctrlTask",  4096, this, CTRL_TASK_PRIO, &hCtrlTask, CTRL_TASK_CORE);
+    buttons.attachNotify(hUiTask);
+    cam.startFrameTimer(onCamDue, this);
 }
 
 
-/* Arduino の loop は最小化（実処理は FreeRTOS タスクへ） */
+/* Arduino の loop は最小化（実処理は FreeRTOS タスクへ）
+ * Serial コマンド: 't' = トレースを Serial へダンプ, 'u' = UDP へダンプ */
 void AppStateMachine::loop() {
-    vTaskDelay(1);
+    while (Serial.available()) {
+        int c = Serial.read();
+        if (c == 't') Trace::dump([](const char* l, size_t n){ Serial.write((const uint8_t*)l, n); });
+        else if (c == 'u') Trace::requestUdpDump();
+    }
+    vTaskDelay(pdMS_TO_TICKS(50));          // Serial コマンド待ちだけなので粗くてよい
 }
 
 /* ===== UI Task: buttons/LED/BLE/motor ================================ */
 void AppStateMachine::uiTask(void* arg){
     auto* self = static_cast<AppStateMachine*>(arg);
     for(;;){
-        if(self->btnActivate){
-            self->buttons.update();
-            self->buttonTask();
-        }
+        // ボタン割り込み / to() / 次の期限（LED・モータ・長押し判定）で起床
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(self->uiWaitMs()));
+        TRACE_BEGIN("ui");
+        self->buttonTask();
         self->ledTask();
 
         /* モータ100msパルス終了処理（非ブロッキング） */
@@ -53,7 +96,58 @@ void AppStateMachine::uiTask(void* arg){
         }
 
         if (self->bleActive) self->ble.loop();
-        vTaskDelay(1);
+        TRACE_END("ui");
+    }
+}
+
+uint32_t AppStateMachine::uiWaitMs() const {
+    const uint32_t now = millis();
+    uint32_t w = UI_IDLE_MS;
+    auto until = [&](uint32_t at){
+        int32_t d = (int32_t)(at - now);
+        if (d < 0) d = 0;
+        if ((uint32_t)d < w) w = (uint32_t)d;
+    };
+    int64_t dl = btnLogic.nextDeadlineUs();
+    if (dl != ButtonLogic::NO_DEADLINE) {
+        int64_t d = dl - esp_timer_get_time();
+        until(now + (d > 0 ? (uint32_t)((d + 999) / 1000) : 0));
+    }
+    if (ledInt)                             until(tLed + ledInt);
+    if (motorPulseUntil)                    until(motorPulseUntil);
+    return w ? w : 1;
+}
+
+/* ===== CTRL Task: 制御チャネル受信とモータ駆動 =======================
+ * 映像の送出中でも待たされないよう、WS /control と UDP 制御のソケットを
+ * この高優先度タスクで select 待ちし、届いたらすぐ処理する。 */
+void AppStateMachine::ctrlTask(void* arg){
+    auto* self = static_cast<AppStateMachine*>(arg);
+    for(;;){
+        // WS_MUX の場合は多重化コネクション全体の受信をここで回す
+        constexpr bool kWs = (CTRL_TRANSPORT != 1) || WS_MUX;
+        int wfd = kWs ? self->ws.ctrlFd() : -1;
+        int ufd = (CTRL_TRANSPORT != 0) ? self->uctl.fd()   : -1;
+        uint32_t waitMs = CTRL_POLL_MS;
+        if (ufd >= 0) { uint32_t d = self->uctl.nextDeadlineMs(); if (d < waitMs) waitMs = d; }
+
+        fd_set rd; FD_ZERO(&rd);
+        int maxfd = -1;
+        if (wfd >= 0) { FD_SET(wfd, &rd); maxfd = wfd; }
+        if (ufd >= 0) { FD_SET(ufd, &rd); if (ufd > maxfd) maxfd = ufd; }
+
+        int64_t rx = 0;
+        if (maxfd >= 0) {
+            timeval tv{0, (long)waitMs * 1000};
+            if (select(maxfd + 1, &rd, nullptr, nullptr, &tv) > 0) rx = esp_timer_get_time();
+            else FD_ZERO(&rd);
+        } else {
+            vTaskDelay(pdMS_TO_TICKS(CTRL_POLL_MS));     // 未接続（接続処理は netcamTask 側）
+        }
+
+        // UDP を先に: WS 側の接続処理（/control の最初の connect）にモータ指令を待たせない
+        if (CTRL_TRANSPORT != 0) self->uctl.service((ufd >= 0 && FD_ISSET(ufd, &rd)) ? rx : 0);
+        if (kWs)                 self->ws.serviceCtrl((wfd >= 0 && FD_ISSET(wfd, &rd)) ? rx : 0);
     }
 }
 
@@ -62,6 +156,7 @@ void AppStateMachine::netcamTask(void* arg){
     auto* self = static_cast<AppStateMachine*>(arg);
 
     for(;;){
+        TRACE_BEGIN("netcam");
 #if AUTO_STREAM_NO_BLE
         // ---- 1) Wi-Fi（STA）に自動接続
         if (!self->wifiStarted) {
@@ -76,13 +171,19 @@ void AppStateMachine::netcamTask(void* arg){
         if (self->wifiStarted && WiFi.status() == WL_CONNECTED && !self->udp.ready()) {
             self->udp.begin(RTP_DEST_IP, RTP_DEST_PORT, UdpAgent::Mode::RTP_JPEG);
             LOGI("UDP","udp.begin(%s:%u)", RTP_DEST_IP, (unsigned)RTP_DEST_PORT);
+            self->fetch.begin();
         }
+        self->serviceFetch();
         // ---- 3) 送出（stateに依存させず常時）
+        self->streams.tick(millis());
         if (self->udp.ready()) {
-            self->cam.stream(self->udp);   // フレームごとにRFC2435でRTP化して送出
+            self->cam.stream();            // フレームごとにRFC2435でRTP化して送出
         }
         self->udp.tick1sReport();
-        vTaskDelay(1);
+        self->udp.tickMetrics();
+        if (Trace::takeUdpDumpRequest()) self->udp.sendTrace();
+        TRACE_END("netcam");
+        self->waitNetEvent();
         continue;   // 既存WS/ボタン系の処理はバイパス
 #endif
 
@@ -113,6 +214,13 @@ void AppStateMachine::netcamTask(void* arg){
                 #endif
                     LOGI("UDP","udp.begin(%s:%u)",
                     self->wifiCreds.ip.c_str(), udp_port);
+                #if RTSP_ENABLE
+                    self->rtsp.begin();
+                #endif
+                    self->fetch.begin();
+                #if CTRL_TRANSPORT != 0
+                    self->uctl.begin(self->wifiCreds.ip.c_str(), CTRL_UDP_PORT);
+                #endif
 
                     static bool bleStopped = false;
                     if (!bleStopped) {
@@ -132,30 +240,106 @@ void AppStateMachine::netcamTask(void* arg){
         }
 
         // --- WS ループ & 送信キュー ---
+        TRACE_BEGIN("ws.loop");
         self->ws.loop();
+        TRACE_END("ws.loop");
+        self->publishSockFds();
+        xEventGroupSetBits(self->evNet, EV_SOCK_DONE);   // sockWatch の select 再開
+
+        self->cam.applyPending();        // to() が要求したカメラプロファイル / standby
+        self->serviceFetch();            // 静止画の要求はここで撮る（ストリームの直前）
+
+        // --- 送出経路の選択（CAPS / LOSS / 各経路の接続状態）---
+        bool wsUp = self->ws.ready();
+        if (self->wsWasUp && !wsUp) self->streams.forgetCaps();
+        self->wsWasUp = wsUp;
+#if RTSP_ENABLE
+        self->rtsp.loop();
+#endif
+        self->streams.tick(millis());
+        if (self->wsQ) Metrics::set(Metrics::WS_Q_DEPTH, uxQueueMessagesWaiting(self->wsQ));
         AppStateMachine::WsCmd cmd;
         while (self->wsQ && xQueueReceive(self->wsQ, &cmd, 0) == pdTRUE) {
             if (cmd.type == WsCmdType::MODE) self->ws.sendMode(cmd.val);
             else                             self->ws.sendMotor(cmd.val);
+            Metrics::observe(Metrics::CMD_TO_WIRE_US, (uint32_t)(esp_timer_get_time() - cmd.t_us));
         }
 
         // --- 実行モード中：画像ストリーム ---
         if (self->st == S::SIG || self->st == S::STRAIGHT || self->st == S::OBJ) {
-        #if   STREAM_MODE==0   // RTP/UDP
-            self->cam.stream(self->udp);
-        #elif STREAM_MODE==1   // RTSP(UDP)
-            // if(self->rtsp.isPlaying()) self->cam.stream(self->udp); // rtsp.loop() 側で begin 済み
-        #elif STREAM_MODE==2   // Legacy WS
-            self->cam.stream(self->ws);
-        #else                  // Legacy RAW UDP
-            self->cam.stream(self->udp);
-        #endif
+            self->cam.stream();            // 送出先は streams が選んだ sink
         }
 
-        // RTP 1秒ごとの統計ログ
+        // RTP 1秒ごとの統計ログ / メトリクス送出
         self->udp.tick1sReport();
+        self->udp.tickMetrics();
+        if (Trace::takeUdpDumpRequest()) self->udp.sendTrace();
+
+        TRACE_END("netcam");
+        self->waitNetEvent();
+    }
+}
+
+/* サーバからの経路選択フィードバック（WsAgent の受信タスク） */
+void AppStateMachine::onStreamFeedback(uint8_t type, const uint8_t* p, size_t l){
+    if (l < 2) return;
+    if      (type == CAPS_MAGIC1) streams.onCaps(p[0], p[1]);
+    else if (type == LOSS_MAGIC1) streams.onLoss((uint16_t(p[0]) << 8) | p[1]);
+}
+
+void AppStateMachine::serviceFetch(){
+    fetch.service();
+    if (cam.snapshotRequested()) {
+        FetchServer::Blob b;
+        fetch.snapshotDone(cam.takeSnapshot(b) ? &b : nullptr);
+    }
+}
+
+void AppStateMachine::waitNetEvent(){
+    // WS フレームを書きかけなら 1 tick で戻り、空いた送信バッファへ続きを書く
+    TickType_t to = ws.txPending() ? 1 : pdMS_TO_TICKS(NET_POLL_MS);
+    xEventGroupWaitBits(evNet, EV_NET_WAKE, pdTRUE, pdFALSE, to);
+}
+
+void AppStateMachine::onCamDue(void* arg){
+    auto* self = static_cast<AppStateMachine*>(arg);
+    xEventGroupSetBits(self->evNet, EV_CAM);
+}
+
+void AppStateMachine::publishSockFds(){
+    int fds[SOCK_MAX];
+    size_t n = ws.fds(fds, SOCK_MAX - 1);
+    if (fetch.ready()) fds[n++] = fetch.fd();
+    for (size_t i = 0; i < SOCK_MAX; ++i) sockFd[i] = (i < n) ? fds[i] : -1;
+}
+
+/* ===== Socket watch: WS / FetchServer ソケットの受信を select で待って netcamTask を起こす =====
+ * arduinoWebSockets はポーリング型なので、受信データの到着をイベントに変換する。
+ * fd は netcamTask が ws.loop() の後に更新したものを読むだけ（古い fd でも
+ * 余分に 1 回起こすだけで害はない）。 */
+void AppStateMachine::sockWatchTask(void* arg){
+    auto* self = static_cast<AppStateMachine*>(arg);
+    for(;;){
+        fd_set rd; FD_ZERO(&rd);
+        int maxfd = -1;
+        for (size_t i = 0; i < SOCK_MAX; ++i) {
+            int fd = self->sockFd[i];
+            if (fd < 0) continue;
+            FD_SET(fd, &rd);
+            if (fd > maxfd) maxfd = fd;
+        }
+        if (maxfd < 0) { vTaskDelay(pdMS_TO_TICKS(100)); continue; }
 
-        vTaskDelay(1);
+        timeval tv{0, 100 * 1000};
+        int r = select(maxfd + 1, &rd, nullptr, nullptr, &tv);
+        if (r > 0) {
+            xEventGroupClearBits(self->evNet, EV_SOCK_DONE);
+            xEventGroupSetBits(self->evNet, EV_SOCK);
+            // netcamTask が読み終えるまで待つ（レベルトリガなので空回り防止）
+            xEventGroupWaitBits(self->evNet, EV_SOCK_DONE, pdTRUE, pdFALSE, pdMS_TO_TICKS(100));
+        } else if (r < 0) {
+            vTaskDelay(pdMS_TO_TICKS(10));           // 切断直後の不正 fd など
+        }
     }
 }
 
@@ -164,6 +348,7 @@ void AppStateMachine::to(S n) {
     S prev = st;
     LOGI("FSM","%s → %s", toStr(st), toStr(n));
     st = n;
+    if (hUiTask) xTaskNotifyGive(hUiTask);   // LED 周期・モータパルスの期限を uiTask に反映
 
     /* --- SIG/STRAIGHT/OBJ → HOME の共通処理 --- */
     if (st == S::HOME && (prev == S::SIG || prev == S::STRAIGHT || prev == S::OBJ)) {
@@ -171,16 +356,32 @@ void AppStateMachine::to(S n) {
         startMotorPulse100ms();         // 既要件：100msモータHIGH
     }
 
+    /* --- カメラ: プロファイル切替（反映は netcamTask）。実行モード開始では
+     *     古い fb を捨て、周期・静止判定を待たずに最初のフレームを送る --- */
+    cam.requestProfile(profileFor(st));
+    if (st == S::SIG || st == S::STRAIGHT || st == S::OBJ) {
+        if (CAM_HOME_STANDBY) cam.requestStandby(false);  // OK_DOWN で起こし損ねた場合
+        cam.startMode();
+    } else if (CAM_HOME_STANDBY && st == S::HOME) {
+        cam.requestStandby(true);
+    }
+
     switch (st) {
         case S::BLE_WAIT:  ledInt = 500;                           break;
         case S::GET_INFO:  ledInt = 200;                           break;
         case S::WS_WAIT:   ledInt = 100; wifiStarted = false;      break;
 
         case S::HOME:      ledInt = 0;     sendModeAsync(mode);    break; 
-        case S::SIG:       okSuppressUntil = millis() + OK_SUPPRESS_MS; okIgnoreUntilRelease = true; sendModeAsync(0x1001); break;
-        case S::STRAIGHT:  okSuppressUntil = millis() + OK_SUPPRESS_MS; okIgnoreUntilRelease = true; sendModeAsync(0x1010); break;
-        case S::OBJ:       okSuppressUntil = millis() + OK_SUPPRESS_MS; okIgnoreUntilRelease = true; sendModeAsync(0x1011); break;
+        case S::SIG:       sendModeAsync(0x1001); break;
+        case S::STRAIGHT:  sendModeAsync(0x1010); break;
+        case S::OBJ:       sendModeAsync(0x1011); break;
      }
+
+    /* ボタン判定の文脈（RUN 進入で suppress + OK を離すまで無視） */
+    btnCtx = (st == S::HOME) ? ButtonLogic::Ctx::HOME
+           : (st == S::SIG || st == S::STRAIGHT || st == S::OBJ) ? ButtonLogic::Ctx::RUN
+           : ButtonLogic::Ctx::IDLE;
+    btnCtxDirty = true;
  }
 
 /* ===== LED 点滅 ====================================================== */
@@ -193,74 +394,74 @@ void AppStateMachine::ledTask() {
     }
 }
 
-/* ===== ボタンハンドラ（HOME：短押し巡回 / 長押し遷移） =============== */
+/* ===== ボタンハンドラ（HOME：短押し巡回 / 長押し遷移） ===============
+ * ISR が積んだエッジを ButtonLogic に流し、出てきたアクションを処理する。 */
+void AppStateMachine::applyBtnCtx() {
+    if (!btnCtxDirty) return;
+    btnCtxDirty = false;
+    btnLogic.setContext(btnCtx, esp_timer_get_time());
+}
+
 void AppStateMachine::buttonTask() {
+    ButtonLogic::Action a;
+    Buttons::Edge e;
+    applyBtnCtx();
+    while (buttons.pop(e)) {
+        btnLogic.onEdge((ButtonLogic::Btn)e.idx, e.level, e.ts_us);
+        while (btnLogic.pop(a)) { onButton(a); applyBtnCtx(); }
+    }
+    btnLogic.poll(esp_timer_get_time());
+    while (btnLogic.pop(a)) { onButton(a); applyBtnCtx(); }
+}
+
+void AppStateMachine::onButton(const ButtonLogic::Action& a) {
+    using Act = ButtonLogic::Act;
+    if (!btnActivate) return;
+    if (a.act == Act::OK_DOWN) {               // 長押しかもしれない: 確定（OK_LONG_MS）前にセンサを起こす
+        if (CAM_HOME_STANDBY && st == S::HOME) cam.requestStandby(false);
+        return;                                // 制御チャネルには流さない
+    }
+    Metrics::observe(Metrics::BTN_TO_ACTION_US, (uint32_t)(esp_timer_get_time() - a.at_us));
+    uint16_t ev = ++btnEvent;                  // 押下時に見えていたフレームを EVENT で引けるように
+    cam.history().noteEvent(ev, a.press_us);
+    LOGD("BTN","act=%u press=%lld us event=%u", (unsigned)a.act, (long long)a.press_us, (unsigned)ev);
+    /* 押下時刻付きのボタンイベント。WS の CTRL は ctrlTask が受け持つときだけ送られる */
+    ws.sendButton((uint8_t)a.act, a.press_us, ev);
+#if CTRL_TRANSPORT != 0
+    uctl.sendButton((uint8_t)a.act, a.press_us, ev);
+#endif
+
     /* --------- HOME でのモード選択 -------------------------------- */
     if(st == S::HOME){
-        if(buttons.rising(BTN_NEXT)){
-            modeIdx = (modeIdx + 1) % MODE_CNT;
-            mode    = kModes[modeIdx];
-            sendModeAsync(mode);    // 候補のみ通知
-        }
-        if(buttons.rising(BTN_PREV)){
-            modeIdx = (modeIdx + MODE_CNT - 1) % MODE_CNT;
-            mode    = kModes[modeIdx];
-            sendModeAsync(mode);
-        }
-
-        /* OK: 短押し=候補巡回 / 長押し(>=300ms)＝その候補へ遷移 */
-        if (buttons.pressed(BTN_OK)) {
-            if(!okHolding){
-                okHolding   = true;
-                okLongFired = false;
-                okPressStart = millis();
-            } else if(!okLongFired && (millis() - okPressStart >= OK_LONG_MS)){
-                okLongFired = true;                    // 長押し即時判定
-                okSuppressUntil = millis() + OK_SUPPRESS_MS;
-                (void)buttons.rising(BTN_OK);
-                okIgnoreUntilRelease = true; 
+        switch(a.act){
+            case Act::NEXT:
+            case Act::OK_SHORT:                // OK 短押し：候補だけ巡回（遷移はしない）
+                if (CAM_HOME_STANDBY) cam.requestStandby(true);   // OK_DOWN で起こした分を戻す
+                modeIdx = (modeIdx + 1) % MODE_CNT;
+                mode    = kModes[modeIdx];
+                sendModeAsync(mode);           // 候補のみ通知
+                break;
+            case Act::PREV:
+                modeIdx = (modeIdx + MODE_CNT - 1) % MODE_CNT;
+                mode    = kModes[modeIdx];
+                sendModeAsync(mode);
+                break;
+            case Act::OK_LONG:                 // 長押し(>=300ms)＝その候補へ遷移
                 switch(modeIdx){
                     case 0: to(S::SIG);       break;
                     case 1: to(S::STRAIGHT);  break;
                     case 2: to(S::OBJ);       break;
                 }
-            }
-        } else if (okHolding) {  // リリース
-            uint32_t held = millis() - okPressStart;
-            bool wasLong = okLongFired;
-            okHolding = false; okLongFired = false;
-            if (!wasLong && held < OK_LONG_MS) {
-                // ← 短押し：候補だけ巡回（遷移はしない）
-                modeIdx = (modeIdx + 1) % MODE_CNT;
-                mode    = kModes[modeIdx];
-                sendModeAsync(mode);
-            }
+                break;
+            default: break;
         }
 
     /* ------ 実行中：BTN_OK単押し/ BACK で HOME ------ */
     }else if (st == S::SIG || st == S::STRAIGHT || st == S::OBJ)
     {
-        // BACKは常時有効
-        if (buttons.rising(BTN_BACK)) {
-            sendModeAsync(0x1000);
-            to(S::HOME);
-            return;
-        }
-
-        // 実行状態に入った直後は、OKを一度“離す”まで無視
-        if (okIgnoreUntilRelease) {
-            if (!buttons.pressed(BTN_OK)) {
-                okIgnoreUntilRelease = false;
-                (void)buttons.rising(BTN_OK); // リリース時にrising残留を捨てる
-            }
-            return; // まだ離していない／今離した直後は処理しない
-        }
-
-        // OK単押し（立ち上がり）で HOME へ
-        if (millis() >= okSuppressUntil && buttons.rising(BTN_OK)) {
+        if (a.act == Act::BACK || a.act == Act::OK_PRESS) {
             sendModeAsync(0x1000);   // 既存挙動維持（HOMEインジケータ）
             to(S::HOME);             // ← to() 内で 0x1111 も送出＆モータ100ms
-            return;
         }
     }
 }
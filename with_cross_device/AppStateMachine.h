@@ -4,7 +4,13 @@
 #include "CameraStreamer.h"
 #include "Hardware.h"
 #include "UdpAgent.h"
+#include "UdpCtrl.h"
+#include "RtspServer.h"
+#include "FetchServer.h"
+#include "StreamSink.h"
 #include "Buttons.h" 
+#include "ButtonLogic.h"
+#include <esp_timer.h>
 
 class AppStateMachine {
 public:
@@ -20,12 +26,28 @@ private:
     enum class S : uint8_t { BLE_WAIT, GET_INFO, WS_WAIT, HOME,
                              SIG, STRAIGHT, OBJ };
 
+    /* ── 状態ごとのカメラプロファイル（config.h の CAM_PROFILE_*） ─── */
+    static constexpr CamProfile kProfHome     = CAM_PROFILE_HOME;
+    static constexpr CamProfile kProfSig      = CAM_PROFILE_SIG;
+    static constexpr CamProfile kProfStraight = CAM_PROFILE_STRAIGHT;
+    static constexpr CamProfile kProfObj      = CAM_PROFILE_OBJ;
+    static const CamProfile* profileFor(S s) {
+        switch (s) {
+            case S::SIG:      return &kProfSig;
+            case S::STRAIGHT: return &kProfStraight;
+            case S::OBJ:      return &kProfObj;
+            default:          return &kProfHome;      // HOME / 接続待ち（撮像はしない）
+        }
+    }
+
     /* ── モード循環テーブル ─────────────────────────────────── */
     static constexpr uint8_t  MODE_CNT = 3;
     static constexpr uint16_t kModes[MODE_CNT] = { 0x0001, 0x0010, 0x0011 };
 
     Buttons  buttons;
-    static constexpr uint8_t kBtnPins[4] = { BTN_PREV, BTN_NEXT, BTN_BACK, BTN_OK };
+    ButtonLogic btnLogic;                // uiTask 専用
+    uint16_t    btnEvent = 0;            // uiTask 専用: ボタンイベントの通し番号（BUTTON / EVENT）
+    static constexpr uint8_t kBtnPins[ButtonLogic::COUNT] = { BTN_PREV, BTN_NEXT, BTN_BACK, BTN_OK };
 
     /* ── 変数 ──────────────────────────────────────────────── */
     S         st       = S::BLE_WAIT;
@@ -34,8 +56,25 @@ private:
     BleAgent  ble;
     WsAgent   ws;
     UdpAgent  udp;
+    UdpCtrl   uctl;                       // CTRL_TRANSPORT!=0: UDP 制御チャネル
+    RtspServer rtsp;                      // RTSP_ENABLE: Wi-Fi 接続後に待ち受け
+    FetchServer fetch;                    // 静止画の取り出し（Wi-Fi 接続後に待ち受け）
     CameraStreamer cam;
 
+    /* 送出経路。全部を begin() で登録し、StreamSelector が実行時に 1 本選ぶ。
+     * UDP の RTP / RAW はビルド時（STREAM_MODE==3 で RAW）に決まる */
+    static constexpr StreamSink::Kind kDefaultStream =
+        STREAM_MODE == 1 ? StreamSink::Kind::RTSP :
+        STREAM_MODE == 2 ? StreamSink::Kind::WS   :
+        STREAM_MODE == 3 ? StreamSink::Kind::RAW  : StreamSink::Kind::RTP;
+    WsFrameSink    wsSink{ws};
+    UdpFrameSink   rtpSink{udp, STREAM_MODE == 3 ? StreamSink::Kind::RAW : StreamSink::Kind::RTP};
+    RtspFrameSink  rtspSink{rtsp};
+    StreamSelector streams;
+    bool           wsWasUp = false;       // netcamTask: 切断で CAPS を忘れる
+    void onStreamFeedback(uint8_t type, const uint8_t* p, size_t l);
+    void serviceFetch();                  // netcamTask: FetchServer の要求と静止画の撮影
+
     BleAgent::Creds wifiCreds;
     bool     wifiStarted = false;
     bool     bleActive   = true;
@@ -43,14 +82,12 @@ private:
 
     uint32_t tLed   = 0; bool ledOn = false; uint16_t ledInt = 500;
 
-    /* --- OK長押し(300ms) 即時判定用 --- */
-    uint32_t  okPressStart = 0;
-    bool      okHolding    = false;
-    bool      okLongFired  = false;
+    /* --- OK長押し(300ms) 即時判定用（判定は ButtonLogic） --- */
     static constexpr uint32_t OK_LONG_MS = 300;  // ← 要件
     static constexpr uint32_t OK_SUPPRESS_MS = 100;
-    uint32_t okSuppressUntil = 0;
-    bool okIgnoreUntilRelease = false;
+    /* to() は netcamTask からも呼ばれるので、ButtonLogic の文脈切替は uiTask で適用 */
+    volatile ButtonLogic::Ctx btnCtx      = ButtonLogic::Ctx::IDLE;
+    volatile bool             btnCtxDirty = false;
 
     /* --- モータ100msパルス（ノンブロッキング） --- */
     uint32_t motorPulseUntil = 0;
@@ -74,28 +111,54 @@ private:
 
     void to(S n);
     void ledTask();
-    void buttonTask();
+    void buttonTask();                                  // エッジ取り込み→アクション処理
+    void onButton(const ButtonLogic::Action& a);
+    void applyBtnCtx();
+    uint32_t uiWaitMs() const;              // 次の期限（LED/モータ/ボタン）までの ms
 
     /* ── Core分離: UI(core0) / NET+CAM(core1) ───────────────── */
     static void uiTask(void* arg);
     static void netcamTask(void* arg);
+    static void ctrlTask(void* arg);     // /control 受信 + モータ（最優先）
     TaskHandle_t hUiTask    = nullptr;
     TaskHandle_t hNetTask   = nullptr;
+    TaskHandle_t hCtrlTask  = nullptr;
+
+    /* ── netcamTask の起床要因（event group） ─────────────────
+     *  EV_WSQ : wsQ へ投入  / EV_CAM : 撮像周期タイマ
+     *  EV_SOCK: WS / FetchServer ソケット受信可（sockWatchTask が select で検出）
+     *  いずれも無ければ NET_POLL_MS で起きて WS/接続処理を回す */
+    enum : EventBits_t { EV_WSQ = 1 << 0, EV_CAM = 1 << 1, EV_SOCK = 1 << 2, EV_SOCK_DONE = 1 << 3 };
+    static constexpr EventBits_t EV_NET_WAKE = EV_WSQ | EV_CAM | EV_SOCK;
+    EventGroupHandle_t evNet = nullptr;
+    static constexpr size_t SOCK_MAX = 4;
+    volatile int  sockFd[SOCK_MAX] = { -1, -1, -1, -1 };   // netcamTask が更新、sockWatchTask が参照
+    TaskHandle_t  hSockTask = nullptr;
+    static void sockWatchTask(void* arg);
+    static void onCamDue(void* arg);
+    void publishSockFds();
+    void waitNetEvent();
 
     /* ── WS送信用キュー（WS操作の一本化） ────────────────── */
     enum class WsCmdType : uint8_t { MODE, MOTOR };
-    struct WsCmd { WsCmdType type; uint16_t val; };
+    struct WsCmd { WsCmdType type; uint16_t val; int64_t t_us; };   // t_us: 投入時刻
     static constexpr int WS_Q_LEN = 16;
     QueueHandle_t wsQ = nullptr;
 
     inline void sendModeAsync(uint16_t v){
+#if CTRL_TRANSPORT != 0
+        uctl.sendMode(v);                 // UDP は呼び出し元タスクで即送出
+#endif
+#if CTRL_TRANSPORT == 1
+        return;
+#endif
         if(!wsQ) return;
-        WsCmd c{WsCmdType::MODE, v};
-        xQueueSend(wsQ, &c, 0);
+        WsCmd c{WsCmdType::MODE, v, esp_timer_get_time()};
+        if (xQueueSend(wsQ, &c, 0) == pdTRUE && evNet) xEventGroupSetBits(evNet, EV_WSQ);
     }
     inline void sendMotorAsync(uint16_t v){
         if(!wsQ) return;
-        WsCmd c{WsCmdType::MOTOR, v};
-        xQueueSend(wsQ, &c, 0);
+        WsCmd c{WsCmdType::MOTOR, v, esp_timer_get_time()};
+        if (xQueueSend(wsQ, &c, 0) == pdTRUE && evNet) xEventGroupSetBits(evNet, EV_WSQ);
     }
 };
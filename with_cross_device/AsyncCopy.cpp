@@ -0,0 +1,95 @@
+#include "AsyncCopy.h"
+#include "NetDebug.h"
+#include <string.h>
+#if defined(ARDUINO)
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#if ASYNC_COPY_ENABLE
+#include "esp_async_memcpy.h"
+#if __has_include("esp_memory_utils.h")
+#include "esp_memory_utils.h"            // IDF 5: esp_ptr_external_ram
+#else
+#include "soc/soc_memory_layout.h"       // IDF 4.4
+#endif
+#endif
+#endif
+
+static_assert((ASYNC_COPY_ALIGN & (ASYNC_COPY_ALIGN - 1)) == 0, "ASYNC_COPY_ALIGN must be a power of two");
+
+#if defined(ARDUINO) && ASYNC_COPY_ENABLE
+/* 完了 ISR: wait() 側のセマフォを上げる */
+static bool IRAM_ATTR onCopyDone(async_memcpy_t, async_memcpy_event_t*, void* arg)
+{
+    BaseType_t woken = pdFALSE;
+    xSemaphoreGiveFromISR((SemaphoreHandle_t)arg, &woken);
+    return woken == pdTRUE;
+}
+#endif
+
+AsyncCopy::~AsyncCopy()
+{
+    wait();
+#if defined(ARDUINO) && ASYNC_COPY_ENABLE
+    if (_drv)  esp_async_memcpy_uninstall((async_memcpy_t)_drv);
+    if (_done) vSemaphoreDelete((SemaphoreHandle_t)_done);
+#endif
+}
+
+bool AsyncCopy::begin()
+{
+    if (_drv) return true;
+#if defined(ARDUINO) && ASYNC_COPY_ENABLE
+    async_memcpy_config_t cfg = ASYNC_MEMCPY_DEFAULT_CONFIG();
+    cfg.backlog           = 1;             // 同時に 1 本
+    cfg.sram_trans_align  = 4;
+    cfg.psram_trans_align = ASYNC_COPY_ALIGN;
+    SemaphoreHandle_t s = xSemaphoreCreateBinary();
+    async_memcpy_t drv = nullptr;
+    if (s && esp_async_memcpy_install(&cfg, &drv) == ESP_OK) {
+        _done = s;
+        _drv  = drv;
+    } else {
+        if (s) vSemaphoreDelete(s);
+        LOGW("COPY","GDMA unavailable, memcpy fallback");
+    }
+#endif
+    return _drv != nullptr;
+}
+
+void AsyncCopy::start(void* dst, const void* src, size_t n)
+{
+    uint8_t*       d = (uint8_t*)dst;
+    const uint8_t* s = (const uint8_t*)src;
+
+#if defined(ARDUINO) && ASYNC_COPY_ENABLE
+    /* GDMA に乗せるのは PSRAM からの十分長いコピーで、送り元と転送先の位相が揃うものだけ */
+    if (_drv && !_busy && n >= ASYNC_COPY_MIN && esp_ptr_external_ram(s) &&
+        (((uintptr_t)s ^ (uintptr_t)d) & (ASYNC_COPY_ALIGN - 1)) == 0) {
+        size_t head = (size_t)(-(uintptr_t)s & (ASYNC_COPY_ALIGN - 1));
+        size_t body = (n - head) & ~(size_t)(ASYNC_COPY_ALIGN - 1);
+        size_t tail = n - head - body;
+        /* fb はカメラの DMA が書いたもので CPU 側に dirty なキャッシュ行は無い
+         * （CPU は fb に書かない）ので、送り元の writeback は省く */
+        if (esp_async_memcpy((async_memcpy_t)_drv, d + head, (void*)(s + head), body,
+                             onCopyDone, _done) == ESP_OK) {
+            _busy = true;
+            if (head) memcpy(d, s, head);                           // DMA と並行して端数
+            if (tail) memcpy(d + head + body, s + head + body, tail);
+            _dmaBytes += body;
+            _cpuBytes += head + tail;
+            return;
+        }
+    }
+#endif
+    memcpy(d, s, n);
+    _cpuBytes += n;
+}
+
+void AsyncCopy::wait()
+{
+#if defined(ARDUINO) && ASYNC_COPY_ENABLE
+    if (!_busy) return;
+    xSemaphoreTake((SemaphoreHandle_t)_done, portMAX_DELAY);
+    _busy = false;
+#endif
+}
@@ -0,0 +1,45 @@
+#pragma once
+#if defined(ARDUINO)
+#include <Arduino.h>
+#endif
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+
+/**
+ * AsyncCopy : PSRAM の fb → 内部 RAM のパケットバッファへのコピーを CPU から外す
+ *  - デバイス: ESP32-S3 の async memcpy（GDMA）で転送し、その間 CPU は前のパケットの
+ *    sendto を進める（rtpjpeg::packetize の先読み）。完了は ISR → セマフォで受ける
+ *  - ホスト / GDMA が使えないとき / 短い・PSRAM 以外のコピー: start() で即 memcpy
+ *  - 同時に走らせるコピーは 1 本だけ。次の start() の前に wait() する
+ *
+ * GDMA は PSRAM 側のアドレスと長さを ASYNC_COPY_ALIGN 境界に揃える必要がある。
+ * 揃わない先頭・末尾の端数だけ CPU でコピーする。転送先は送り元と同じ位相になるよう
+ * 置く（alignShift）ので、本体はほぼ全部 DMA に乗る。転送先は DMA 可能な内部 RAM
+ * （PacketPool の Mem::DMA）であること。
+ */
+class AsyncCopy {
+public:
+    ~AsyncCopy();
+
+    /* GDMA ドライバを入れる。使えなければ false（その後も memcpy で動く） */
+    bool    begin();
+    bool    dma() const { return _drv != nullptr; }
+
+    /* dstBase + shift が src と同じ ASYNC_COPY_ALIGN 位相になる shift（0..ALIGN-1） */
+    static size_t alignShift(const void* dstBase, const void* src) {
+        return ((uintptr_t)src - (uintptr_t)dstBase) & (ASYNC_COPY_ALIGN - 1);
+    }
+
+    void start(void* dst, const void* src, size_t n);   // 非同期に始める（即時完了もある）
+    void wait();                                        // 直前の start() の完了待ち
+
+    uint32_t dmaBytes() const { return _dmaBytes; }     // GDMA で運んだ累計
+    uint32_t cpuBytes() const { return _cpuBytes; }     // memcpy した累計（端数・代替を含む）
+
+private:
+    void*    _drv     = nullptr;     // async_memcpy_t
+    void*    _done    = nullptr;     // SemaphoreHandle_t
+    bool     _busy    = false;
+    uint32_t _dmaBytes = 0, _cpuBytes = 0;
+};
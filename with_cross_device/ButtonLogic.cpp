@@ -0,0 +1,102 @@
+#include "ButtonLogic.h"
+
+void ButtonLogic::reset(const bool levels[COUNT]){
+  for (size_t i = 0; i < COUNT; ++i) {
+    _key[i] = Key{};
+    _key[i].raw = _key[i].stable = levels[i];
+  }
+  _okHolding = _okLongFired = false;
+  _okIgnoreUntilRelease = _key[OK].stable;
+  _qLen = 0;
+}
+
+void ButtonLogic::setContext(Ctx c, int64_t now_us){
+  _ctx = c;
+  _okHolding = _okLongFired = false;               // 前の文脈の押下は持ち越さない
+  if (c == Ctx::RUN) {
+    _okSuppressUntil      = now_us + _cfg.suppress_us;
+    _okIgnoreUntilRelease = _key[OK].stable;
+  } else {
+    _okIgnoreUntilRelease = false;
+  }
+}
+
+void ButtonLogic::onEdge(Btn b, bool level, int64_t ts_us){
+  poll(ts_us);                                     // 先に期限切れを時刻順に処理
+  Key& k = _key[b];
+  k.raw = level;
+  if (k.lockUntil) return;                         // チャタリング中（明けに再確認）
+  if (level != k.stable) {
+    k.lockUntil = ts_us + _cfg.debounce_us;
+    transition(b, level, ts_us);
+  }
+}
+
+void ButtonLogic::poll(int64_t now_us){
+  for (uint8_t i = 0; i < COUNT; ++i) {
+    Key& k = _key[i];
+    if (!k.lockUntil || now_us < k.lockUntil) continue;
+    int64_t t = k.lockUntil;
+    k.lockUntil = 0;
+    if (k.raw != k.stable) {                       // ロック中に最終エッジが来ていた
+      k.lockUntil = t + _cfg.debounce_us;
+      transition((Btn)i, k.raw, t);
+    }
+  }
+
+  if (_ctx == Ctx::HOME && _okHolding && !_okLongFired) {
+    int64_t due = _key[OK].pressUs + _cfg.long_us;
+    if (now_us >= due) {
+      _okLongFired = true;                         // 長押し即時判定（リリースを待たない）
+      emit(Act::OK_LONG, _key[OK].pressUs, due);
+    }
+  }
+}
+
+void ButtonLogic::transition(Btn b, bool down, int64_t ts){
+  Key& k = _key[b];
+  k.stable = down;
+  if (down) k.pressUs = ts;
+
+  if (b != OK) {
+    if (down) emit(b == PREV ? Act::PREV : b == NEXT ? Act::NEXT : Act::BACK, ts, ts);
+    return;
+  }
+
+  if (_ctx == Ctx::HOME) {
+    if (down) {
+      _okHolding = true; _okLongFired = false;
+      emit(Act::OK_DOWN, ts, ts);
+    } else if (_okHolding) {
+      bool wasLong = _okLongFired;
+      _okHolding = _okLongFired = false;
+      if (!wasLong && ts - k.pressUs < (int64_t)_cfg.long_us) emit(Act::OK_SHORT, k.pressUs, ts);
+    }
+  } else if (_ctx == Ctx::RUN) {
+    if (!down) { _okIgnoreUntilRelease = false; return; }
+    if (!_okIgnoreUntilRelease && ts >= _okSuppressUntil) emit(Act::OK_PRESS, ts, ts);
+  }
+}
+
+void ButtonLogic::emit(Act a, int64_t press_us, int64_t at_us){
+  if (_ctx == Ctx::IDLE || _qLen >= QCAP) return;
+  _q[(_qHead + _qLen++) % QCAP] = Action{a, press_us, at_us};
+}
+
+bool ButtonLogic::pop(Action& a){
+  if (!_qLen) return false;
+  a = _q[_qHead];
+  _qHead = (_qHead + 1) % QCAP; _qLen--;
+  return true;
+}
+
+int64_t ButtonLogic::nextDeadlineUs() const {
+  int64_t t = NO_DEADLINE;
+  for (const Key& k : _key)
+    if (k.lockUntil && k.lockUntil < t) t = k.lockUntil;
+  if (_ctx == Ctx::HOME && _okHolding && !_okLongFired) {
+    int64_t due = _key[OK].pressUs + _cfg.long_us;
+    if (due < t) t = due;
+  }
+  return t;
+}
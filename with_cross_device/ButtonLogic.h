@@ -0,0 +1,76 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * ButtonLogic : ボタンのデバウンスと OK 長押し判定（純粋なロジック）
+ *  - 入力はエッジ {ボタン, レベル, 時刻µs} と現在時刻だけ（GPIO/millis に触らない）
+ *  - デバウンスは先行エッジ方式: ロック外のエッジは即確定し、debounce_us の間は
+ *    チャタリングを無視。ロック明けに生レベルが確定状態と違えばその時点で確定。
+ *  - HOME: OK 押下が long_us 続けば OK_LONG（押下時刻+long_us）、それより前の
+ *          リリースで OK_SHORT。押下の時点で OK_DOWN（長押しに備えた先回り用）。
+ *          PREV/NEXT/BACK は押下で即アクション。
+ *  - RUN : 進入から suppress_us の間と、進入時に押されていた OK を離すまでは
+ *          OK を無視。以降の OK 押下で OK_PRESS。
+ *  - IDLE: 状態は追うがアクションは出さない
+ *  アクションには押下エッジの時刻を付ける（撮像時刻との突き合わせ用）。
+ *  ARDUINO 非依存（ホストでも使える）。
+ */
+class ButtonLogic {
+public:
+  enum Btn : uint8_t { PREV, NEXT, BACK, OK, COUNT };     // kBtnPins と同じ並び
+  enum class Ctx : uint8_t { IDLE, HOME, RUN };
+  enum class Act : uint8_t { PREV, NEXT, BACK, OK_SHORT, OK_LONG, OK_PRESS, OK_DOWN };
+
+  struct Action {
+    Act     act;
+    int64_t press_us;   // 押下エッジの時刻
+    int64_t at_us;      // アクションが確定した時刻（OK_LONG は press_us+long_us）
+  };
+
+  struct Config {
+    uint32_t debounce_us = 20000;
+    uint32_t long_us     = 300000;
+    uint32_t suppress_us = 100000;
+  };
+
+  static constexpr int64_t NO_DEADLINE = INT64_MAX;
+
+  void configure(const Config& c) { _cfg = c; }
+
+  // 起動時の生レベル（押下 = true）
+  void reset(const bool levels[COUNT]);
+
+  // 文脈の切替（RUN 進入時は suppress + OK を離すまで無視）
+  void setContext(Ctx c, int64_t now_us);
+  Ctx  context() const { return _ctx; }
+
+  void onEdge(Btn b, bool level, int64_t ts_us);
+  void poll(int64_t now_us);                 // デバウンス明け・長押し期限の処理
+
+  bool    pop(Action& a);
+  int64_t nextDeadlineUs() const;            // 次に poll() が必要な時刻
+  bool    pressed(Btn b) const { return _key[b].stable; }
+
+private:
+  struct Key {
+    bool    raw = false, stable = false;
+    int64_t lockUntil = 0;                   // 0 = ロックなし
+    int64_t pressUs   = 0;
+  };
+  static constexpr size_t QCAP = 8;
+
+  void transition(Btn b, bool down, int64_t ts);
+  void emit(Act a, int64_t press_us, int64_t at_us);
+
+  Config  _cfg;
+  Ctx     _ctx = Ctx::IDLE;
+  Key     _key[COUNT];
+
+  bool    _okHolding = false, _okLongFired = false;
+  bool    _okIgnoreUntilRelease = false;
+  int64_t _okSuppressUntil = 0;
+
+  Action  _q[QCAP];
+  uint8_t _qHead = 0, _qLen = 0;
+};
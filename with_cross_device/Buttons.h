@@ -1,67 +1,76 @@
 #pragma once
 #include <Arduino.h>
+#include <esp_timer.h>
+#include <atomic>
 #include "NetDebug.h"          // LOGD 用
 
+/**
+ * Buttons : GPIO エッジ割り込みでボタンの変化を時刻付きで取り込む
+ *  - ISR は {ボタン番号, レベル, esp_timer µs} を lock-free SPSC リングに積み、
+ *    attachNotify() で指定したタスクを起こすだけ
+ *  - デバウンス・長押し判定は ButtonLogic（uiTask 側）で行う
+ */
 class Buttons {
-  static constexpr uint32_t DEBOUNCE_MS = 20;
-  static constexpr size_t   MAX_BTN     = 8;
-  struct Info { uint8_t pin; bool prev; bool rise; };
+  static constexpr size_t MAX_BTN = 8;
+  static constexpr size_t QLEN    = 32;          // 2 のべき乗
 
 public:
+  struct Edge { uint8_t idx; uint8_t level; int64_t ts_us; };
+
   void begin(const uint8_t* pins, size_t n) {
     _cnt = (n > MAX_BTN) ? MAX_BTN : n;
     for (size_t i = 0; i < _cnt; ++i) {
-      _btn[i].pin = pins[i];
+      _pin[i] = { this, (uint8_t)i, pins[i] };
       pinMode(pins[i], INPUT_PULLDOWN);       // ★ まず設定
-      _btn[i].prev = digitalRead(pins[i]);    // その後読み取る
-      _btn[i].rise = false;
     }
-    _lastScan = millis();
   }
 
-  /* loop() から毎回呼び出し */
-  void update() {
-    if (millis() - _lastScan < DEBOUNCE_MS) return;
-    _lastScan = millis();
-
-    for (size_t i = 0; i < _cnt; ++i) {
-      bool now = digitalRead(_btn[i].pin);
-      if (!_btn[i].prev && now) {             // LOW→HIGH
-        _btn[i].rise = true;
-        LOGD("BTN", "Rising pin=%u", _btn[i].pin);
-      }
-      _btn[i].prev = now;
-    }
-  }
-
-  /* 立ち上がりがあった瞬間だけ true（読み出し時に自動クリア） */
-  bool rising(uint8_t pin) {
+  /* 割り込みを有効化し、エッジごとに task を起こす（タスク生成後に 1 回） */
+  void attachNotify(TaskHandle_t task) {
+    _notify = task;
     for (size_t i = 0; i < _cnt; ++i)
-      if (_btn[i].pin == pin) {
-        bool r = _btn[i].rise;
-        _btn[i].rise = false;
-        return r;
-      }
-    return false;
+      attachInterruptArg(digitalPinToInterrupt(_pin[i].pin), onEdge, &_pin[i], CHANGE);
   }
 
-  bool falling(uint8_t pin){
-    for(size_t i=0;i<_cnt;++i)
-      if(_btn[i].pin==pin){
-        bool f = (_btn[i].prev && !digitalRead(pin));
-        return f;
-      }
-    return false;
-}
+  /* 現在の生レベル（ButtonLogic::reset 用） */
+  bool level(size_t idx) const { return idx < _cnt && digitalRead(_pin[idx].pin); }
 
-  bool pressed(uint8_t pin) const {
-    for (size_t i = 0; i < _cnt; ++i)
-      if (_btn[i].pin == pin) return _btn[i].prev;
-    return false;
+  /* 取り出し（消費側は 1 タスクのみ） */
+  bool pop(Edge& e) {
+    uint32_t t = _tail.load(std::memory_order_relaxed);
+    if (t == _head.load(std::memory_order_acquire)) return false;
+    e = _q[t & (QLEN - 1)];
+    _tail.store(t + 1, std::memory_order_release);
+    return true;
   }
 
+  uint32_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
 private:
-  Info     _btn[MAX_BTN];
-  size_t   _cnt      = 0;
-  uint32_t _lastScan = 0;
+  struct Pin { Buttons* self; uint8_t idx; uint8_t pin; };
+
+  Pin      _pin[MAX_BTN];
+  size_t   _cnt = 0;
+  TaskHandle_t _notify = nullptr;
+
+  Edge                  _q[QLEN];
+  std::atomic<uint32_t> _head{0}, _tail{0};
+  std::atomic<uint32_t> _dropped{0};
+
+  /* GPIO 割り込みは 1 コアで直列に処理されるので生産者は 1 つとみなせる */
+  static void IRAM_ATTR onEdge(void* arg) {
+    auto* p    = static_cast<Pin*>(arg);
+    auto* self = p->self;
+    int64_t ts = esp_timer_get_time();
+    uint32_t h = self->_head.load(std::memory_order_relaxed);
+    if (h - self->_tail.load(std::memory_order_acquire) >= QLEN) {
+      self->_dropped.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      self->_q[h & (QLEN - 1)] = Edge{ p->idx, (uint8_t)digitalRead(p->pin), ts };
+      self->_head.store(h + 1, std::memory_order_release);
+    }
+    BaseType_t woken = pdFALSE;
+    if (self->_notify) vTaskNotifyGiveFromISR(self->_notify, &woken);
+    if (woken) portYIELD_FROM_ISR();
+  }
 };
@@ -2,50 +2,362 @@
 #include "NetDebug.h"
 #include "config.h"
 #include "UdpAgent.h"
+#include "RtspServer.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include <esp_heap_caps.h>
 
-bool CameraStreamer::begin() {
+bool CameraStreamer::begin(const CamProfile& initial) {
     camera_config_t cfg{};
     initCameraConfig(cfg);
     esp_err_t err = esp_camera_init(&cfg);
-    _interval = 1000 / CAM_FPS;                 // FPS に追従
+    _fbSize = cfg.frame_size;
+    _src.setFbCount(cfg.fb_count);
+    _interval = 1000 / CAM_FPS;
+    _dedup.configure(DEDUP_KEEPALIVE_MS, DEDUP_LEN_TOL_PERMILLE, DEDUP_MAX_DIFF_SEGS);
     LOGI("CAM","esp_camera_init=%d", (int)err);
-    return err == ESP_OK;
+    if (err != ESP_OK) return false;
+    setSensor(initial, true);            // fb は CAM_FB_FRAMESIZE で確保済み、撮像は初期プロファイルで
+    if (_hist.begin()) _src.addSink(&_hist);
+    return true;
 }
 
-void CameraStreamer::stream(WsAgent& ws)
+/* ===== プロファイル / standby / モード進入 ===== */
+void CameraStreamer::applyPending()
 {
-    if (millis() < _nextOkAfter) return;
-    if (millis() - _tLast < _interval || !ws.ready()) return;
+    int8_t sb = _standbyReq.exchange(-1);
+    if (sb >= 0) setStandby(sb == 1);
+    const CamProfile* p = _want.exchange(nullptr, std::memory_order_acquire);
+    if (p) setSensor(*p, false);
+}
+
+void CameraStreamer::requestStandby(bool on)
+{
+    _standbyReq = on ? 1 : 0;
+    if (_onDue) _onDue(_onDueArg);      // netcamTask を起こして先に反映させる（OK 押下 → 長押し確定の間）
+}
+
+/* センサのソフト standby（XIAO は PWDN ピンが無いのでレジスタで）。出力が止まるので
+ * その間 fb_get はしないこと（HOME では撮像しない） */
+bool CameraStreamer::setStandby(bool on)
+{
+    if (on == _standby) return true;
+    sensor_t* s = esp_camera_sensor_get();
+    if (!s) return false;
+    int r;
+    switch (s->id.PID) {
+        case OV2640_PID: r = s->set_reg(s, 0x109, 0x10, on ? 0x10 : 0); break;   // COM2[4]（sensor bank）
+        case OV3660_PID:
+        case OV5640_PID: r = s->set_reg(s, 0x3008, 0x40, on ? 0x40 : 0); break;  // SYSTEM_CTROL0[6]
+        default:
+            LOGW("CAM","standby unsupported (PID 0x%04X)", (unsigned)s->id.PID);
+            return false;
+    }
+    if (r != 0) { LOGW("CAM","standby %d failed", (int)on); return false; }
+    _standby = on;
+    LOGI("CAM","sensor %s", on ? "standby" : "awake");
+    return true;
+}
+
+void CameraStreamer::startMode()
+{
+    _entryUs   = esp_timer_get_time();
+    _forceNext = true;
+    _due       = true;
+    if (_onDue) _onDue(_onDueArg);
+}
+
+/* 変わった項目だけセンサへ書く。解像度を変えたときは、新しい大きさの最初の fb が
+ * 届くまでを CAM_SWITCH_US に記録する（それ以外はセッタの所要時間） */
+bool CameraStreamer::setSensor(const CamProfile& p, bool force)
+{
+    if (!force && p.size == _prof.size && p.quality == _prof.quality &&
+        p.fps == _prof.fps && p.grab == _prof.grab) return true;
+    if (p.size > _fbSize) {
+        LOGW("CAM","profile framesize %d exceeds fb (%d)", (int)p.size, (int)_fbSize);
+        return false;
+    }
+    sensor_t* s = esp_camera_sensor_get();
+    if (!s) return false;
+    int64_t t0 = esp_timer_get_time();
+    bool resize = force || p.size != _prof.size;
+    if (resize && s->set_framesize(s, p.size) != 0) {
+        LOGW("CAM","set_framesize(%d) failed", (int)p.size);
+        return false;
+    }
+    if (force || p.quality != _prof.quality) s->set_quality(s, p.quality);
+    if (force || p.fps != _prof.fps) setInterval(1000 / (p.fps ? p.fps : CAM_FPS));
+    _src.setFreshUs(p.grab == CamGrab::LATEST ? CAM_FRESH_US : 0);
+    _prof = p;
+
+    uint32_t dt = (uint32_t)(esp_timer_get_time() - t0);
+    if (resize) {
+        _switchT0 = t0;
+        _switchW  = resolution[p.size].width;
+        _switchH  = resolution[p.size].height;
+    } else {
+        Metrics::observe(Metrics::CAM_SWITCH_US, dt);
+    }
+    LOGI("CAM","profile %ux%u q%u %ufps %s (sensor %u us)", (unsigned)resolution[p.size].width,
+         (unsigned)resolution[p.size].height, (unsigned)p.quality, (unsigned)p.fps,
+         p.grab == CamGrab::LATEST ? "latest" : "queued", (unsigned)dt);
+    return true;
+}
 
-    uint64_t t0 = esp_timer_get_time();
-    camera_fb_t* fb = esp_camera_fb_get();
-    if (!fb){
-        LOGW("CAM","fb null");
-        return;
+/* ===== 静止画 ===== */
+void CameraStreamer::requestSnapshot()
+{
+    _snapReq = true;
+    if (_onDue) _onDue(_onDueArg);
+}
+
+/* 解像度・画質だけを静止画用に変えて 1 枚撮り、PSRAM へ写してすぐ fb を返す。
+ * _prof（周期・鮮度の設定）はそのままで、撮り終えたら元の大きさへ戻す。
+ * ストリーム中なら、戻した直後の最初の fb を周期を待たずに配って間隔を詰める */
+bool CameraStreamer::takeSnapshot(FetchServer::Blob& out)
+{
+    _snapReq = false;
+    static constexpr CamProfile kSnap = CAM_PROFILE_SNAP;
+    sensor_t* s = esp_camera_sensor_get();
+    if (!s) return false;
+    if (kSnap.size > _fbSize) {
+        LOGW("CAM","snapshot framesize %d exceeds fb (%d)", (int)kSnap.size, (int)_fbSize);
+        return false;
     }
-    uint64_t t1 = esp_timer_get_time();
+    TRACE_SCOPE("cam.snap");
+    int64_t t0 = esp_timer_get_time();
+    bool streaming = _tPubUs && t0 - _tPubUs < 2 * (int64_t)_interval * 1000;
+    bool slept = _standby;
+    if (slept) setStandby(false);
 
-    bool ok = ws.sendFrame(fb->buf, fb->len, 80);
-    esp_camera_fb_return(fb);
+    _src.service();                      // 書きかけの送出を進めて fb を空ける
+    _src.setFreshUs(0);                  // 大きい fb は転送だけで CAM_FRESH_US を超えうる
+    s->set_framesize(s, kSnap.size);
+    s->set_quality(s, kSnap.quality);
+    FrameRef f = grabSized(kSnap.size, esp_timer_get_time());
+    bool ok = f && keepSnapshot(f);
+    f.reset();
 
-    if (ok) _tLast = millis();
+    s->set_framesize(s, _prof.size);
+    s->set_quality(s, _prof.quality);
+    _src.setFreshUs(_prof.grab == CamGrab::LATEST ? CAM_FRESH_US : 0);
+    int64_t tBack = esp_timer_get_time();
+    Metrics::observe(Metrics::SNAP_US, (uint32_t)(tBack - t0));
+    LOGI("CAM","snapshot %s %ux%u %uB (%u us)", ok ? "ok" : "failed", (unsigned)_snapW,
+         (unsigned)_snapH, (unsigned)_snapLen, (unsigned)(tBack - t0));
 
-    LOGD("CAM","cap %uB in %llu us, send %s",
-         (unsigned)fb->len,
-         (unsigned long long)(t1 - t0),
-         ok ? "ok" : "drop");
+    if (slept) {
+        setStandby(true);
+    } else if (streaming) {
+        _gapFrom   = _tPubUs;
+        _forceNext = true;               // 静止画の前と同じ絵でも重複として捨てない
+        uint32_t mask = _src.wanting();
+        if (mask) {
+            FrameRef g = grabSized(_prof.size, tBack);
+            if (g) deliver(std::move(g), mask, 0);
+        }
+    }
+    return ok && snapshot(_snapId, out);
 }
 
-void CameraStreamer::stream(UdpAgent& udp){
-    if (millis() - _tLast < _interval || !udp.ready()) return;
+bool CameraStreamer::snapshot(uint32_t id, FetchServer::Blob& out) const
+{
+    if (!_snapLen || id != _snapId) return false;
+    out.id    = _snapId;
+    out.data  = _snapBuf;
+    out.len   = (uint32_t)_snapLen;
+    out.w     = _snapW;
+    out.h     = _snapH;
+    out.capUs = _snapCapUs;
+    return true;
+}
 
-    camera_fb_t* fb = esp_camera_fb_get();
-    if (!fb){ LOGW("CAM","fb null"); return; }
+bool CameraStreamer::keepSnapshot(const FrameRef& f)
+{
+    if (f.len() > _snapCap) {
+        heap_caps_free(_snapBuf);
+        size_t cap = (f.len() + 0xFFFF) & ~(size_t)0xFFFF;      // 64 KB 単位で伸ばす
+        _snapBuf = (uint8_t*)heap_caps_malloc(cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        _snapCap = _snapBuf ? cap : 0;
+        _snapLen = 0;
+        if (!_snapBuf) { LOGW("CAM","snapshot buffer %u B alloc failed", (unsigned)cap); return false; }
+    }
+    memcpy(_snapBuf, f.data(), f.len());
+    _snapLen   = f.len();
+    _snapW     = f.width();
+    _snapH     = f.height();
+    _snapCapUs = f.capUs();
+    _snapId    = kSnapIdBit | ((_snapId + 1) & ~kSnapIdBit);
+    return true;
+}
 
-    bool ok = udp.sendRtpJpegFrame(fb->buf, fb->len, fb->width, fb->height);
-    esp_camera_fb_return(fb);
+/* notBeforeUs 以降に撮られた size の大きさの fb（解像度を変えた直後は前の大きさが混じる） */
+FrameRef CameraStreamer::grabSized(framesize_t size, int64_t notBeforeUs)
+{
+    for (int i = 0; i < CAM_SNAP_TRIES; ++i) {
+        FrameRef f = _src.grab(notBeforeUs);
+        if (!f) continue;
+        if (f.width() == resolution[size].width && f.height() == resolution[size].height) return f;
+        Metrics::inc(Metrics::CAM_STALE_DROPS);
+    }
+    return FrameRef();
+}
 
-    if (ok) _tLast = millis();
+void CameraStreamer::setInterval(uint32_t ms)
+{
+    _interval = ms ? ms : 1;
+    if (!_timer) return;
+    esp_timer_stop(_timer);
+    esp_timer_start_periodic(_timer, (uint64_t)_interval * 1000);
+}
+
+void CameraStreamer::noteSwitched(const FrameRef& f)
+{
+    if (!_switchT0 || f.width() != _switchW || f.height() != _switchH) return;
+    uint32_t dt = (uint32_t)(esp_timer_get_time() - _switchT0);
+    Metrics::observe(Metrics::CAM_SWITCH_US, dt);
+    LOGI("CAM","first %ux%u frame %u us after switch", (unsigned)_switchW, (unsigned)_switchH, (unsigned)dt);
+    _switchT0 = 0;
+}
+
+bool CameraStreamer::startFrameTimer(void (*onDue)(void*), void* arg){
+    if (_timer) return true;
+    _onDue = onDue; _onDueArg = arg;
+    esp_timer_create_args_t a{};
+    a.callback = &CameraStreamer::onTimer;
+    a.arg      = this;
+    a.name     = "camDue";
+    if (esp_timer_create(&a, &_timer) != ESP_OK) { _timer = nullptr; return false; }
+    esp_timer_start_periodic(_timer, (uint64_t)_interval * 1000);
+    LOGI("CAM","frame timer %u ms", (unsigned)_interval);
+    return true;
+}
+
+void CameraStreamer::onTimer(void* arg){
+    auto* self = static_cast<CameraStreamer*>(arg);
+    self->_due = true;
+    if (self->_onDue) self->_onDue(self->_onDueArg);
+}
+
+/* 送出タイミングか（タイマ未起動なら従来の millis 間隔判定） */
+bool CameraStreamer::takeDue(){
+    if (!_timer && !_due) return millis() - _tLast >= _interval;
+    if (!_due) return false;
+    _due = false;
+    return true;
+}
+
+/* 1 周期 1 回だけ撮像し、受け取れる sink へ同じ fb を配る。
+ * どの sink も受け取れない周期（クレジット切れ等）は撮像自体を見送る（FrameHistory が
+ * 有効なら履歴のために撮り続ける） */
+void CameraStreamer::stream()
+{
+    _src.service();                      // 書きかけの送出を先に進めて枠を空ける
+    if (!takeDue()) return;
+    uint32_t mask = _src.wanting();
+    if (!mask) return;
+    TRACE_SCOPE("cam.stream");
+
+    int64_t entry = _entryUs.load();
+    FrameRef f = _src.grab(entry);
+    if (!f) return;
+    deliver(std::move(f), mask, entry);
+}
+
+/* 撮った fb を mask の sink へ配る（重複なら捨てる）。モード進入・静止画からの復帰の計測もここ */
+void CameraStreamer::deliver(FrameRef f, uint32_t mask, int64_t entry)
+{
+    noteSwitched(f);
+    _src.notifyCaptured(mask);
+    if (skipDuplicate(f)) return;        // f の解放で fb も返る
+    _tLast = millis();
+    int64_t now = esp_timer_get_time();
+    if (entry && _entryUs.compare_exchange_strong(entry, 0)) {
+        uint32_t dt = (uint32_t)(now - entry);
+        Metrics::observe(Metrics::MODE_FIRST_FRAME_US, dt);
+        LOGI("CAM","first frame %u us after mode entry (age %u us)", (unsigned)dt,
+             (unsigned)(now - f.capUs()));
+    }
+    if (_gapFrom) {
+        uint32_t gap = (uint32_t)(now - _gapFrom);
+        Metrics::observe(Metrics::SNAP_GAP_US, gap);
+        LOGI("CAM","stream gap %u us around snapshot", (unsigned)gap);
+        _gapFrom = 0;
+    }
+    _tPubUs = now;
+    _src.publish(std::move(f), mask);
+    _src.service();
+}
+
+/* 静止シーンの重複フレームか（true なら捨てる）。間隔タイマは進める */
+bool CameraStreamer::skipDuplicate(const FrameRef& f){
+#if DEDUP_ENABLE
+    if (_forceNext) { _forceNext = false; _dedup.reset(); }
+    if (_dedup.shouldSend(f.data(), f.len(), millis())) return false;
+    _tLast = millis();
+    return true;
+#else
+    (void)f;
+    return false;
+#endif
+}
+
+/* ===== WsFrameSink ===== */
+bool WsFrameSink::accept()
+{
+    if (!_ws.ready()) return false;
+    if (!_cur && _ws.canSend()) return true;
+    Metrics::inc(Metrics::WS_STALLS);    // 送出中 / クレジット無し
+    return false;
+}
+
+void WsFrameSink::service()
+{
+    if (!_cur) {
+        if (!take(_cur)) return;
+        if (!_ws.beginJpeg(_cur.data(), _cur.len(), _cur.width(), _cur.height(), _cur.capUs(), 80)) {
+            _cur.reset();
+            return;
+        }
+    }
+    int r = _ws.pump();
+    if (r != 0) finish(r > 0);
+}
+
+void WsFrameSink::finish(bool ok)
+{
+    if (ok) Metrics::observe(Metrics::FRAME_TO_WIRE_US, (uint32_t)(esp_timer_get_time() - _cur.capUs()));
+    LOGD("CAM","ws frame #%u %uB %s", (unsigned)_cur.seq(), (unsigned)_cur.len(), ok ? "ok" : "drop");
+    _cur.reset();
+}
+
+/* ===== UdpFrameSink ===== */
+bool UdpFrameSink::available() { return _udp.ready(); }
+void UdpFrameSink::onCaptured(){ _udp.noteCapture(); }
+
+void UdpFrameSink::service()
+{
+    FrameRef f;
+    while (take(f)) {
+        bool ok = (kind() == Kind::RAW)
+                ? _udp.sendFrame(f.data(), f.len())
+                : _udp.sendRtpJpegFrame(f.data(), f.len(), f.width(), f.height(), f.capUs());
+        if (ok) Metrics::observe(Metrics::FRAME_TO_WIRE_US, (uint32_t)(esp_timer_get_time() - f.capUs()));
+        f.reset();
+    }
+}
+
+/* ===== RtspFrameSink ===== */
+bool RtspFrameSink::available() { return _rtsp.isPlaying(); }
+
+void RtspFrameSink::service()
+{
+    FrameRef f;
+    while (take(f)) {
+        bool ok = _rtsp.sendJpegFrame(f.data(), f.len(), f.width(), f.height(), f.capUs());
+        if (ok) Metrics::observe(Metrics::FRAME_TO_WIRE_US, (uint32_t)(esp_timer_get_time() - f.capUs()));
+        f.reset();
+    }
 }
 
 void CameraStreamer::initCameraConfig(camera_config_t& config) {
@@ -68,7 +380,7 @@ void CameraStreamer::initCameraConfig(camera_config_t& config) {
     config.pin_pwdn = PWDN_GPIO_NUM;
     config.pin_reset = RESET_GPIO_NUM;
     config.xclk_freq_hz = 20000000;
-    config.frame_size = FRAMESIZE_240X240;
+    config.frame_size = CAM_FB_FRAMESIZE;        // fb の大きさ。撮像サイズはプロファイルで下げる
     config.pixel_format = PIXFORMAT_JPEG;
     config.grab_mode = CAMERA_GRAB_WHEN_EMPTY;
     config.fb_location = CAMERA_FB_IN_PSRAM;
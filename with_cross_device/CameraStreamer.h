@@ -2,20 +2,139 @@
 #include <Arduino.h>
 
 #include "WsAgent.h"
+#include "FrameDedup.h"
+#include "FrameSource.h"
+#include "StreamSink.h"
+#include "FetchServer.h"
+#include "FrameHistory.h"
 #include "esp_camera.h"
+#include <esp_timer.h>
+#include <atomic>
 #define CAMERA_MODEL_XIAO_ESP32S3
 #include "camera_pins.h"
 
 class UdpAgent;
+class RtspServer;
+
+/* 撮像の取り方。esp32-camera の grab_mode は初期化時にしか変えられないので、
+ * ドライバは LATEST のまま FrameSource 側で鮮度を見る */
+enum class CamGrab : uint8_t {
+    QUEUED,                              // ドライバが渡した fb をそのまま使う
+    LATEST,                              // CAM_FRESH_US より古い fb は捨てて撮り直す
+};
+
+/* モードごとのカメラ設定（config.h の CAM_PROFILE_*） */
+struct CamProfile {
+    framesize_t size;                    // CAM_FB_FRAMESIZE 以下
+    uint8_t     quality;                 // jpeg_quality（小さいほど高画質）
+    uint8_t     fps;
+    CamGrab     grab;
+};
+
+/* WS 送出 sink: クレジットが無ければ受け取らない。fb は送り終えるまで握る */
+class WsFrameSink : public StreamSink {
+public:
+    explicit WsFrameSink(WsAgent& ws) : StreamSink(Kind::WS, 1, Drop::OLDEST), _ws(ws) {}
+    bool available() override { return _ws.ready(); }
+    void service() override;
+protected:
+    bool accept() override;
+private:
+    WsAgent& _ws;
+    FrameRef _cur;                       // 非ブロッキング送出中のフレーム（外されても送り切る）
+    void finish(bool ok);
+};
+
+/* RTP/JPEG（または RAW UDP）送出 sink。種別は UdpAgent の begin() のモードに合わせる */
+class UdpFrameSink : public StreamSink {
+public:
+    UdpFrameSink(UdpAgent& udp, Kind k) : StreamSink(k, 1, Drop::OLDEST), _udp(udp) {}
+    bool available() override;
+    void onCaptured() override;
+    void service() override;
+private:
+    UdpAgent& _udp;
+};
+
+/* RTSP 送出 sink: クライアントが PLAY している間だけ */
+class RtspFrameSink : public StreamSink {
+public:
+    explicit RtspFrameSink(RtspServer& rtsp) : StreamSink(Kind::RTSP, 1, Drop::OLDEST), _rtsp(rtsp) {}
+    bool available() override;
+    void service() override;
+private:
+    RtspServer& _rtsp;
+};
 
 class CameraStreamer {
 public:
-    bool begin();                 
-    void stream(WsAgent& ws);
-    void stream(UdpAgent& udp);
+    bool begin(const CamProfile& initial);
+
+    /* プロファイル切り替え・センサの standby。request はどのタスクからでも、
+     * 適用は netcamTask の applyPending()（sensor_t のセッタ。再初期化しない） */
+    void requestProfile(const CamProfile* p) { _want.store(p, std::memory_order_release); }
+    void requestStandby(bool on);
+    void applyPending();
+    const CamProfile& profile() const { return _prof; }
+    bool addSink(FrameSink* s) { return _src.addSink(s); }
+    void stream();                // 周期が来たら 1 回撮像して登録済みの sink へ配る（netcamTask）
+
+    /* 実行モード開始: 静止判定を外し、周期を待たずに撮る。進入より前に撮られた fb は
+     * 捨てる。進入から最初のフレームを sink へ渡すまでを MODE_FIRST_FRAME_US に記録 */
+    void startMode();
+
+    /* 高解像度の静止画（CAM_PROFILE_SNAP）を 1 枚。要求はどのタスクからでも、撮影は netcamTask の
+     * takeSnapshot()。その間ストリームは止まるので、解像度を戻したら周期を待たずに次のフレームを
+     * 配る（前後のフレーム間隔を SNAP_GAP_US に記録）。静止画は次の撮影まで PSRAM に残す */
+    void requestSnapshot();
+    bool snapshotRequested() const { return _snapReq.load(); }
+    bool takeSnapshot(FetchServer::Blob& out);                 // 撮れたら out に入れて true
+    bool snapshot(uint32_t id, FetchServer::Blob& out) const;  // id の静止画がまだ残っていれば true
+
+    /* 配ったフレームの直近 HISTORY_MS（ボタン押下時に見えていたフレームを後から引く） */
+    FrameHistory& history() { return _hist; }
+
+    /* 撮像周期タイマ（1/fps、プロファイルで変わる）。周期ごとに onDue(arg) を呼ぶ（netcamTask の起床用）。
+     * 開始後は stream() の間隔判定がタイマ基準になる（送出時間で周期が伸びない） */
+    bool startFrameTimer(void (*onDue)(void*), void* arg);
 private:
     uint32_t _interval = 100;    
     uint32_t _tLast = 0;
-    uint32_t _nextOkAfter  = 0;
+    FrameSource _src;
+    FrameHistory _hist;
+    FrameDedup _dedup;
+    volatile bool _forceNext = false;
+    esp_timer_handle_t _timer = nullptr;
+    CamProfile _prof{};
+    framesize_t _fbSize = CAM_FB_FRAMESIZE;   // 実際に確保した fb の大きさ（PSRAM 無しでは VGA）
+    std::atomic<const CamProfile*> _want{nullptr};
+    int64_t  _switchT0 = 0;              // 解像度を変えた時刻（新しい大きさの最初の fb まで）
+    uint16_t _switchW = 0, _switchH = 0;
+    bool setSensor(const CamProfile& p, bool force);
+    void setInterval(uint32_t ms);
+    void noteSwitched(const FrameRef& f);
+    std::atomic<int64_t> _entryUs{0};    // startMode() の時刻（最初のフレームを渡すまで）
+    std::atomic<int8_t>  _standbyReq{-1};   // -1 = 要求なし / 0 = 起こす / 1 = 眠らせる
+    bool _standby = false;
+    bool setStandby(bool on);
+    /* 静止画（id の最上位ビットを立てて撮影ごとに進める） */
+    static constexpr uint32_t kSnapIdBit = 0x80000000u;
+    std::atomic<bool> _snapReq{false};
+    uint8_t* _snapBuf = nullptr;
+    size_t   _snapCap = 0, _snapLen = 0;
+    uint32_t _snapId = 0;
+    uint16_t _snapW = 0, _snapH = 0;
+    uint64_t _snapCapUs = 0;
+    int64_t  _tPubUs  = 0;               // 最後に sink へ配った時刻
+    int64_t  _gapFrom = 0;               // 静止画の直前に配った時刻（復帰後の最初のフレームまで）
+    bool keepSnapshot(const FrameRef& f);
+    FrameRef grabSized(framesize_t size, int64_t notBeforeUs);
+    void deliver(FrameRef f, uint32_t mask, int64_t entry);
+    void (*_onDue)(void*) = nullptr;
+    void* _onDueArg = nullptr;
+    volatile bool _due = false;
+    bool takeDue();
+    static void onTimer(void* arg);
+    bool skipDuplicate(const FrameRef& f);
     void initCameraConfig(camera_config_t&);
 };
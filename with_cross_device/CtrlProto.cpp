@@ -0,0 +1,135 @@
+#include "CtrlProto.h"
+#include <string.h>
+
+namespace ctrlproto {
+
+static inline void put16(uint8_t* p, uint16_t v){ p[0] = uint8_t(v >> 8); p[1] = uint8_t(v); }
+static inline void put32(uint8_t* p, uint32_t v){
+  p[0] = uint8_t(v >> 24); p[1] = uint8_t(v >> 16); p[2] = uint8_t(v >> 8); p[3] = uint8_t(v);
+}
+static inline uint16_t get16(const uint8_t* p){ return uint16_t(p[0] << 8 | p[1]); }
+static inline uint32_t get32(const uint8_t* p){
+  return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+size_t encode(const Msg& m, uint8_t* out, size_t cap){
+  if (m.len > MAX_PAYLOAD || cap < HDR_LEN + m.len) return 0;
+  out[0] = 'W'; out[1] = 'C'; out[2] = VERSION;
+  out[3] = (uint8_t)m.type; out[4] = m.flags; out[5] = m.len;
+  put16(out + 6, m.seq); put32(out + 8, m.ts_us); put32(out + 12, m.epoch);
+  memcpy(out + HDR_LEN, m.payload, m.len);
+  return HDR_LEN + m.len;
+}
+
+bool decode(const uint8_t* d, size_t n, Msg& m){
+  if (n < HDR_LEN || d[0] != 'W' || d[1] != 'C' || d[2] != VERSION) return false;
+  m.type = (Type)d[3]; m.flags = d[4]; m.len = d[5];
+  if (m.len > MAX_PAYLOAD || HDR_LEN + m.len > n) return false;
+  m.seq = get16(d + 6); m.ts_us = get32(d + 8); m.epoch = get32(d + 12);
+  memcpy(m.payload, d + HDR_LEN, m.len);
+  return true;
+}
+
+/* ===== CtrlPeer ========================================================== */
+void CtrlPeer::begin(SendFn send, uint32_t rto_us, uint8_t max_tries, uint32_t epoch){
+  _send = std::move(send);
+  _rto_us = rto_us; _maxTries = max_tries;
+  _epoch = epoch;
+  for (auto& p : _pend) p.used = false;
+  _rxInit = false;
+}
+
+bool CtrlPeer::send(Type t, const uint8_t* payload, size_t len, uint32_t now_us, bool reliable){
+  if (len > MAX_PAYLOAD || !_send) return false;
+  Msg m{};
+  m.type = t; m.flags = reliable ? F_NEED_ACK : 0;
+  m.seq = _seq++; m.ts_us = now_us; m.epoch = _epoch; m.len = (uint8_t)len;
+  if (len) memcpy(m.payload, payload, len);
+
+  if (!reliable) {
+    uint8_t b[HDR_LEN + MAX_PAYLOAD];
+    size_t n = encode(m, b, sizeof(b));
+    _send(b, n); _st.sent++;
+    return true;
+  }
+  Pending* slot = nullptr;
+  for (auto& p : _pend) if (!p.used) { slot = &p; break; }
+  if (!slot) return false;
+  slot->len = (uint8_t)encode(m, slot->buf, sizeof(slot->buf));
+  slot->used = true; slot->seq = m.seq; slot->sent_us = now_us; slot->tries = 1;
+  _send(slot->buf, slot->len); _st.sent++;
+  return true;
+}
+
+bool CtrlPeer::isDuplicate(uint16_t seq){
+  if (!_rxInit) { _rxInit = true; _rxMax = seq; _rxMask = 1; return false; }
+  int16_t d = (int16_t)(seq - _rxMax);
+  if (d > 0) {
+    _rxMask = (d >= 64) ? 1 : (_rxMask << d) | 1;
+    _rxMax = seq;
+    return false;
+  }
+  if (-d >= 64) return true;                 // 窓より古い（再送の残骸とみなす）
+  uint64_t bit = 1ull << (-d);
+  if (_rxMask & bit) return true;
+  _rxMask |= bit;
+  return false;
+}
+
+bool CtrlPeer::onDatagram(const uint8_t* d, size_t n, uint32_t now_us, Msg& out){
+  Msg m;
+  if (!decode(d, n, m)) return false;
+
+  if (m.type == Type::ACK) {
+    if (m.len < 6) return false;
+    uint16_t s = get16(m.payload);
+    for (auto& p : _pend) {
+      if (p.used && p.seq == s) {
+        p.used = false; _st.acked++;
+        _st.rtt_last_us = now_us - get32(m.payload + 2);
+      }
+    }
+    return false;
+  }
+
+  if (!_rxInit || m.epoch != _rxEpoch) {     // 対向が再起動した: seq が巻き戻るので窓を捨てる
+    _rxEpoch = m.epoch;
+    _rxInit  = false;
+  }
+  if (m.flags & F_NEED_ACK) {                // 重複でも ACK は返す（ACK 喪失時の再送対策）
+    uint8_t a[6];
+    put16(a, m.seq); put32(a + 2, m.ts_us);
+    Msg ack{};
+    ack.type = Type::ACK; ack.seq = _seq++; ack.ts_us = now_us; ack.epoch = _epoch; ack.len = 6;
+    memcpy(ack.payload, a, 6);
+    uint8_t b[HDR_LEN + 6];
+    size_t k = encode(ack, b, sizeof(b));
+    if (_send) _send(b, k);
+  }
+  if (isDuplicate(m.seq)) { _st.dups++; return false; }
+  out = m;
+  return true;
+}
+
+void CtrlPeer::tick(uint32_t now_us){
+  for (auto& p : _pend) {
+    if (!p.used || now_us - p.sent_us < _rto_us) continue;
+    if (p.tries >= _maxTries) { p.used = false; _st.gave_up++; continue; }
+    p.tries++; p.sent_us = now_us;
+    _send(p.buf, p.len);
+    _st.retransmits++;
+  }
+}
+
+uint32_t CtrlPeer::nextDeadlineUs(uint32_t now_us) const {
+  uint32_t w = UINT32_MAX;
+  for (const auto& p : _pend) {
+    if (!p.used) continue;
+    uint32_t el = now_us - p.sent_us;
+    uint32_t r  = el >= _rto_us ? 0 : _rto_us - el;
+    if (r < w) w = r;
+  }
+  return w;
+}
+
+} // namespace ctrlproto
@@ -0,0 +1,108 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+
+/**
+ * CtrlProto : RTP の横に置く UDP 制御チャネル（モード / モータ / ボタン / ACK）
+ *
+ * datagram（big-endian, 16B ヘッダ + payload）
+ *   0  'W' 'C'   magic
+ *   2  ver(1)=1
+ *   3  type(1)   MODE / MOTOR / BUTTON / ACK / HELLO
+ *   4  flags(1)  bit0 = ACK 要求
+ *   5  len(1)    payload 長
+ *   6  seq(2)    送信側ごとの通し番号
+ *   8  ts_us(4)  送信側時計（esp_timer / 任意の µs 時計の下位 32bit）
+ *  12  epoch(4)  送信側の起動ごとの値。変わったら受信側は重複排除窓を捨てる
+ *                （対向の再起動で seq が巻き戻っても、HELLO を待たずに受けられる）
+ *  16  payload
+ *     MODE / MOTOR : value(2)
+ *     BUTTON       : act(1) press_us(4) event(2)
+ *                    （ButtonLogic::Act, 押下エッジ時刻, その時のフレームを FetchServer の EVENT で引く番号）
+ *     ACK          : seq(2) echo_ts(4)    （echo_ts で送信側が RTT を測る）
+ *     HELLO        : nonce(4)             （epoch と同じ値。対向が宛先を学習する）
+ *
+ * CtrlPeer は 1 対向分の状態（再送キュー・重複排除窓）を持つ。ソケットは持たず、
+ * 送出は begin() で渡す関数経由。ARDUINO 非依存（ホストの参照実装と共用）。
+ */
+namespace ctrlproto {
+
+constexpr uint8_t  VERSION  = 2;
+constexpr size_t   HDR_LEN  = 16;
+constexpr size_t   MAX_PAYLOAD = 32;
+constexpr uint8_t  F_NEED_ACK  = 0x01;
+
+enum class Type : uint8_t { MODE = 1, MOTOR = 2, BUTTON = 3, ACK = 4, HELLO = 5 };
+
+struct Msg {
+  Type     type;
+  uint8_t  flags;
+  uint16_t seq;
+  uint32_t ts_us;
+  uint32_t epoch;
+  uint8_t  len;
+  uint8_t  payload[MAX_PAYLOAD];
+  uint16_t u16() const { return len >= 2 ? uint16_t(payload[0] << 8 | payload[1]) : 0; }
+};
+
+size_t encode(const Msg& m, uint8_t* out, size_t cap);
+bool   decode(const uint8_t* d, size_t n, Msg& m);
+
+class CtrlPeer {
+public:
+  using SendFn = std::function<void(const uint8_t* d, size_t n)>;
+
+  struct Stats {
+    uint32_t sent = 0, retransmits = 0, gave_up = 0, dups = 0, acked = 0;
+    uint32_t rtt_last_us = 0;
+  };
+
+  // epoch: 起動ごとに変える値（全メッセージのヘッダに載る）
+  void begin(SendFn send, uint32_t rto_us, uint8_t max_tries, uint32_t epoch);
+
+  // ACK 要求付きで送る（再送キューが満杯なら false）。unreliable は HELLO 等に
+  bool send(Type t, const uint8_t* payload, size_t len, uint32_t now_us, bool reliable = true);
+  bool sendU16(Type t, uint16_t v, uint32_t now_us) {
+    uint8_t b[2] = { uint8_t(v >> 8), uint8_t(v) };
+    return send(t, b, 2, now_us);
+  }
+
+  // 受信処理: 新しいメッセージなら out に入れて true。ACK 要求には（重複でも）ACK を返す。
+  // ACK 自体は内部で消費して false（RTT は stats().rtt_last_us）。
+  bool onDatagram(const uint8_t* d, size_t n, uint32_t now_us, Msg& out);
+
+  void     tick(uint32_t now_us);            // RTO 超過分の再送
+  uint32_t nextDeadlineUs(uint32_t now_us) const;   // 次の再送までの µs（無ければ UINT32_MAX）
+  const Stats& stats() const { return _st; }
+
+private:
+  static constexpr size_t PENDING = 8;
+  struct Pending {
+    bool     used = false;
+    uint16_t seq  = 0;
+    uint32_t sent_us = 0;
+    uint8_t  tries = 0;
+    uint8_t  len  = 0;
+    uint8_t  buf[HDR_LEN + MAX_PAYLOAD];
+  };
+
+  bool isDuplicate(uint16_t seq);
+
+  SendFn   _send;
+  uint32_t _rto_us = 30000;
+  uint8_t  _maxTries = 5;
+  uint16_t _seq = 1;
+  uint32_t _epoch = 0;
+  Pending  _pend[PENDING];
+
+  // 受信側の重複排除窓（最大 seq と直近 64 個のビットマップ）
+  bool     _rxInit = false;
+  uint16_t _rxMax  = 0;
+  uint64_t _rxMask = 0;
+  uint32_t _rxEpoch = 0;                   // 対向の epoch（再起動検出）
+
+  Stats    _st;
+};
+
+} // namespace ctrlproto
@@ -0,0 +1,142 @@
+#include "FetchServer.h"
+#include "NetDebug.h"
+#include "Metrics.h"
+
+static inline uint32_t rd32(const uint8_t* p){
+  return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+static inline uint16_t rd16(const uint8_t* p){ return uint16_t((p[0] << 8) | p[1]); }
+static inline uint8_t* wr16(uint8_t* p, uint16_t v){ p[0] = uint8_t(v >> 8); p[1] = uint8_t(v); return p + 2; }
+static inline uint8_t* wr32(uint8_t* p, uint32_t v){
+  p[0] = uint8_t(v >> 24); p[1] = uint8_t(v >> 16); p[2] = uint8_t(v >> 8); p[3] = uint8_t(v);
+  return p + 4;
+}
+
+bool FetchServer::begin(uint16_t port){
+  if (_sock >= 0) return true;
+  int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (s < 0) { LOGE("FETCH","udp socket failed"); return false; }
+  sockaddr_in local{};
+  local.sin_family = AF_INET;
+  local.sin_port = htons(port);
+  local.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(s, (sockaddr*)&local, sizeof(local)) < 0) {
+    LOGE("FETCH","bind %u failed", (unsigned)port);
+    close(s);
+    return false;
+  }
+  int fl = fcntl(s, F_GETFL, 0);
+  fcntl(s, F_SETFL, fl | O_NONBLOCK);
+  _sock = s;
+  LOGI("FETCH","listening udp %u", (unsigned)port);
+  return true;
+}
+
+void FetchServer::service(){
+  if (_sock < 0) return;
+  uint8_t b[32];                         // 要求はどれも短い
+  for (;;) {
+    sockaddr_in from{};
+    socklen_t fl = sizeof(from);
+    int n = recvfrom(_sock, (char*)b, sizeof(b), 0, (sockaddr*)&from, &fl);
+    if (n <= 0) break;
+    handle(b, (size_t)n, from);
+  }
+}
+
+void FetchServer::handle(const uint8_t* p, size_t n, const sockaddr_in& from){
+  if (n < 4 || p[0] != MAGIC0 || p[1] != MAGIC1) return;
+  const uint8_t* q = p + 4;
+  switch ((Type)p[2]) {
+    case Type::SNAP:
+      if (n >= 8) onSnap(rd32(q), from);
+      break;
+    case Type::AT:
+      if (n >= 12) onFindReq(Type::AT, rd32(q), rd32(q + 4), from);
+      break;
+    case Type::EVENT:
+      if (n >= 10) onFindReq(Type::EVENT, rd32(q), rd16(q + 4), from);
+      break;
+    case Type::GET: {
+      if (n < 13) return;
+      uint32_t id = rd32(q), off = rd32(q + 4);
+      Blob b;
+      if (!_lookup || !_lookup(id, b)) {
+        Blob gone; gone.id = id;
+        sendMeta(from, 0, Status::GONE, &gone);
+        return;
+      }
+      sendChunks(from, b, off, q[8]);
+    } break;
+    default: break;
+  }
+}
+
+/* 同じ req の再送には今の状態を返すだけ。新しい req なら撮影を要求して PENDING */
+void FetchServer::onSnap(uint32_t req, const sockaddr_in& from){
+  if (req == _snapReq && (_snapBusy || _snapBlob || _snapFail)) {
+    if (_snapBusy)      { sendMeta(from, req, Status::PENDING, nullptr); return; }
+    if (_snapFail)      { sendMeta(from, req, Status::FAILED, nullptr);  return; }
+    Blob b;
+    if (_lookup && _lookup(_snapBlob, b)) sendMeta(from, req, Status::OK, &b);
+    else { Blob gone; gone.id = _snapBlob; sendMeta(from, req, Status::GONE, &gone); }
+    return;
+  }
+  if (_snapBusy || !_snap) { sendMeta(from, req, Status::FAILED, nullptr); return; }   // 別の撮影中
+  _snapReq  = req;
+  _snapBlob = 0;
+  _snapFail = false;
+  _snapBusy = true;
+  _snapFrom = from;
+  LOGI("FETCH","snapshot req=%u", (unsigned)req);
+  sendMeta(from, req, Status::PENDING, nullptr);
+  _snap();
+}
+
+void FetchServer::onFindReq(Type t, uint32_t req, uint32_t key, const sockaddr_in& from){
+  Blob b;
+  if (_find && _find(t, key, b)) sendMeta(from, req, Status::OK, &b);
+  else                           sendMeta(from, req, Status::GONE, nullptr);
+}
+
+void FetchServer::snapshotDone(const Blob* b){
+  if (!_snapBusy) return;
+  _snapBusy = false;
+  _snapFail = (b == nullptr);
+  _snapBlob = b ? b->id : 0;
+  sendMeta(_snapFrom, _snapReq, b ? Status::OK : Status::FAILED, b);
+}
+
+void FetchServer::sendMeta(const sockaddr_in& to, uint32_t req, Status st, const Blob* b){
+  uint8_t* p = _tx;
+  *p++ = MAGIC0; *p++ = MAGIC1; *p++ = (uint8_t)Type::META; *p++ = 0;
+  p = wr32(p, req);
+  *p++ = (uint8_t)st;
+  p = wr32(p, b ? b->id : 0);
+  p = wr32(p, (b && b->data) ? b->len : 0);
+  p = wr16(p, b ? b->w : 0);
+  p = wr16(p, b ? b->h : 0);
+  p = wr32(p, b ? (uint32_t)b->capUs : 0);
+  sendTo(to, (size_t)(p - _tx));
+}
+
+/* offset から最大 count チャンク。送信バッファが詰まったらそこで止める（残りはサーバが GET し直す） */
+void FetchServer::sendChunks(const sockaddr_in& to, const Blob& b, uint32_t off, uint8_t count){
+  if (count > FETCH_WINDOW) count = FETCH_WINDOW;
+  for (uint8_t i = 0; i < count && off < b.len; ++i) {
+    size_t k = b.len - off;
+    if (k > FETCH_CHUNK) k = FETCH_CHUNK;
+    uint8_t* p = _tx;
+    *p++ = MAGIC0; *p++ = MAGIC1; *p++ = (uint8_t)Type::DATA; *p++ = 0;
+    p = wr32(p, b.id);
+    p = wr32(p, off);
+    memcpy(p, b.data + off, k);
+    if (!sendTo(to, 12 + k)) break;
+    Metrics::inc(Metrics::FETCH_CHUNKS);
+    off += (uint32_t)k;
+  }
+}
+
+bool FetchServer::sendTo(const sockaddr_in& to, size_t n){
+  return sendto(_sock, (const char*)_tx, n, 0, (const sockaddr*)&to, sizeof(to)) == (int)n;
+}
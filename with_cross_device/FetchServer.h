@@ -0,0 +1,78 @@
+#pragma once
+#include <Arduino.h>
+#include <lwip/sockets.h>
+#include <netinet/in.h>
+#include <functional>
+#include "config.h"
+
+/**
+ * FetchServer : 端末に残した JPEG（静止画など）をサーバが UDP で引き取るチャネル
+ *  - 要求はサーバから、FETCH_UDP_PORT（端末側で bind）へ送る。応答は要求元へ返す
+ *  - 取り出しはサーバ主導の GET（blob, offset, チャンク数）。抜けた範囲は GET し直せば
+ *    よく、blob が端末に残っている間はいつでも途中から再開できる（端末は状態を持たない）
+ *  - service() は netcamTask から呼ぶ（fd() を sockWatch が見る）。Lookup / onSnapshot / onFind も
+ *    netcamTask の中で呼ばれるので、blob の中身はその間だけ有効であればよい
+ *
+ * メッセージ（big-endian、先頭 'W' 'F' type(1) 0(1)）
+ *   SNAP  サーバ→端末  req(4)                   高解像度の静止画を 1 枚撮る
+ *   AT    サーバ→端末  req(4) ts_us(4)          履歴から ts_us 以前で最も新しいフレーム
+ *   EVENT サーバ→端末  req(4) event(2)          履歴からボタンイベント（BUTTON）の押下時刻のフレーム
+ *   META  端末→サーバ  req(4) status(1) blob(4) size(4) w(2) h(2) cap_us(4)
+ *   GET   サーバ→端末  blob(4) offset(4) count(1)  offset から count チャンク（≤ FETCH_WINDOW）
+ *   DATA  端末→サーバ  blob(4) offset(4) | FETCH_CHUNK 以下のバイト列
+ * SNAP は req で冪等: 撮影中は PENDING、撮影後は同じ META を返す（META の取りこぼし対策）。
+ * AT / EVENT はその場で探して META を返す（見つからなければ GONE）。ts_us は端末の esp_timer の
+ * 下位 32 bit（BUTTON の press_us・JF の ts_us と同じ時計）。event と press_us は BUTTON で届く
+ * （WS の CTRL と、CTRL_TRANSPORT!=0 なら CtrlProto の両方。中身は同じ）。
+ * 消えた blob への GET には META(req=0, status=GONE) を返す。
+ */
+class FetchServer {
+public:
+  static constexpr uint8_t MAGIC0 = 'W', MAGIC1 = 'F';
+  enum class Type   : uint8_t { SNAP = 1, META = 2, GET = 3, DATA = 4, AT = 5, EVENT = 6 };
+  enum class Status : uint8_t { OK = 0, PENDING = 1, FAILED = 2, GONE = 3 };
+
+  struct Blob {
+    uint32_t       id    = 0;
+    const uint8_t* data  = nullptr;
+    uint32_t       len   = 0;
+    uint16_t       w = 0, h = 0;
+    uint64_t       capUs = 0;
+  };
+  using Lookup = std::function<bool(uint32_t id, Blob& out)>;   // 無ければ false
+  using SnapFn = std::function<void()>;                        // 撮影を要求（完了は snapshotDone）
+  using FindFn = std::function<bool(Type t, uint32_t key, Blob& out)>;   // AT / EVENT（key は ts_us / event）
+
+  bool begin(uint16_t port = FETCH_UDP_PORT);
+  bool ready() const { return _sock >= 0; }
+  int  fd()    const { return _sock; }
+
+  void onLookup(Lookup f)   { _lookup = std::move(f); }
+  void onSnapshot(SnapFn f) { _snap = std::move(f); }
+  void onFind(FindFn f)     { _find = std::move(f); }
+
+  void service();                        // 届いている要求を全部処理する
+  void snapshotDone(const Blob* b);      // 撮影の結果（nullptr = 失敗）を要求元へ META で返す
+
+private:
+  int         _sock = -1;
+  Lookup      _lookup;
+  SnapFn      _snap;
+  FindFn      _find;
+
+  /* 直近の SNAP（冪等にするため req と結果の blob を覚える） */
+  uint32_t    _snapReq  = 0;
+  uint32_t    _snapBlob = 0;
+  bool        _snapBusy = false;
+  bool        _snapFail = false;
+  sockaddr_in _snapFrom{};
+
+  uint8_t     _tx[12 + FETCH_CHUNK];
+
+  void handle(const uint8_t* p, size_t n, const sockaddr_in& from);
+  void onSnap(uint32_t req, const sockaddr_in& from);
+  void onFindReq(Type t, uint32_t req, uint32_t key, const sockaddr_in& from);
+  void sendMeta(const sockaddr_in& to, uint32_t req, Status st, const Blob* b);
+  void sendChunks(const sockaddr_in& to, const Blob& b, uint32_t off, uint8_t count);
+  bool sendTo(const sockaddr_in& to, size_t n);
+};
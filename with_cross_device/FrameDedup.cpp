@@ -0,0 +1,77 @@
+#include "FrameDedup.h"
+#include "NetDebug.h"
+
+/*** スキャン範囲の特定（マーカ走査は SOS まで、EOI は末尾から探す） ******/
+static bool findScan(const uint8_t* b, size_t L, size_t& s, size_t& e){
+  if (!b || L < 4 || b[0] != 0xFF || b[1] != 0xD8) return false;
+  size_t i = 2;
+  while (i + 3 < L) {
+    if (b[i] != 0xFF) { i++; continue; }
+    uint8_t m = b[i+1];
+    if (m == 0xD8 || (m >= 0xD0 && m <= 0xD7) || m == 0x01 || m == 0xFF) { i += (m == 0xFF) ? 1 : 2; continue; }
+    size_t seg_end = i + 2 + ((size_t(b[i+2]) << 8) | b[i+3]);
+    if (seg_end > L) return false;
+    if (m == 0xDA /*SOS*/) {
+      s = seg_end;
+      // esp32-camera のバッファは末尾にパディングが付くことがある
+      size_t lim = (L > s + 64) ? L - 64 : s;
+      for (size_t p = L - 2; p >= lim && p > s; --p)
+        if (b[p] == 0xFF && b[p+1] == 0xD9) { e = p; return e > s; }
+      e = L; return e > s;
+    }
+    i = seg_end;
+  }
+  return false;
+}
+
+bool FrameDedup::extract(const uint8_t* jpg, size_t len, Features& f){
+  f.ok = false;
+  size_t s, e;
+  if (!findScan(jpg, len, s, e)) return false;
+  f.scan_len = e - s;
+
+  const size_t seg = f.scan_len / SEGMENTS;
+  for (size_t k = 0; k < SEGMENTS; ++k) {
+    // FNV-1a over SAMPLES bytes spread across the segment
+    uint32_t h = 2166136261u;
+    const uint8_t* p = jpg + s + k * seg;
+    const size_t step = (seg > SAMPLES) ? seg / SAMPLES : 1;
+    for (size_t j = 0; j < SAMPLES && j * step < seg; ++j) { h ^= p[j * step]; h *= 16777619u; }
+    f.sig[k] = h;
+  }
+  f.ok = true;
+  return true;
+}
+
+bool FrameDedup::nearDuplicate(const Features& a, const Features& b) const {
+  if (!a.ok || !b.ok) return false;
+
+  // スキャン長が大きく違えば変化あり
+  size_t d = (a.scan_len > b.scan_len) ? a.scan_len - b.scan_len : b.scan_len - a.scan_len;
+  if (d * 1000 > (size_t)_lenTolPermille * b.scan_len) return false;
+
+  // 長さが近くても中身の変化（信号の色・均一な背景に入った人など）は区間ハッシュに出る。
+  // 変化した区間より後ろは符号列がずれて一致しなくなるので、許すのは末尾の数区間まで
+  size_t diff = 0;
+  for (size_t k = 0; k < SEGMENTS; ++k) diff += (a.sig[k] != b.sig[k]);
+  return diff <= _maxDiffSegs;
+}
+
+bool FrameDedup::shouldSend(const uint8_t* jpg, size_t len, uint32_t now_ms){
+  Features f;
+  extract(jpg, len, f);
+
+  bool dup = nearDuplicate(f, _ref);
+  if (dup && (now_ms - _tRefSent) < _keepaliveMs) {
+    if (!_static) LOGD("DEDUP","static scene → suppress (scan=%u)", (unsigned)f.scan_len);
+    _static = true;
+    _suppressed++;
+    return false;
+  }
+
+  if (_static && !dup) LOGD("DEDUP","motion → resume (suppressed=%u)", (unsigned)_suppressed);
+  if (!dup) _static = false;
+  _ref = f;
+  _tRefSent = now_ms;
+  return true;
+}
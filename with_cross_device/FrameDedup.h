@@ -0,0 +1,53 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * FrameDedup : 静止シーン向けの JPEG 重複判定
+ *  - デコードせずに取れる特徴量だけを使う
+ *      * エントロピー符号化データ（SOS..EOI）の長さ
+ *      * スキャンを SEGMENTS 分割し、各区間から等間隔サンプルしたハッシュ
+ *  - 重複とみなすのは、スキャン長が許容差以内で、かつ区間ハッシュの不一致が
+ *    max_diff_segs 区間以下のときだけ（長さだけでは決めない。長さがほぼ同じでも
+ *    中身が変わった区間が多ければ送る）
+ *  - 比較対象は「最後に送ったフレーム」（微小変化の累積で取りこぼさない）
+ *  - 静止中でも keepalive_ms ごとに 1 枚は送る
+ *  ARDUINO 非依存（ホストでも使える）。
+ */
+class FrameDedup {
+public:
+  static constexpr size_t SEGMENTS = 16;
+  static constexpr size_t SAMPLES  = 16;   // 1 区間あたりのサンプル数
+
+  struct Features {
+    size_t   scan_len = 0;
+    uint32_t sig[SEGMENTS] = {0};
+    bool     ok = false;
+  };
+
+  void configure(uint32_t keepalive_ms, uint32_t len_tol_permille, uint8_t max_diff_segs){
+    _keepaliveMs = keepalive_ms; _lenTolPermille = len_tol_permille; _maxDiffSegs = max_diff_segs;
+  }
+
+  // true: 送出すべき（変化あり / keepalive / 初回）。送る場合は内部の参照を更新する。
+  bool shouldSend(const uint8_t* jpg, size_t len, uint32_t now_ms);
+
+  // 次のフレームを必ず送らせる（モード遷移直後など）
+  void reset() { _ref.ok = false; }
+
+  bool     isStatic()   const { return _static; }
+  uint32_t suppressed() const { return _suppressed; }
+
+  static bool extract(const uint8_t* jpg, size_t len, Features& f);
+
+private:
+  bool nearDuplicate(const Features& a, const Features& b) const;
+
+  Features _ref;
+  uint32_t _tRefSent = 0;
+  uint32_t _keepaliveMs = 1000;
+  uint32_t _lenTolPermille = 6;
+  uint8_t  _maxDiffSegs = 1;
+  uint32_t _suppressed = 0;
+  bool     _static = false;
+};
@@ -0,0 +1,143 @@
+#include "FrameHistory.h"
+#include "NetDebug.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+
+bool FrameHistory::begin(size_t bytes)
+{
+    if (_buf || !bytes) return _buf != nullptr;
+    _buf = (uint8_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!_buf) { LOGW("HIST","ring %u B alloc failed (history off)", (unsigned)bytes); return false; }
+    _cap = bytes;
+    LOGI("HIST","ring %u KB, %u ms, %u frames", (unsigned)(bytes / 1024), (unsigned)HISTORY_MS,
+         (unsigned)HISTORY_FRAMES);
+    return true;
+}
+
+int64_t FrameHistory::widenUs(uint32_t us32)
+{
+    int64_t now = esp_timer_get_time();
+    return now - (int64_t)(uint32_t)((uint32_t)now - us32);
+}
+
+/* ===== 書き込み（netcamTask） ===== */
+void FrameHistory::service()
+{
+    FrameRef f;
+    while (take(f)) {
+        push(f);
+        f.reset();
+    }
+}
+
+void FrameHistory::popOldest()
+{
+    _head = (_head + 1) % HISTORY_FRAMES;
+    _n--;
+}
+
+/* 書き込み位置の先にあるのが最も古いフレーム。末尾に収まらなければ先頭へ折り返し、
+ * 末尾側（より古い）を全部捨ててから重なる分を捨てる */
+void FrameHistory::push(const FrameRef& f)
+{
+    TRACE_SCOPE("hist.push");
+    size_t len = f.len();
+    if (!len || len > _cap) return;
+    int64_t now = esp_timer_get_time();
+    while (_n && (_n == HISTORY_FRAMES || now - (int64_t)at(0).capUs > HISTORY_MS * 1000LL)) popOldest();
+    if (_wr + len > _cap) {
+        while (_n && at(0).off >= _wr) popOldest();
+        _wr = 0;
+    }
+    while (_n && at(0).off >= _wr && at(0).off < _wr + len) popOldest();
+
+    memcpy(_buf + _wr, f.data(), len);
+    Entry& e = _ent[(_head + _n) % HISTORY_FRAMES];
+    e.seq   = f.seq();
+    e.off   = (uint32_t)_wr;
+    e.len   = (uint32_t)len;
+    e.w     = f.width();
+    e.h     = f.height();
+    e.capUs = f.capUs();
+    _n++;
+    _wr += len;
+    Metrics::set(Metrics::HISTORY_SPAN_MS, (uint32_t)((e.capUs - at(0).capUs) / 1000));
+}
+
+/* ===== ボタンイベント（uiTask） ===== */
+void FrameHistory::noteEvent(uint16_t id, int64_t atUs)
+{
+    portENTER_CRITICAL(&_evMux);
+    _ev[_evNext] = Event{id, atUs};
+    _evNext = (_evNext + 1) % HISTORY_EVENTS;
+    portEXIT_CRITICAL(&_evMux);
+}
+
+/* ===== 読み出し（netcamTask） ===== */
+bool FrameHistory::findAt(int64_t atUs, FetchServer::Blob& out)
+{
+    int i = (int)_n - 1;
+    while (i >= 0 && (int64_t)at((uint16_t)i).capUs > atUs) --i;
+    if (i < 0 || !pin(at((uint16_t)i))) {
+        Metrics::inc(Metrics::HISTORY_MISSES);
+        LOGW("HIST","no frame at %lld us (%u kept)", (long long)atUs, (unsigned)_n);
+        return false;
+    }
+    Metrics::observe(Metrics::HISTORY_LAG_US, (uint32_t)(atUs - (int64_t)_pinEnt.capUs));
+    toBlob(_pinEnt, _pin, out);
+    return true;
+}
+
+bool FrameHistory::findEvent(uint16_t id, FetchServer::Blob& out)
+{
+    int64_t atUs = 0;
+    portENTER_CRITICAL(&_evMux);
+    for (const Event& e : _ev) if (e.atUs && e.id == id) { atUs = e.atUs; break; }
+    portEXIT_CRITICAL(&_evMux);
+    if (!atUs) {
+        Metrics::inc(Metrics::HISTORY_MISSES);
+        LOGW("HIST","unknown event %u", (unsigned)id);
+        return false;
+    }
+    return findAt(atUs, out);
+}
+
+bool FrameHistory::lookup(uint32_t id, FetchServer::Blob& out) const
+{
+    if (_pinned && _pinEnt.seq == id) { toBlob(_pinEnt, _pin, out); return true; }
+    for (uint16_t i = 0; i < _n; ++i) {
+        const Entry& e = at(i);
+        if (e.seq == id) { toBlob(e, _buf + e.off, out); return true; }
+    }
+    return false;
+}
+
+/* 取り出し中にリングから押し出されないよう写しておく（同じフレームなら写し直さない） */
+bool FrameHistory::pin(const Entry& e)
+{
+    if (_pinned && _pinEnt.seq == e.seq) return true;
+    if (e.len > _pinCap) {
+        heap_caps_free(_pin);
+        size_t cap = (e.len + 0x3FFF) & ~(size_t)0x3FFF;         // 16 KB 単位で伸ばす
+        _pin    = (uint8_t*)heap_caps_malloc(cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        _pinCap = _pin ? cap : 0;
+        _pinned = false;
+        if (!_pin) return false;
+    }
+    memcpy(_pin, _buf + e.off, e.len);
+    _pinEnt = e;
+    _pinned = true;
+    return true;
+}
+
+void FrameHistory::toBlob(const Entry& e, const uint8_t* data, FetchServer::Blob& out)
+{
+    out.id    = e.seq;
+    out.data  = data;
+    out.len   = e.len;
+    out.w     = e.w;
+    out.h     = e.h;
+    out.capUs = e.capUs;
+}
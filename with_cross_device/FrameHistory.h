@@ -0,0 +1,61 @@
+#pragma once
+#include <Arduino.h>
+#include "FrameSource.h"
+#include "FetchServer.h"
+#include "config.h"
+
+/**
+ * FrameHistory : 配ったフレームの直近 HISTORY_MS を PSRAM のリングに写して残す sink
+ *  - JPEG は HISTORY_BYTES のバイトリングに詰めて置き、索引（HISTORY_FRAMES 個）を撮像時刻順に
+ *    持つ。容量・索引・時間のどれかを超えたら古い順に捨てる
+ *  - fb は service()（netcamTask）で写したらすぐ返す。ストリームの sink と同じ 1 回の撮像を使う
+ *  - 探すのは「指定時刻以前で最も新しいフレーム」（押した瞬間に見えていたもの）。時刻は
+ *    直接（AT）か、noteEvent() で覚えたボタンイベントの押下時刻（EVENT）で与える
+ *  - 見つけたフレームは固定バッファへ写す（pin）。リングから押し出されても取り出しを続けられる
+ * noteEvent() 以外は netcamTask 専用（リングへの書き込みと FetchServer の読み出しが同じタスク）。
+ */
+class FrameHistory : public FrameSink {
+public:
+  FrameHistory() : FrameSink(2, Drop::OLDEST) {}
+
+  bool begin(size_t bytes = HISTORY_BYTES);
+  bool wants() override { return _buf != nullptr; }
+  void service() override;
+
+  void noteEvent(uint16_t id, int64_t atUs);                 // どのタスクからでも
+  bool findAt(int64_t atUs, FetchServer::Blob& out);         // 見つかれば pin して out へ
+  bool findEvent(uint16_t id, FetchServer::Blob& out);
+  bool lookup(uint32_t id, FetchServer::Blob& out) const;    // pin 済みか、まだリングにあるフレーム
+
+  /* FetchServer / BUTTON の 32 bit 時刻（esp_timer の下位）を今から遡って 64 bit に戻す */
+  static int64_t widenUs(uint32_t us32);
+
+private:
+  struct Entry {
+    uint32_t seq;                        // FrameRef::seq（= FetchServer の blob id）
+    uint32_t off, len;
+    uint16_t w, h;
+    uint64_t capUs;
+  };
+  struct Event { uint16_t id; int64_t atUs; };
+
+  uint8_t* _buf = nullptr;
+  size_t   _cap = 0, _wr = 0;
+  Entry    _ent[HISTORY_FRAMES];
+  uint16_t _head = 0, _n = 0;            // _ent[_head] が最も古い
+
+  Event        _ev[HISTORY_EVENTS] = {};
+  uint8_t      _evNext = 0;
+  portMUX_TYPE _evMux = portMUX_INITIALIZER_UNLOCKED;
+
+  uint8_t* _pin = nullptr;               // findAt / findEvent が選んだフレームの写し
+  size_t   _pinCap = 0;
+  Entry    _pinEnt{};
+  bool     _pinned = false;
+
+  const Entry& at(uint16_t i) const { return _ent[(_head + i) % HISTORY_FRAMES]; }
+  void push(const FrameRef& f);
+  void popOldest();
+  bool pin(const Entry& e);
+  static void toBlob(const Entry& e, const uint8_t* data, FetchServer::Blob& out);
+};
@@ -0,0 +1,154 @@
+#include "FrameSource.h"
+#include "NetDebug.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include <esp_timer.h>
+
+/* ===== FrameRef ===== */
+void FrameRef::reset()
+{
+    Frame* f = _f;
+    if (!f) return;
+    _f = nullptr;
+    if (f->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+    esp_camera_fb_return(f->fb);         // 最後の参照
+    f->fb = nullptr;
+    f->inUse.store(false, std::memory_order_release);
+}
+
+/* ===== FrameSink ===== */
+void FrameSink::offer(FrameRef&& f)
+{
+    Frame* victim = nullptr;
+    portENTER_CRITICAL(&_mux);
+    if (_cnt == _depth) {
+        if (_drop == Drop::NEWEST) {
+            portEXIT_CRITICAL(&_mux);
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            f.reset();
+            return;
+        }
+        victim = _q[_head];
+        _head = (_head + 1) % _depth;
+        _cnt--;
+    }
+    _q[(_head + _cnt) % _depth] = f._f;
+    _cnt++;
+    f._f = nullptr;                      // 参照はキューへ移った
+    portEXIT_CRITICAL(&_mux);
+
+    if (victim) {                        // fb 返却はクリティカルセクションの外で
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        FrameRef(victim).reset();
+    }
+}
+
+bool FrameSink::take(FrameRef& out)
+{
+    Frame* f = nullptr;
+    portENTER_CRITICAL(&_mux);
+    if (_cnt) {
+        f = _q[_head];
+        _head = (_head + 1) % _depth;
+        _cnt--;
+    }
+    portEXIT_CRITICAL(&_mux);
+    if (!f) return false;
+    out = FrameRef(f);
+    return true;
+}
+
+/* ===== FrameSource ===== */
+/* 撮像時刻: esp32-camera は VSYNC 受信時の esp_timer 値を fb->timestamp に入れる */
+static uint64_t fbTimeUs(const camera_fb_t* fb)
+{
+    return (uint64_t)fb->timestamp.tv_sec * 1000000ull + (uint64_t)fb->timestamp.tv_usec;
+}
+
+bool FrameSource::addSink(FrameSink* s)
+{
+    if (!s || _nSinks >= kMaxSinks) return false;
+    _sinks[_nSinks++] = s;
+    return true;
+}
+
+uint32_t FrameSource::wanting()
+{
+    uint32_t m = 0;
+    for (uint8_t i = 0; i < _nSinks; ++i)
+        if (_sinks[i]->wants()) m |= 1u << i;
+    return m;
+}
+
+FrameRef FrameSource::grab(int64_t notBeforeUs)
+{
+    Frame* slot = nullptr;
+    for (Frame& f : _slots) {
+        bool expect = false;
+        if (f.inUse.compare_exchange_strong(expect, true, std::memory_order_acquire)) { slot = &f; break; }
+    }
+    if (!slot) {                         // 全 fb を sink が握っている
+        LOGD("CAM","no free frame slot");
+        return FrameRef();
+    }
+
+    uint64_t t0 = esp_timer_get_time();
+    TRACE_BEGIN("fb_get");
+    camera_fb_t* fb = esp_camera_fb_get();
+    /* 鮮度指定: ドライバに溜まっていた古い fb（設定変更前・モード進入前）は返して撮り直す。
+     * 溜まりうるのはドライバの fb の枚数分なので、撮り直しもその回数まで */
+    for (uint8_t i = 0; fb && (_freshUs || notBeforeUs) && i < _fbCount; ++i) {
+        uint64_t cap = fbTimeUs(fb);
+        if (!cap) break;
+        bool stale = (int64_t)cap < notBeforeUs ||
+                     (_freshUs && (uint64_t)esp_timer_get_time() - cap > _freshUs);
+        if (!stale) break;
+        esp_camera_fb_return(fb);
+        Metrics::inc(Metrics::CAM_STALE_DROPS);
+        fb = esp_camera_fb_get();
+    }
+    TRACE_END("fb_get");
+    if (!fb) {
+        LOGW("CAM","fb null");
+        slot->inUse.store(false, std::memory_order_release);
+        return FrameRef();
+    }
+    Metrics::observe(Metrics::CAPTURE_US, (uint32_t)(esp_timer_get_time() - t0));
+    Metrics::observe(Metrics::FRAME_BYTES, (uint32_t)fb->len);
+
+    uint64_t us = fbTimeUs(fb);
+    slot->fb    = fb;
+    slot->capUs = us ? us : (uint64_t)esp_timer_get_time();
+    slot->seq   = ++_seq;
+    slot->refs.store(1, std::memory_order_relaxed);
+    return FrameRef(slot);
+}
+
+size_t FrameSource::publish(FrameRef&& f, uint32_t mask)
+{
+    if (!f) return 0;
+    size_t n = 0;
+    for (uint8_t i = 0; i < _nSinks; ++i) if (mask & (1u << i)) n++;
+    if (!n) { f.reset(); return 0; }
+
+    /* sink ごとに 1 参照。最後の sink には f 自体を渡す */
+    f._f->refs.fetch_add((uint8_t)(n - 1), std::memory_order_relaxed);
+    size_t left = n;
+    for (uint8_t i = 0; i < _nSinks; ++i) {
+        if (!(mask & (1u << i))) continue;
+        if (--left) _sinks[i]->offer(FrameRef(f._f));
+        else        _sinks[i]->offer(std::move(f));
+    }
+    return n;
+}
+
+void FrameSource::notifyCaptured(uint32_t mask)
+{
+    for (uint8_t i = 0; i < _nSinks; ++i)
+        if (mask & (1u << i)) _sinks[i]->onCaptured();
+}
+
+void FrameSource::service()
+{
+    for (uint8_t i = 0; i < _nSinks; ++i) _sinks[i]->service();
+}
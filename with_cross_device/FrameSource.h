@@ -0,0 +1,109 @@
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+#include <utility>
+#include "esp_camera.h"
+#include "config.h"
+
+/**
+ * FrameSource : 1 回の撮像を複数の送出先（FrameSink）へ無コピーで配る
+ *  - esp_camera_fb_get() の fb を参照カウント付きの Frame に包み、sink ごとに
+ *    move-only の FrameRef を 1 つずつ渡す。最後の FrameRef が手放された時点で
+ *    fb をドライバへ返す（RTP + WS、送出 + 記録でも撮像は 1 回）
+ *  - sink はそれぞれ深さと満杯時の捨て方（Drop）を持つキュー
+ *  - 受け取れる sink が 1 つも無い周期は撮像しない
+ * fb を長く握るとドライバの空きが無くなるので、sink の深さは小さく保つこと。
+ */
+struct Frame {                           // FrameSource のプール要素（直接は触らない）
+    camera_fb_t*          fb    = nullptr;
+    uint64_t              capUs = 0;     // 撮像時刻（VSYNC）
+    uint32_t              seq   = 0;
+    std::atomic<uint8_t>  refs{0};
+    std::atomic<bool>     inUse{false};
+};
+
+class FrameRef {
+public:
+    FrameRef() = default;
+    FrameRef(FrameRef&& o) noexcept : _f(o._f) { o._f = nullptr; }
+    FrameRef& operator=(FrameRef&& o) noexcept {
+        if (this != &o) { reset(); _f = o._f; o._f = nullptr; }
+        return *this;
+    }
+    FrameRef(const FrameRef&) = delete;
+    FrameRef& operator=(const FrameRef&) = delete;
+    ~FrameRef() { reset(); }
+
+    explicit operator bool() const { return _f != nullptr; }
+    const uint8_t* data()   const { return _f->fb->buf; }
+    size_t         len()    const { return _f->fb->len; }
+    uint16_t       width()  const { return (uint16_t)_f->fb->width; }
+    uint16_t       height() const { return (uint16_t)_f->fb->height; }
+    uint64_t       capUs()  const { return _f->capUs; }
+    uint32_t       seq()    const { return _f->seq; }
+
+    void reset();                        // 参照を手放す（最後の 1 つなら fb を返却）
+
+private:
+    friend class FrameSource;
+    friend class FrameSink;
+    explicit FrameRef(Frame* f) : _f(f) {}
+    Frame* _f = nullptr;
+};
+
+class FrameSink {
+public:
+    enum class Drop : uint8_t {
+        NEWEST,                          // 満杯なら届いたフレームを捨てる
+        OLDEST,                          // 満杯なら一番古いものを捨てて積む（低遅延向け）
+    };
+    static constexpr uint8_t kMaxDepth = 4;
+
+    FrameSink(uint8_t depth, Drop drop)
+        : _depth(depth < 1 ? 1 : depth > kMaxDepth ? kMaxDepth : depth), _drop(drop) {}
+    virtual ~FrameSink() { FrameRef f; while (take(f)) f.reset(); }
+
+    /* 撮像の直前に問い合わせる。false ならこの周期のフレームは渡さない */
+    virtual bool wants() { return true; }
+    /* 撮像した（重複で捨てたフレームも含む） */
+    virtual void onCaptured() {}
+    /* netcamTask から毎回呼ぶ。自前のタスクで take() する sink は不要 */
+    virtual void service() {}
+
+    bool     take(FrameRef& out);        // 消費側（どのタスクからでも可）
+    uint32_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+private:
+    friend class FrameSource;
+    void offer(FrameRef&& f);
+
+    Frame*       _q[kMaxDepth] = {};
+    uint8_t      _depth, _head = 0, _cnt = 0;
+    Drop         _drop;
+    std::atomic<uint32_t> _dropped{0};
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+class FrameSource {
+public:
+    static constexpr uint8_t kMaxSinks = 4;
+
+    bool     addSink(FrameSink* s);
+    uint32_t wanting();                  // wants() が true の sink のビットマスク
+    /* esp_camera_fb_get() して包む（失敗・プール切れは空）。notBeforeUs より前に
+     * 撮られた fb（と setFreshUs の鮮度を外れたもの）は返して撮り直す */
+    FrameRef grab(int64_t notBeforeUs = 0);
+    void     setFreshUs(uint32_t us) { _freshUs = us; }   // 0 以外: これより古い fb は捨てて撮り直す
+    void     setFbCount(size_t n) { _fbCount = n ? (uint8_t)n : 1; }   // ドライバの fb 数（撮り直しの上限）
+    size_t   publish(FrameRef&& f, uint32_t mask);   // mask の sink へ配る。配った数
+    void     notifyCaptured(uint32_t mask);
+    void     service();                  // 各 sink の service()
+
+private:
+    Frame      _slots[FRAME_SLOTS];
+    FrameSink* _sinks[kMaxSinks] = {};
+    uint8_t    _nSinks = 0;
+    uint32_t   _seq = 0;
+    uint32_t   _freshUs = 0;
+    uint8_t    _fbCount = 1;
+};
@@ -18,4 +18,13 @@ inline void initHardware() {
     pinMode(BTN_BACK, INPUT_PULLDOWN);
     pinMode(BTN_OK , INPUT_PULLDOWN);
 }
-inline bool btn(uint8_t p) { return digitalRead(p)==HIGH; }
\ No newline at end of file
+inline bool btn(uint8_t p) { return digitalRead(p)==HIGH; }
+
+/* 制御チャネル（WS /control・UDP）共通のモータ ON/OFF。変化したら true */
+inline bool setMotor(bool on) {
+    static bool state = false;
+    if (state == on) return false;
+    state = on;
+    digitalWrite(PIN_MOTOR, on ? HIGH : LOW);
+    return true;
+}
\ No newline at end of file
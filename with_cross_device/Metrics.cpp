@@ -0,0 +1,79 @@
+#include "Metrics.h"
+#if defined(ARDUINO)
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#else
+#include <time.h>
+#endif
+
+namespace Metrics {
+
+std::atomic<uint32_t> gScalar[FIRST_HIST];
+Hist                  gHist[HIST_CNT];
+
+int64_t nowUs(){
+#if defined(ARDUINO)
+  return esp_timer_get_time();
+#else
+  timespec t; clock_gettime(CLOCK_MONOTONIC, &t);
+  return (int64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+#endif
+}
+
+void sampleSystem(){
+#if defined(ARDUINO)
+  set(HEAP_FREE,     (uint32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+  set(HEAP_MIN_FREE, (uint32_t)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+  set(PSRAM_FREE,    (uint32_t)heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+#endif
+}
+
+/* ---- export ---------------------------------------------------------
+ * ver(1)=1 | n(1) | uptime_ms(4) | entries...
+ *   entry: id(1) kind(1) +
+ *     COUNTER/GAUGE: value(4)
+ *     HIST         : count(4) sum(4) max(4) mask(4) + 非ゼロバケットの値(4)×popcount(mask)
+ * max だけは前回 encode 以降の最大値（読み出しでリセット）。
+ */
+static inline uint8_t* put32(uint8_t* p, uint32_t v){
+  p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+  return p + 4;
+}
+
+size_t encode(uint8_t* out, size_t cap){
+  if (cap < 6) return 0;
+  uint8_t* p = out; uint8_t* end = out + cap;
+  *p++ = 1;
+  uint8_t* nPos = p++;
+  p = put32(p, (uint32_t)(nowUs() / 1000));
+  uint8_t n = 0;
+
+  for (uint8_t id = 0; id < COUNT; ++id) {
+    Kind k = kindOf(id);
+    if (k != Kind::HIST) {
+      if (p + 6 > end) break;
+      *p++ = id; *p++ = (uint8_t)k;
+      p = put32(p, gScalar[id].load(std::memory_order_relaxed));
+    } else {
+      Hist& h = gHist[id - FIRST_HIST];
+      uint32_t vals[BUCKETS], mask = 0; uint8_t nb = 0;
+      for (uint8_t i = 0; i < BUCKETS; ++i) {
+        vals[nb] = h.b[i].load(std::memory_order_relaxed);
+        if (vals[nb]) { mask |= 1u << i; nb++; }
+      }
+      if (p + 18 + 4 * nb > end) break;
+      *p++ = id; *p++ = (uint8_t)k;
+      p = put32(p, h.count.load(std::memory_order_relaxed));
+      p = put32(p, h.sum.load(std::memory_order_relaxed));
+      p = put32(p, h.max.exchange(0, std::memory_order_relaxed));
+      p = put32(p, mask);
+      for (uint8_t i = 0; i < nb; ++i) p = put32(p, vals[i]);
+    }
+    n++;
+  }
+  *nPos = n;
+  return (size_t)(p - out);
+}
+
+} // namespace Metrics
@@ -0,0 +1,72 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * Metrics : 固定メモリのメトリクスレジストリ
+ *  - counter / gauge / histogram（2 のべき乗バケット）
+ *  - 更新は std::atomic の relaxed 操作のみ（どのタスクからでも可、ロック無し）
+ *  - encode() で RTCP APP ("WXMT") のアプリデータ部を作る（UdpAgent が送出）
+ * ID を追加したら src/metrics_monitor/metrics_monitor.py の NAMES も揃えること。
+ */
+namespace Metrics {
+
+enum Id : uint8_t {
+  /* counters */
+  RTP_PKTS, RTP_DROPS, RTP_FRAMES,
+  WS_FRAMES, WS_DROPS, WS_RECONNECTS, WIFI_DISCONNECTS, CTRL_CMDS, CTRL_RETX,
+  WS_STALLS, PKT_POOL_FAILS, STREAM_SWITCHES, CAM_STALE_DROPS, FETCH_CHUNKS, HISTORY_MISSES,
+  /* gauges */
+  WS_Q_DEPTH, WS_INFLIGHT, HEAP_FREE, HEAP_MIN_FREE, PSRAM_FREE, PKT_POOL_HWM,
+  STREAM_ACTIVE, STREAM_LOSS_PERMILLE, HISTORY_SPAN_MS,
+  /* histograms */
+  CAPTURE_US, PACKETIZE_US, SEND_US, FRAME_BYTES,
+  BTN_TO_ACTION_US, CMD_TO_WIRE_US, FRAME_TO_WIRE_US, CTRL_TO_MOTOR_US, CTRL_RTT_US,
+  WS_RECONNECT_MS, CAM_SWITCH_US, MODE_FIRST_FRAME_US, SNAP_US, SNAP_GAP_US,
+  HISTORY_LAG_US,
+  COUNT
+};
+constexpr uint8_t FIRST_GAUGE = WS_Q_DEPTH;
+constexpr uint8_t FIRST_HIST  = CAPTURE_US;
+constexpr uint8_t HIST_CNT    = COUNT - FIRST_HIST;
+constexpr uint8_t BUCKETS     = 24;    // b[k]: 2^(k-1) <= v < 2^k（b[0] は v=0, 末尾は上限超え）
+
+enum class Kind : uint8_t { COUNTER = 0, GAUGE = 1, HIST = 2 };
+inline Kind kindOf(uint8_t id){
+  return id >= FIRST_HIST ? Kind::HIST : id >= FIRST_GAUGE ? Kind::GAUGE : Kind::COUNTER;
+}
+
+struct Hist {
+  std::atomic<uint32_t> count, sum, max;
+  std::atomic<uint32_t> b[BUCKETS];
+};
+extern std::atomic<uint32_t> gScalar[FIRST_HIST];
+extern Hist                  gHist[HIST_CNT];
+
+inline void inc(Id id, uint32_t n = 1){ gScalar[id].fetch_add(n, std::memory_order_relaxed); }
+inline void set(Id id, uint32_t v)    { gScalar[id].store(v, std::memory_order_relaxed); }
+
+inline void observe(Id id, uint32_t v){
+  Hist& h = gHist[id - FIRST_HIST];
+  uint32_t k = v ? 32 - __builtin_clz(v) : 0;
+  if (k >= BUCKETS) k = BUCKETS - 1;
+  h.b[k].fetch_add(1, std::memory_order_relaxed);
+  h.count.fetch_add(1, std::memory_order_relaxed);
+  h.sum.fetch_add(v, std::memory_order_relaxed);      // 折り返しは受信側で差分を取る
+  uint32_t m = h.max.load(std::memory_order_relaxed);
+  while (v > m && !h.max.compare_exchange_weak(m, v, std::memory_order_relaxed)) {}
+}
+
+// ヒストグラム用のスコープ計測（esp_timer µs）
+int64_t nowUs();
+struct ScopedUs {
+  Id id; int64_t t0;
+  explicit ScopedUs(Id i) : id(i), t0(nowUs()) {}
+  ~ScopedUs(){ observe(id, (uint32_t)(nowUs() - t0)); }
+};
+
+void   sampleSystem();                         // heap / PSRAM の gauge 更新
+size_t encode(uint8_t* out, size_t cap);       // 値は累積（差分は受信側）。big-endian
+
+} // namespace Metrics
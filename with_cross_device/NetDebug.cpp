@@ -0,0 +1,236 @@
+#include "NetDebug.h"
+#if defined(ARDUINO)
+#include <string.h>
+
+namespace NetDebug {
+
+/* ===== per-core リング（有界 MPMC, Vyukov 方式）=========================
+ * 同一コア上のタスク間で横取りが起きても壊れないよう、スロットごとの
+ * シーケンス番号で予約→書込→公開を行う。読み手は drain タスクのみ。
+ * seq はスロット番号を引いた相対値で持つ（ゼロ初期化のままで使えるので
+ * 他 TU の静的初期化中に LOG されても初期化順に依存しない）。 */
+static_assert((LOG_RING_SLOTS & (LOG_RING_SLOTS - 1)) == 0, "LOG_RING_SLOTS must be power of 2");
+static constexpr uint32_t kMask = LOG_RING_SLOTS - 1;
+
+struct Ring {
+  Record                slots[LOG_RING_SLOTS];
+  std::atomic<uint32_t> head;
+  uint32_t              tail;
+  std::atomic<uint32_t> dropped;
+};
+static Ring gRing[2];          // 静的領域のゼロ初期化のみ
+
+static inline uint32_t seqOf(const Record& r, uint32_t pos, std::memory_order mo){
+  return r.seq.load(mo) + (pos & kMask);
+}
+static inline void setSeq(Record& r, uint32_t pos, uint32_t v){
+  r.seq.store(v - (pos & kMask), std::memory_order_release);
+}
+
+Record* acquire(uint32_t& pos){
+  Ring& rg = gRing[xPortGetCoreID() & 1];
+  pos = rg.head.load(std::memory_order_relaxed);
+  for (;;) {
+    Record& r = rg.slots[pos & kMask];
+    int32_t dif = (int32_t)(seqOf(r, pos, std::memory_order_acquire) - pos);
+    if (dif == 0) {
+      if (rg.head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) return &r;
+    } else if (dif < 0) {
+      rg.dropped.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;                      // 満杯
+    } else {
+      pos = rg.head.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void publish(Record* r, uint32_t pos){
+  setSeq(*r, pos, pos + 1);
+}
+
+static const Record* peek(Ring& rg){
+  const Record& r = rg.slots[rg.tail & kMask];
+  return (seqOf(r, rg.tail, std::memory_order_acquire) == rg.tail + 1) ? &r : nullptr;
+}
+
+static void pop(Ring& rg){
+  setSeq(rg.slots[rg.tail & kMask], rg.tail, rg.tail + LOG_RING_SLOTS);
+  rg.tail++;
+}
+
+#if !LOG_OUTPUT_BINARY
+/* ===== 遅延整形 ==========================================================
+ * va_list は組み立てられないので、fmt を変換指定子ごとに切り出して
+ * 1 引数ずつ snprintf に渡す。幅/精度/フラグはそのまま活かす。 */
+struct ArgReader {
+  const uint8_t* p; const uint8_t* end; bool miss = false;
+  template<class T> T get(){
+    T v{};
+    if (p + sizeof(T) > end) { miss = true; return v; }
+    memcpy(&v, p, sizeof(T)); p += sizeof(T); return v;
+  }
+  void str(char* out, size_t cap){
+    if (p >= end) { miss = true; out[0] = 0; return; }
+    size_t n = *p++; if (n > size_t(end - p)) n = size_t(end - p);
+    if (n >= cap) n = cap - 1;
+    memcpy(out, p, n); out[n] = 0; p += n;
+  }
+};
+
+static size_t formatRecord(const Record& r, char* out, size_t cap){
+  ArgReader rd{r.args, r.args + r.argLen};
+  size_t o = 0;
+  const char* f = r.fmt;
+  while (*f && o + 1 < cap) {
+    if (*f != '%') { out[o++] = *f++; continue; }
+    if (f[1] == '%') { out[o++] = '%'; f += 2; continue; }
+
+    char spec[16]; size_t sn = 0;
+    spec[sn++] = *f++;
+    while (*f && strchr("-+ #0123456789.", *f) && sn < 10) spec[sn++] = *f++;
+    int lng = 0;
+    while (*f && strchr("hlzjt", *f)) { lng += (*f == 'l') ? 1 : (*f == 'j') ? 2 : 0; f++; }
+    char conv = *f;
+    if (!conv) break;
+    f++;
+
+    size_t room = cap - o;
+    int n = 0;
+    switch (conv) {
+      case 's': {
+        char s[128]; rd.str(s, sizeof(s));
+        spec[sn++] = 's'; spec[sn] = 0;
+        n = snprintf(out + o, room, spec, s);
+      } break;
+      case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+        spec[sn++] = conv; spec[sn] = 0;
+        n = snprintf(out + o, room, spec, rd.get<double>());
+        break;
+      case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+        if (lng >= 2) {
+          spec[sn++] = 'l'; spec[sn++] = 'l'; spec[sn++] = conv; spec[sn] = 0;
+          n = snprintf(out + o, room, spec, (unsigned long long)rd.get<uint64_t>());
+        } else {
+          spec[sn++] = conv; spec[sn] = 0;
+          n = snprintf(out + o, room, spec, (unsigned)rd.get<uint32_t>());
+        }
+        break;
+      case 'p':
+        n = snprintf(out + o, room, "0x%08x", (unsigned)rd.get<uint32_t>());
+        break;
+      default:
+        n = snprintf(out + o, room, "%%%c", conv);
+        break;
+    }
+    if (n > 0) o += ((size_t)n < room) ? (size_t)n : room - 1;
+  }
+  if ((r.flags & REC_TRUNCATED) || rd.miss) {
+    const char* t = " <trunc>";
+    while (*t && o + 1 < cap) out[o++] = *t++;
+  }
+  out[o] = 0;
+  return o;
+}
+
+static void emit(const Record& r, size_t heapFree){
+  char msg[256];
+  formatRecord(r, msg, sizeof(msg));
+  Serial.printf("[%llu us][%s][%s][heap:%u][core:%d] %s\n",
+                (unsigned long long)r.ts_us, lvlStr((Level)r.level), r.tag,
+                (unsigned)heapFree, r.core, msg);
+}
+
+static void emitDropped(int core, uint32_t n, size_t heapFree){
+  Serial.printf("[%llu us][W][NetDebug][heap:%u][core:%d] dropped %u records\n",
+                (unsigned long long)esp_timer_get_time(), (unsigned)heapFree,
+                core, (unsigned)n);
+}
+#else
+/* ===== バイナリ出力 ======================================================
+ * frame: A5 5A | type(1) | len(1) | payload(len)
+ *   0x01 STR   : id(u16) + 文字列（tag / fmt の辞書。初出時と定期再送）
+ *   0x02 REC   : ts_us(u64) level(1) core(1) tag_id(u16) fmt_id(u16) flags(1) + args
+ *   0x03 DROP  : core(1) count(u32)
+ * 数値はすべて little-endian。引数の詰め方は NetDebug.h の Record と同じ。 */
+static constexpr size_t   kDictSize = 256;
+static constexpr uint32_t kDictResendMs = 10000;
+static const char* gDict[kDictSize];
+static uint16_t    gDictCnt = 0;
+
+static void writeFrame(uint8_t type, const uint8_t* p, size_t n){
+  uint8_t h[4] = { 0xA5, 0x5A, type, (uint8_t)n };
+  Serial.write(h, 4); Serial.write(p, n);
+}
+
+static void sendStr(uint16_t id){
+  uint8_t b[255];
+  size_t n = strnlen(gDict[id], sizeof(b) - 2);
+  b[0] = (uint8_t)id; b[1] = (uint8_t)(id >> 8);
+  memcpy(b + 2, gDict[id], n);
+  writeFrame(0x01, b, n + 2);
+}
+
+static uint16_t intern(const char* s){
+  for (uint16_t i = 0; i < gDictCnt; ++i) if (gDict[i] == s) return i;
+  if (gDictCnt >= kDictSize) return 0xFFFF;
+  gDict[gDictCnt] = s;
+  sendStr(gDictCnt);
+  return gDictCnt++;
+}
+
+static void emit(const Record& r, size_t){
+  uint16_t tid = intern(r.tag), fid = intern(r.fmt);
+  uint8_t b[15 + REC_ARG_BYTES];
+  memcpy(b, &r.ts_us, 8);
+  b[8] = r.level; b[9] = r.core;
+  memcpy(b + 10, &tid, 2); memcpy(b + 12, &fid, 2);
+  b[14] = r.flags;
+  memcpy(b + 15, r.args, r.argLen);
+  writeFrame(0x02, b, 15 + r.argLen);
+}
+
+static void emitDropped(int core, uint32_t n, size_t){
+  uint8_t b[5] = { (uint8_t)core };
+  memcpy(b + 1, &n, 4);
+  writeFrame(0x03, b, 5);
+}
+#endif
+
+/* ===== drain タスク ======================================================
+ * 2 本のリングを時刻順にマージして出力する。heap 残量はバッチごとに 1 回。 */
+static void drainTask(void*){
+#if LOG_OUTPUT_BINARY
+  uint32_t tDict = millis();
+#endif
+  for (;;) {
+    size_t hf = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    for (;;) {
+      const Record* a = peek(gRing[0]);
+      const Record* b = peek(gRing[1]);
+      if (!a && !b) break;
+      int k = (!b || (a && a->ts_us <= b->ts_us)) ? 0 : 1;
+      emit(k ? *b : *a, hf);
+      pop(gRing[k]);
+    }
+    for (int k = 0; k < 2; ++k) {
+      uint32_t d = gRing[k].dropped.exchange(0, std::memory_order_relaxed);
+      if (d) emitDropped(k, d, hf);
+    }
+#if LOG_OUTPUT_BINARY
+    if (millis() - tDict >= kDictResendMs) {   // 途中から接続したデコーダ向け
+      for (uint16_t i = 0; i < gDictCnt; ++i) sendStr(i);
+      tDict = millis();
+    }
+#endif
+    vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_MS));
+  }
+}
+
+void begin(){
+  static TaskHandle_t h = nullptr;
+  if (h) return;
+  xTaskCreatePinnedToCore(drainTask, "logDrain", 3072, nullptr, 1, &h, tskNO_AFFINITY);
+}
+
+} // namespace NetDebug
+#endif
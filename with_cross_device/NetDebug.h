@@ -1,14 +1,31 @@
 /**
- * NetDebug.h : simple logging helpers
+ * NetDebug.h : logging helpers
  *  - LOGD/LOGI/LOGW/LOGE(tag, fmt, ...)
+ *  - 呼び出し側は引数をバイナリのまま per-core リングに積むだけ（lock-free）。
+ *    整形と Serial 出力は低優先度の drain タスク（NetDebug::begin()）が行う。
+ *  - LOG_LEVEL 未満のマクロはコンパイル時に消える（既定: LOGD を除去）
+ *  - LOG_OUTPUT_BINARY=1 なら整形せずバイナリで出す（src/log_decoder で復号）
  *  - Wi-Fi event hook
+ *  - ARDUINO 未定義（ホストビルド）では同期的に stderr へ出力
  */
 #pragma once
+#include "config.h"
+#include "Metrics.h"
+#if defined(ARDUINO)
 #include <Arduino.h>
 #include <WiFi.h>
 #include <esp_timer.h>
 #include <esp_heap_caps.h>
+#include <atomic>
+#include <initializer_list>
+#include <type_traits>
+#else
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#endif
 
+#if defined(ARDUINO)
 static const char* reasonStr(uint8_t r){
   switch(r){
     case  1: return "UNSPECIFIED";
@@ -22,6 +39,7 @@ static const char* reasonStr(uint8_t r){
     default: return "OTHER";
   }
 }
+#endif
 
 
 namespace NetDebug {
@@ -31,27 +49,90 @@ namespace NetDebug {
               case WARN_L:return "W";default:return "E";}
   }
 
-  inline void vlog(Level lvl, const char* tag, const char* fmt, va_list ap){
-    char msg[256];
-    vsnprintf(msg, sizeof(msg), fmt, ap);
-    uint64_t us  = esp_timer_get_time();
-    size_t   hf  = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
-    Serial.printf("[%llu us][%s][%s][heap:%u][core:%d] %s\n",
-                  (unsigned long long)us, lvlStr(lvl), tag,
-                  (unsigned)hf, xPortGetCoreID(), msg);
+#if defined(ARDUINO)
+  /* ---- リングの 1 レコード（96B）-------------------------------------
+   * tag / fmt は文字列リテラル前提でポインタのみ保持する。
+   * 引数は型ごとに詰める: 整数≤32bit→4B, 64bit→8B, 浮動小数→double 8B,
+   * 文字列→長さ1B+本体（呼び出し後に消える String::c_str() 等のためコピー）。 */
+  constexpr size_t REC_ARG_BYTES = 72;
+  enum : uint8_t { REC_TRUNCATED = 0x01 };
+  struct Record {
+    std::atomic<uint32_t> seq;
+    uint8_t     level, core, argLen, flags;
+    uint64_t    ts_us;
+    const char* tag;
+    const char* fmt;
+    uint8_t     args[REC_ARG_BYTES];
+  };
+
+  struct ArgWriter {
+    uint8_t* p; uint8_t* end; bool trunc;
+    void raw(const void* v, size_t n){
+      if (p + n > end) { trunc = true; p = end; return; }
+      memcpy(p, v, n); p += n;
+    }
+    void str(const char* s){
+      if (p >= end) { trunc = true; return; }
+      size_t n = s ? strnlen(s, 255) : 0, room = size_t(end - p) - 1;
+      if (n > room) { n = room; trunc = true; }
+      *p++ = (uint8_t)n; memcpy(p, s, n); p += n;
+    }
+  };
+  inline void put(ArgWriter& w, const char* s){ w.str(s); }
+  inline void put(ArgWriter& w, char* s)      { w.str(s); }
+  inline void put(ArgWriter& w, double v)     { w.raw(&v, 8); }
+  template<class T>
+  inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+  put(ArgWriter& w, T v){
+    if (sizeof(T) > 4) { uint64_t u = (uint64_t)v; w.raw(&u, 8); }
+    else               { uint32_t u = (uint32_t)v; w.raw(&u, 4); }
+  }
+  template<class T> inline void put(ArgWriter& w, T* ptr){
+    uint32_t u = (uint32_t)(uintptr_t)ptr; w.raw(&u, 4);
+  }
+
+  // NetDebug.cpp: per-core MPMC リング（満杯時は nullptr, drop 計上）
+  Record* acquire(uint32_t& pos);
+  void    publish(Record* r, uint32_t pos);
+  void    begin();                       // drain タスク起動（setup 冒頭で 1 回）
+
+  template<class... A>
+  inline void log(Level lvl, const char* tag, const char* fmt, A... a){
+    uint32_t pos;
+    Record* r = acquire(pos);
+    if (!r) return;
+    r->ts_us = (uint64_t)esp_timer_get_time();
+    r->level = (uint8_t)lvl; r->core = (uint8_t)xPortGetCoreID();
+    r->tag = tag; r->fmt = fmt;
+    ArgWriter w{r->args, r->args + REC_ARG_BYTES, false};
+    (void)std::initializer_list<int>{ (put(w, a), 0)... };
+    r->argLen = (uint8_t)(w.p - r->args);
+    r->flags  = w.trunc ? REC_TRUNCATED : 0;
+    publish(r, pos);
   }
+#else
+  inline void begin(){}
 
-  inline void log(Level lvl, const char* tag, const char* fmt, ...){
-    va_list ap; va_start(ap, fmt); 
-    vlog(lvl, tag, fmt, ap); va_end(ap);
+  template<class... A>
+  inline void log(Level lvl, const char* tag, const char* fmt, A... a){
+    char msg[256];
+    if constexpr (sizeof...(A) > 0) snprintf(msg, sizeof(msg), fmt, a...);
+    else                            snprintf(msg, sizeof(msg), "%s", fmt);
+    fprintf(stderr, "[%s][%s] %s\n", lvlStr(lvl), tag, msg);
   }
+#endif
 }
 
-#define LOGD(tag, fmt, ...) NetDebug::log(NetDebug::DEBUG_L, tag, fmt, ##__VA_ARGS__)
-#define LOGI(tag, fmt, ...) NetDebug::log(NetDebug::INFO_L,  tag, fmt, ##__VA_ARGS__)
-#define LOGW(tag, fmt, ...) NetDebug::log(NetDebug::WARN_L,  tag, fmt, ##__VA_ARGS__)
-#define LOGE(tag, fmt, ...) NetDebug::log(NetDebug::ERROR_L, tag, fmt, ##__VA_ARGS__)
+/* LOG_LEVEL 未満は if(0) で包んで型検査だけ残し、コードと文字列は最適化で消える */
+#define NETDEBUG_LOG_(lvl, on, tag, fmt, ...) \
+  do { if (on) NetDebug::log(lvl, tag, fmt, ##__VA_ARGS__); } while (0)
+
+#define LOGD(tag, fmt, ...) NETDEBUG_LOG_(NetDebug::DEBUG_L, LOG_LEVEL <= 0, tag, fmt, ##__VA_ARGS__)
+#define LOGI(tag, fmt, ...) NETDEBUG_LOG_(NetDebug::INFO_L,  LOG_LEVEL <= 1, tag, fmt, ##__VA_ARGS__)
+#define LOGW(tag, fmt, ...) NETDEBUG_LOG_(NetDebug::WARN_L,  LOG_LEVEL <= 2, tag, fmt, ##__VA_ARGS__)
+#define LOGE(tag, fmt, ...) NETDEBUG_LOG_(NetDebug::ERROR_L, LOG_LEVEL <= 3, tag, fmt, ##__VA_ARGS__)
 
+#if defined(ARDUINO)
 /* -------- Wi-Fi event hook ------------------------------------------ */
 static void WiFiEvt(WiFiEvent_t e, WiFiEventInfo_t info){
   switch(e){
@@ -63,6 +144,7 @@ static void WiFiEvt(WiFiEvent_t e, WiFiEventInfo_t info){
            WiFi.gatewayIP().toString().c_str());
       break;
     case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+      Metrics::inc(Metrics::WIFI_DISCONNECTS);
       LOGW("WiFiEvt","DISCONNECTED, reason=%u(%s)", 
       info.wifi_sta_disconnected.reason, 
       reasonStr(info.wifi_sta_disconnected.reason));
@@ -77,3 +159,4 @@ static void WiFiEvt(WiFiEvent_t e, WiFiEventInfo_t info){
   }
 }
 inline void registerWiFiDebug(){ WiFi.onEvent(WiFiEvt); }
+#endif
@@ -0,0 +1,93 @@
+#include "PacketPool.h"
+#include "NetDebug.h"
+#include <stdlib.h>
+#if defined(ARDUINO)
+#include <esp_heap_caps.h>
+#endif
+
+static uint8_t* allocBlock(size_t align, size_t n, PacketPool::Mem mem)
+{
+#if defined(ARDUINO)
+    uint32_t caps = (mem == PacketPool::Mem::PSRAM) ? (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+                                                    : (MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    return (uint8_t*)heap_caps_aligned_alloc(align, n, caps);
+#else
+    (void)mem;
+    return (uint8_t*)aligned_alloc(align, n);   // n は align の倍数
+#endif
+}
+
+static void freeBlock(uint8_t* p)
+{
+#if defined(ARDUINO)
+    heap_caps_free(p);
+#else
+    ::free(p);
+#endif
+}
+
+PacketPool::~PacketPool()
+{
+    if (_inUse.load(std::memory_order_relaxed))
+        LOGW("POOL","destroyed with %u buffers in use", (unsigned)inUse());
+    freeBlock(_base);
+    delete[] _next;
+}
+
+bool PacketPool::begin(size_t count, size_t bufSize, Mem mem, size_t align)
+{
+    if (ready()) return true;
+    if (!count || count > kMaxCount || !bufSize || (align & (align - 1))) return false;
+
+    _stride = (bufSize + align - 1) & ~(align - 1);
+    _base   = allocBlock(align, _stride * count, mem);
+    _next   = new std::atomic<uint16_t>[count];
+    if (!_base || !_next) {
+        LOGE("POOL","alloc fail (%u x %u B, %s)", (unsigned)count, (unsigned)_stride,
+             mem == Mem::PSRAM ? "PSRAM" : "DMA");
+        freeBlock(_base); _base = nullptr;
+        delete[] _next;   _next = nullptr;
+        return false;
+    }
+    _bufSize = bufSize;
+    _count   = count;
+    for (size_t i = 0; i < count; ++i)
+        _next[i].store(i + 1 < count ? (uint16_t)(i + 1) : kNil, std::memory_order_relaxed);
+    _head.store(0, std::memory_order_release);
+    LOGI("POOL","%u x %u B (%s)", (unsigned)count, (unsigned)_stride, mem == Mem::PSRAM ? "PSRAM" : "DMA");
+    return true;
+}
+
+uint8_t* PacketPool::alloc()
+{
+    if (!_base) return nullptr;
+    uint32_t h = _head.load(std::memory_order_acquire);
+    for (;;) {
+        uint16_t i = (uint16_t)h;
+        if (i == kNil) {
+            _fails.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        /* i が他で取られて戻されていてもタグが変わるので CAS が失敗する */
+        uint32_t nh = ((h & 0xFFFF0000u) + 0x10000u) | _next[i].load(std::memory_order_relaxed);
+        if (_head.compare_exchange_weak(h, nh, std::memory_order_acquire, std::memory_order_acquire)) {
+            uint32_t u = _inUse.fetch_add(1, std::memory_order_relaxed) + 1;
+            uint32_t m = _hwm.load(std::memory_order_relaxed);
+            while (u > m && !_hwm.compare_exchange_weak(m, u, std::memory_order_relaxed)) {}
+            return _base + (size_t)i * _stride;
+        }
+    }
+}
+
+void PacketPool::free(uint8_t* p)
+{
+    if (!p) return;
+    if (!owns(p)) { LOGW("POOL","free of foreign buffer %p", p); return; }
+    uint16_t i = (uint16_t)((size_t)(p - _base) / _stride);
+    _inUse.fetch_sub(1, std::memory_order_relaxed);
+    uint32_t h = _head.load(std::memory_order_relaxed);
+    do {
+        _next[i].store((uint16_t)h, std::memory_order_relaxed);
+    } while (!_head.compare_exchange_weak(h, ((h & 0xFFFF0000u) + 0x10000u) | i,
+                                          std::memory_order_release, std::memory_order_relaxed));
+}
@@ -0,0 +1,55 @@
+#pragma once
+#if defined(ARDUINO)
+#include <Arduino.h>
+#endif
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * PacketPool : 固定長パケットバッファのスラブ
+ *  - begin() で count 個をまとめて確保し、以後は malloc しない
+ *  - alloc() / free() は O(1) のロック無し（タグ付き空きリストの CAS）。
+ *    どのタスク・コアからでも呼べる
+ *  - 使用中の個数・最大使用数（high-water）・確保失敗数を持つ
+ *  - Mem::DMA は DMA 可能な内部 RAM（packetize / GDMA / sendto の作業用）、
+ *    Mem::PSRAM は再送履歴など長く持つもの用。ホストではどちらも malloc
+ *
+ * 1 つのバッファは「組み立て → 送出待ち → 再送履歴」と持ち主が移っていく前提で、
+ * 最後の持ち主が free() する（参照カウントは持たない）。
+ */
+class PacketPool {
+public:
+    enum class Mem : uint8_t { DMA, PSRAM };
+    static constexpr size_t kMaxCount = 0xFFFE;
+
+    PacketPool() = default;
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+    ~PacketPool();
+
+    /* bufSize は align 単位に切り上げる。count は 1..kMaxCount */
+    bool     begin(size_t count, size_t bufSize, Mem mem, size_t align = 16);
+    bool     ready() const { return _base != nullptr; }
+
+    uint8_t* alloc();                    // 空きが無ければ nullptr
+    void     free(uint8_t* p);           // alloc() で得たもの以外は無視
+    bool     owns(const uint8_t* p) const {
+        return _base && p >= _base && p < _base + _stride * _count && (size_t)(p - _base) % _stride == 0;
+    }
+
+    size_t   bufSize()   const { return _bufSize; }
+    size_t   count()     const { return _count; }
+    uint32_t inUse()     const { return _inUse.load(std::memory_order_relaxed); }
+    uint32_t highWater() const { return _hwm.load(std::memory_order_relaxed); }
+    uint32_t fails()     const { return _fails.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr uint16_t kNil = 0xFFFF;
+
+    uint8_t*               _base   = nullptr;
+    std::atomic<uint16_t>* _next   = nullptr;    // 空きリストのリンク
+    size_t                 _bufSize = 0, _stride = 0, _count = 0;
+    std::atomic<uint32_t>  _head{kNil};          // 上位 16bit: ABA 対策のタグ / 下位: 先頭 index
+    std::atomic<uint32_t>  _inUse{0}, _hwm{0}, _fails{0};
+};
@@ -0,0 +1,163 @@
+#include "RtspServer.h"
+#include "NetDebug.h"
+
+static constexpr size_t kReqMax = 2048;      // これを超える要求は捨てる（ヘッダのみの想定）
+
+/* "Name: value" の値（無ければ空）。名前は大文字小文字を区別しない */
+static String header(const String& req, const char* name)
+{
+    String low = req;  low.toLowerCase();
+    String key = String("\n") + name + ":";  key.toLowerCase();
+    int i = low.indexOf(key);
+    if (i < 0) return String();
+    int b = i + key.length();
+    int e = req.indexOf("\r\n", b);
+    String v = req.substring(b, e < 0 ? req.length() : e);
+    v.trim();
+    return v;
+}
+
+bool RtspServer::begin(uint16_t port)
+{
+    if (_started) return true;
+    _srv.begin(port);
+    _srv.setNoDelay(true);
+    _started = true;
+    LOGI("RTSP","listening rtsp://%s:%u%s", WiFi.localIP().toString().c_str(), (unsigned)port, RTSP_PATH);
+    return true;
+}
+
+void RtspServer::stopSession(const char* why)
+{
+    if (_playing) LOGI("RTSP","stop (%s)", why);
+    _playing = false;
+    _cli_rtp = _cli_rtcp = 0;
+}
+
+void RtspServer::loop()
+{
+    if (!_started) return;
+
+    if (!_cli || !_cli.connected()) {
+        if (_cli) { _cli.stop(); stopSession("client closed"); }
+        WiFiClient c = _srv.accept();
+        if (!c) return;
+        _cli = c;
+        _cli.setNoDelay(true);
+        _reqbuf = "";
+        _tReq   = millis();
+        LOGI("RTSP","client %s", _cli.remoteIP().toString().c_str());
+    }
+
+    /* 届いている分だけ読む。空行で 1 要求（本文付きの要求は扱わない） */
+    while (_cli.available() > 0) {
+        int ch = _cli.read();
+        if (ch < 0) break;
+        _reqbuf += (char)ch;
+        if (_reqbuf.endsWith("\r\n\r\n")) {
+            _tReq = millis();
+            handleRequest(_reqbuf);
+            _reqbuf = "";
+        } else if (_reqbuf.length() > kReqMax) {
+            LOGW("RTSP","request too long, dropped");
+            _reqbuf = "";
+        }
+    }
+
+    if (_playing && millis() - _tReq > RTSP_SESSION_TIMEOUT_S * 1000UL) {
+        stopSession("session timeout");
+        _cli.stop();
+    }
+}
+
+void RtspServer::reply(int code, const char* reason, const String& cseq,
+                       const String& extra, const String& body)
+{
+    String r = String("RTSP/1.0 ") + code + " " + reason + "\r\n";
+    r += String("CSeq: ") + cseq + "\r\n";
+    r += extra;
+    if (body.length()) r += String("Content-Length: ") + (int)body.length() + "\r\n";
+    r += "\r\n";
+    r += body;
+    _cli.write((const uint8_t*)r.c_str(), r.length());
+}
+
+void RtspServer::handleRequest(const String& req)
+{
+    int sp = req.indexOf(' ');
+    int sp2 = sp < 0 ? -1 : req.indexOf(' ', sp + 1);
+    if (sp < 0 || sp2 < 0) return;
+    String method = req.substring(0, sp);
+    String url    = req.substring(sp + 1, sp2);
+    String cseq   = header(req, "CSeq");
+    auto   sess   = [this]{ return String("Session: ") + _session + ";timeout=" + (int)RTSP_SESSION_TIMEOUT_S + "\r\n"; };
+    LOGD("RTSP","%s %s", method.c_str(), url.c_str());
+
+    if (method == "OPTIONS") {
+        reply(200, "OK", cseq, "Public: OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN, GET_PARAMETER\r\n");
+
+    } else if (method == "DESCRIBE") {
+        reply(200, "OK", cseq,
+              String("Content-Base: ") + url + "/\r\nContent-Type: application/sdp\r\n", makeSdp());
+
+    } else if (method == "SETUP") {
+        /* UDP ユニキャストのみ（TCP interleaved は 461） */
+        String tr = header(req, "Transport");
+        int cp = tr.indexOf("client_port=");
+        if (cp < 0 || tr.indexOf("TCP") >= 0) {
+            reply(461, "Unsupported Transport", cseq);
+            return;
+        }
+        String ports = tr.substring(cp + 12);
+        int dash = ports.indexOf('-');
+        _cli_rtp  = (uint16_t)ports.substring(0, dash < 0 ? ports.length() : dash).toInt();
+        _cli_rtcp = dash < 0 ? _cli_rtp + 1 : (uint16_t)ports.substring(dash + 1).toInt();
+        _cli_ip   = _cli.remoteIP();
+        _session  = String((uint32_t)esp_random(), HEX);
+        reply(200, "OK", cseq,
+              String("Transport: RTP/AVP;unicast;client_port=") + _cli_rtp + "-" + _cli_rtcp +
+              ";server_port=" + (int)RTSP_RTP_PORT + "\r\n" + sess());   // RTCP は受けない
+
+    } else if (method == "PLAY") {
+        /* 宛先はこのクライアントだけ（RTP_EXTRA_DESTS は RTP 経路のもの）。送信元は SETUP で伝えた server_port */
+        if (!_cli_rtp || !_udp.begin(_cli_ip.toString().c_str(), _cli_rtp, UdpAgent::Mode::RTP_JPEG,
+                                     nullptr, RTSP_RTP_PORT)) {
+            reply(455, "Method Not Valid in This State", cseq);
+            return;
+        }
+        _playing = true;
+        LOGI("RTSP","play → %s:%u", _cli_ip.toString().c_str(), (unsigned)_cli_rtp);
+        reply(200, "OK", cseq, String("Range: npt=0.000-\r\n") + sess());
+
+    } else if (method == "TEARDOWN") {
+        stopSession("teardown");
+        reply(200, "OK", cseq, sess());
+
+    } else if (method == "GET_PARAMETER" || method == "SET_PARAMETER") {
+        reply(200, "OK", cseq, sess());                        // keepalive
+
+    } else {
+        reply(501, "Not Implemented", cseq);
+    }
+}
+
+String RtspServer::makeSdp() const
+{
+    String s;
+    s += "v=0\r\n";
+    s += String("o=- ") + _session + " 1 IN IP4 " + WiFi.localIP().toString() + "\r\n";
+    s += "s=with_cross_device\r\n";
+    s += "c=IN IP4 0.0.0.0\r\n";
+    s += "t=0 0\r\n";
+    s += String("m=video 0 RTP/AVP ") + (int)RTP_PT_JPEG + "\r\n";
+    s += String("a=rtpmap:") + (int)RTP_PT_JPEG + " JPEG/90000\r\n";
+    s += String("a=framerate:") + (int)CAM_FPS + "\r\n";
+    s += "a=control:track1\r\n";
+    return s;
+}
+
+bool RtspServer::sendJpegFrame(const uint8_t* jpg, size_t len, uint16_t w, uint16_t h, uint64_t cap_us)
+{
+    if (!_playing || !_udp.ready()) return false;
+    return _udp.sendRtpJpegFrame(jpg, len, w, h, cap_us);
+}
@@ -4,21 +4,33 @@
 #include "UdpAgent.h"
 #include "config.h"
 
+/**
+ * RtspServer : RTP/JPEG を UDP で流す最小の RTSP サーバ（クライアント 1 台）
+ *  - OPTIONS / DESCRIBE / SETUP（RTP/AVP の UDP ユニキャストのみ）/ PLAY / TEARDOWN /
+ *    GET_PARAMETER（keepalive）
+ *  - loop() はブロックしない（netcamTask から毎回呼ぶ）。要求が RTSP_SESSION_TIMEOUT_S
+ *    途絶えたら再生を止める
+ *  - 送出は内部の UdpAgent（PLAY でクライアントの RTP ポートへ begin）。送信元は RTSP_RTP_PORT に
+ *    bind して SETUP の server_port で伝える（RTCP のポートは持たない）
+ */
 class RtspServer {
 public:
   bool begin(uint16_t port = RTSP_PORT);
+  bool started() const { return _started; }
   void loop(); // accept / parse / keepalive
   bool isPlaying() const { return _playing; }
 
   // カメラフレームを送る（内部の UdpAgent が RTP/JPEG 送出）
-  bool sendJpegFrame(const uint8_t* jpg, size_t len, uint16_t w, uint16_t h);
+  bool sendJpegFrame(const uint8_t* jpg, size_t len, uint16_t w, uint16_t h, uint64_t cap_us = 0);
 
 private:
   WiFiServer  _srv{RTSP_PORT};
   WiFiClient  _cli;
+  bool        _started = false;
   bool        _playing = false;
   String      _session = "0001abcd";
   String      _reqbuf;
+  uint32_t    _tReq = 0;          // 最後に要求を受けた millis（セッションの期限）
 
   // client RTP/RTCP
   IPAddress   _cli_ip;
@@ -27,5 +39,8 @@ private:
   UdpAgent    _udp;
 
   void handleRequest(const String& req);
-  String makeSdp(uint16_t w, uint16_t h) const;
+  void reply(int code, const char* reason, const String& cseq, const String& extra = String(),
+             const String& body = String());
+  void stopSession(const char* why);
+  String makeSdp() const;          // 画素数は RTP/JPEG ヘッダで伝わるので載せない
 };
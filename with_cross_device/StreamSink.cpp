@@ -0,0 +1,127 @@
+#include "StreamSink.h"
+#include "NetDebug.h"
+#include "Metrics.h"
+
+/* ===== StreamSink ===== */
+const char* StreamSink::name(Kind k)
+{
+    switch (k) {
+        case Kind::RTP:  return "RTP";
+        case Kind::WS:   return "WS";
+        case Kind::RTSP: return "RTSP";
+        case Kind::RAW:  return "RAW";
+    }
+    return "?";
+}
+
+void StreamSink::setActive(bool on)
+{
+    _active.store(on, std::memory_order_relaxed);
+    if (on) return;
+    FrameRef f;                          // 外れた経路に積まれた分は送らない
+    while (take(f)) f.reset();
+}
+
+/* ===== StreamSelector ===== */
+bool StreamSelector::add(StreamSink* s)
+{
+    if (!s || _n >= StreamSink::kKinds || find(s->kind())) return false;
+    _sinks[_n++] = s;
+    return true;
+}
+
+StreamSink* StreamSelector::find(Kind k) const
+{
+    for (uint8_t i = 0; i < _n; ++i)
+        if (_sinks[i]->kind() == k) return _sinks[i];
+    return nullptr;
+}
+
+void StreamSelector::onCaps(uint8_t caps, uint8_t prefer)
+{
+    _caps.store(uint16_t(caps) << 8 | prefer);
+    _capsValid = true;
+    LOGI("STREAM","server caps=0x%02X prefer=%u", caps, prefer);
+}
+
+void StreamSelector::onLoss(uint16_t permille)
+{
+    uint32_t now = millis();
+    _loss.store(permille);
+    _lossAt.store(now ? now : 1);
+    Metrics::set(Metrics::STREAM_LOSS_PERMILLE, permille);
+}
+
+void StreamSelector::forgetCaps()
+{
+    if (_capsValid.exchange(false)) LOGI("STREAM","server caps cleared");
+    _lossAt = 0;
+}
+
+bool StreamSelector::eligible(Kind k, uint8_t caps, bool capsValid) const
+{
+    StreamSink* s = find(k);
+    if (!s) return false;
+    if (capsValid ? !(caps & (1u << (uint8_t)k)) : k != _default) return false;
+    return s->available();
+}
+
+/* 今の UDP 系経路の損失率が閾値を超え続けたら、しばらく UDP 系を外す */
+void StreamSelector::checkLoss(uint32_t now)
+{
+    uint32_t at = _lossAt.load();
+    bool fresh = at && (int32_t)(at - _tSwitch) >= 0 && now - at <= STREAM_LOSS_HOLD_MS;
+    if (!_active || !StreamSink::overUdp(_active->kind()) || !fresh ||
+        _loss.load() <= STREAM_LOSS_HI_PERMILLE) {
+        _badSince = 0;
+        return;
+    }
+    if (!_badSince) { _badSince = now ? now : 1; return; }
+    if (now - _badSince < STREAM_LOSS_HOLD_MS) return;
+
+    LOGW("STREAM","%s loss %u‰ for %u ms – UDP paths off for %u ms", _active->name(),
+         (unsigned)_loss.load(), (unsigned)(now - _badSince), (unsigned)STREAM_RETRY_MS);
+    _udpBanTil = (now + STREAM_RETRY_MS) | 1;
+    _badSince  = 0;
+}
+
+void StreamSelector::tick(uint32_t now)
+{
+    checkLoss(now);
+    if (_udpBanTil && (int32_t)(now - _udpBanTil) >= 0) {
+        _udpBanTil = 0;
+        LOGI("STREAM","retrying UDP paths");
+    }
+
+    uint16_t cp    = _caps.load();
+    bool     valid = _capsValid.load();
+    uint8_t  caps  = cp >> 8, prefer = cp & 0xFF;
+
+    Kind order[2 + StreamSink::kKinds];
+    uint8_t n = 0;
+    if (valid && prefer < StreamSink::kKinds) order[n++] = (Kind)prefer;
+    order[n++] = _default;
+    for (Kind k : { Kind::RTP, Kind::RTSP, Kind::RAW, Kind::WS }) order[n++] = k;
+
+    /* UDP 系を外している間も、他に送れる経路が無ければ UDP 系で送り続ける */
+    StreamSink* pick = nullptr;
+    for (int pass = _udpBanTil ? 0 : 1; pass < 2 && !pick; ++pass) {
+        for (uint8_t i = 0; i < n && !pick; ++i) {
+            if (pass == 0 && StreamSink::overUdp(order[i])) continue;
+            if (eligible(order[i], caps, valid)) pick = find(order[i]);
+        }
+    }
+    if (pick != _active) activate(pick, now);
+}
+
+void StreamSelector::activate(StreamSink* s, uint32_t now)
+{
+    LOGI("STREAM","%s → %s", _active ? _active->name() : "none", s ? s->name() : "none");
+    if (_active) _active->setActive(false);
+    if (s)       s->setActive(true);
+    if (_active && s) Metrics::inc(Metrics::STREAM_SWITCHES);
+    _active   = s;
+    _tSwitch  = now;
+    _badSince = 0;
+    Metrics::set(Metrics::STREAM_ACTIVE, s ? (uint32_t)s->kind() : 0xFF);
+}
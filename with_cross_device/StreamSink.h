@@ -0,0 +1,87 @@
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+#include "FrameSource.h"
+#include "config.h"
+
+/**
+ * StreamSink : 映像の送出経路（RTP/UDP・RAW UDP・WS・RTSP）の共通インタフェース
+ *  - 全経路の sink を起動時に登録しておき、StreamSelector が選んだ 1 本だけを
+ *    active にする。active でない sink は撮像を要求しない（wants() が false）
+ *  - 経路の切り替えはフラグの付け替えだけで、カメラ・ソケットは作り直さない
+ *  - available() は「今この経路で送れるか」（接続済み・再生中など）。選択に使う
+ */
+class StreamSink : public FrameSink {
+public:
+    /* 値は CAPS のビット位置（WsAgent.h の STREAM_CAPS 参照） */
+    enum class Kind : uint8_t { RTP = 0, WS = 1, RTSP = 2, RAW = 3 };
+    static constexpr uint8_t kKinds = 4;
+
+    StreamSink(Kind k, uint8_t depth, Drop drop) : FrameSink(depth, drop), _kind(k) {}
+
+    Kind        kind() const { return _kind; }
+    const char* name() const { return name(_kind); }
+    static const char* name(Kind k);
+    static bool overUdp(Kind k) { return k != Kind::WS; }     // 損失率で外す対象
+
+    virtual bool available() = 0;
+    bool active() const { return _active.load(std::memory_order_relaxed); }
+    void setActive(bool on);             // 外すときは溜まっているフレームを捨てる
+
+    bool wants() final { return active() && accept(); }
+
+protected:
+    /* active のとき、この周期のフレームを受け取れるか（従来の wants()） */
+    virtual bool accept() { return available(); }
+
+private:
+    Kind              _kind;
+    std::atomic<bool> _active{false};
+};
+
+/**
+ * StreamSelector : 送出経路の選択（netcamTask の tick() で適用）
+ *  - 候補: サーバの CAPS（受けられる経路）に含まれ、available() なもの。
+ *    CAPS を受けていない間（従来のサーバ）は既定の経路（STREAM_MODE）だけ
+ *  - 順位: サーバの prefer → 既定の経路 → RTP → RTSP → RAW → WS
+ *  - UDP 系の経路で受信側の損失率が STREAM_LOSS_HI_PERMILLE を超えた状態が
+ *    STREAM_LOSS_HOLD_MS 続いたら、UDP 系を STREAM_RETRY_MS だけ外す（WS へ
+ *    落ちる）。期限が来たら元の経路を試し直す
+ *  - onCaps() / onLoss() は受信タスク（WS_MUX なら ctrlTask）から呼んでよい
+ */
+class StreamSelector {
+public:
+    using Kind = StreamSink::Kind;
+
+    bool add(StreamSink* s);
+    void setDefault(Kind k) { _default = k; }
+
+    void onCaps(uint8_t caps, uint8_t prefer);     // サーバの対応経路（0xFF = 端末に任せる）
+    void onLoss(uint16_t permille);                // UDP 経路の直近の損失率（受信側で計測）
+    void forgetCaps();                             // サーバとの接続が切れた
+
+    void tick(uint32_t nowMs);
+    StreamSink* active() const { return _active; }
+
+private:
+    StreamSink* find(Kind k) const;
+    bool        eligible(Kind k, uint8_t caps, bool capsValid) const;
+    void        checkLoss(uint32_t now);
+    void        activate(StreamSink* s, uint32_t now);
+
+    StreamSink* _sinks[StreamSink::kKinds] = {};
+    uint8_t     _n = 0;
+    Kind        _default = Kind::RTP;
+    StreamSink* _active = nullptr;
+
+    /* 受信タスク → tick() */
+    std::atomic<uint16_t> _caps{0};                // caps(8) << 8 | prefer(8)
+    std::atomic<bool>     _capsValid{false};
+    std::atomic<uint16_t> _loss{0};
+    std::atomic<uint32_t> _lossAt{0};              // 最後に LOSS を受けた millis（0 = 未受信）
+
+    /* tick() のみ */
+    uint32_t _tSwitch   = 0;                       // 今の経路にした時刻
+    uint32_t _badSince  = 0;                       // 損失率が閾値を超え始めた時刻（0 = 正常）
+    uint32_t _udpBanTil = 0;                       // UDP 系を外している期限（0 = なし）
+};
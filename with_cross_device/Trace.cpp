@@ -0,0 +1,98 @@
+#include "Trace.h"
+#if defined(ARDUINO) && TRACE_ENABLE
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <atomic>
+#include "NetDebug.h"
+
+namespace Trace {
+
+static_assert((TRACE_EVENTS & (TRACE_EVENTS - 1)) == 0, "TRACE_EVENTS must be power of 2");
+
+struct Event {               // 16B
+  uint32_t    ts_us;         // esp_timer 下位 32bit（変換側で折り返しを補正）
+  const char* name;          // 文字列リテラル
+  uint32_t    task;          // TaskHandle_t
+  uint16_t    arg;
+  uint8_t     ph;
+  uint8_t     core;
+};
+
+static Event*                gBuf = nullptr;
+static std::atomic<uint32_t> gIdx{0};
+static std::atomic<bool>     gOn{false};
+static std::atomic<bool>     gUdpReq{false};
+
+bool begin(){
+  if (gBuf) return true;
+  gBuf = (Event*)heap_caps_calloc(TRACE_EVENTS, sizeof(Event), MALLOC_CAP_SPIRAM);
+  if (!gBuf) { LOGW("TRACE","PSRAM alloc failed – disabled"); return false; }
+  gOn.store(true);
+  LOGI("TRACE","ring %u events (%u KB PSRAM)", (unsigned)TRACE_EVENTS,
+       (unsigned)(TRACE_EVENTS * sizeof(Event) / 1024));
+  return true;
+}
+
+void record(Ph ph, const char* name, uint32_t arg){
+  if (!gOn.load(std::memory_order_relaxed)) return;
+  uint32_t i = gIdx.fetch_add(1, std::memory_order_relaxed);
+  Event& e = gBuf[i & (TRACE_EVENTS - 1)];
+  e.ts_us = (uint32_t)esp_timer_get_time();
+  e.name  = name;
+  e.task  = (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle();
+  e.arg   = (uint16_t)(arg > 0xFFFF ? 0xFFFF : arg);
+  e.ph    = ph;
+  e.core  = (uint8_t)xPortGetCoreID();
+}
+
+/* 出力形式（1 行 1 レコード）
+ *   #TRACE v1 events=<n>
+ *   #TASK <handle hex> <name>
+ *   E,<ts_us>,<ph>,<core>,<task hex>,<arg>,<name>
+ *   #END
+ */
+void dump(const std::function<void(const char*, size_t)>& sink){
+  if (!gBuf) return;
+  gOn.store(false);
+  vTaskDelay(1);                                   // 書き込み途中のイベントを待つ
+
+  uint32_t end = gIdx.load();
+  uint32_t n   = end < TRACE_EVENTS ? end : TRACE_EVENTS;
+  uint32_t beg = end - n;
+  char line[96];
+  int  len = snprintf(line, sizeof(line), "#TRACE v1 events=%u\n", (unsigned)n);
+  sink(line, len);
+
+  // タスク名（ハンドルは削除されない前提で pcTaskGetName を引く）
+  uint32_t seen[16]; size_t ns = 0;
+  for (uint32_t i = beg; i != end && ns < 16; ++i) {
+    uint32_t t = gBuf[i & (TRACE_EVENTS - 1)].task;
+    bool dup = false;
+    for (size_t k = 0; k < ns; ++k) dup |= (seen[k] == t);
+    if (dup || !t) continue;
+    seen[ns++] = t;
+    len = snprintf(line, sizeof(line), "#TASK %08x %s\n", (unsigned)t, pcTaskGetName((TaskHandle_t)(uintptr_t)t));
+    sink(line, len);
+  }
+
+  for (uint32_t i = beg; i != end; ++i) {
+    const Event& e = gBuf[i & (TRACE_EVENTS - 1)];
+    if (!e.name) continue;
+    len = snprintf(line, sizeof(line), "E,%u,%c,%u,%08x,%u,%s\n",
+                   (unsigned)e.ts_us, (char)e.ph, (unsigned)e.core,
+                   (unsigned)e.task, (unsigned)e.arg, e.name);
+    sink(line, len);
+  }
+  sink("#END\n", 5);
+
+  gIdx.store(0);
+  memset(gBuf, 0, TRACE_EVENTS * sizeof(Event));
+  gOn.store(true);
+}
+
+void requestUdpDump()     { gUdpReq.store(true); }
+bool takeUdpDumpRequest() { return gUdpReq.exchange(false); }
+
+} // namespace Trace
+#endif
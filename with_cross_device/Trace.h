@@ -0,0 +1,56 @@
+#pragma once
+#include "config.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+
+/**
+ * Trace : 低オーバヘッドのパイプライン・トレース
+ *  - B/E/I イベントを esp_timer 時刻・コア番号・タスクと共に PSRAM リングへ記録
+ *  - 記録は atomic fetch_add で 1 スロット確保して書くだけ（古いものから上書き）
+ *  - dump() で 1 行 1 イベントのテキストに書き出す（Serial / UDP）。
+ *    src/trace_tools/trace2chrome.py で Chrome/Perfetto の JSON に変換する。
+ *  ARDUINO 以外 / TRACE_ENABLE=0 ではマクロごと消える。
+ */
+namespace Trace {
+  enum Ph : uint8_t { BEGIN = 'B', END = 'E', INSTANT = 'i' };
+
+#if defined(ARDUINO) && TRACE_ENABLE
+  bool begin();                                   // PSRAM 確保（失敗時は無効のまま）
+  void record(Ph ph, const char* name, uint32_t arg = 0);
+
+  // テキスト 1 行ずつ sink に渡す。ダンプ中は記録を止める。
+  void dump(const std::function<void(const char* line, size_t len)>& sink);
+
+  // UDP ダンプ要求（Serial 'u'）→ netcamTask 側で UdpAgent::sendTrace()
+  void requestUdpDump();
+  bool takeUdpDumpRequest();
+
+  struct Scope {
+    const char* n;
+    explicit Scope(const char* name, uint32_t arg = 0) : n(name) { record(BEGIN, name, arg); }
+    ~Scope() { record(END, n); }
+  };
+#else
+  inline bool begin() { return false; }
+  inline void record(Ph, const char*, uint32_t = 0) {}
+  inline void dump(const std::function<void(const char*, size_t)>&) {}
+  inline void requestUdpDump() {}
+  inline bool takeUdpDumpRequest() { return false; }
+  struct Scope { explicit Scope(const char*, uint32_t = 0) {} };
+#endif
+}
+
+#define TRACE_CAT2_(a, b) a##b
+#define TRACE_CAT_(a, b)  TRACE_CAT2_(a, b)
+#if defined(ARDUINO) && TRACE_ENABLE
+#define TRACE_BEGIN(name)          Trace::record(Trace::BEGIN, name)
+#define TRACE_END(name)            Trace::record(Trace::END, name)
+#define TRACE_INSTANT(name, arg)   Trace::record(Trace::INSTANT, name, arg)
+#define TRACE_SCOPE(name)          Trace::Scope TRACE_CAT_(_trace_, __LINE__)(name)
+#else
+#define TRACE_BEGIN(name)          do {} while (0)
+#define TRACE_END(name)            do {} while (0)
+#define TRACE_INSTANT(name, arg)   do {} while (0)
+#define TRACE_SCOPE(name)          do {} while (0)
+#endif
@@ -1,9 +1,59 @@
 #include "UdpAgent.h"
 #include "NetDebug.h"
 #include "rtp_jpeg.h"
+#include "Metrics.h"
+#include "Trace.h"
 #include <string.h>
+#include <esp_timer.h>
+#include <type_traits>
+#if RTP_BATCH_SEND
+#include <lwip/udp.h>
+#include <lwip/pbuf.h>
+#include <lwip/tcpip.h>
+#include <lwip/priv/tcpip_priv.h>
+#endif
 
-bool UdpAgent::begin(const char* ip, uint16_t port, Mode mode){
+// SSRC: 0 番の宛先は固定（既存の受信側設定と互換）。追加宛先は乱数
+static constexpr uint32_t kRtpSsrc = 0x13572468u;
+
+static bool parseAddr(const char* ip, uint16_t port, sockaddr_in& a){
+  memset(&a, 0, sizeof(a));
+  a.sin_family = AF_INET;
+  a.sin_port   = htons(port);
+  return inet_pton(AF_INET, ip, &a.sin_addr) == 1;
+}
+
+static bool isMulticast(const sockaddr_in& a){
+  return (ntohl(a.sin_addr.s_addr) & 0xF0000000u) == 0xE0000000u;   // 224.0.0.0/4
+}
+
+#if RTP_BATCH_SEND
+/* lwIP コア（raw API）での実行。コアロックが使えればこのタスクのまま 1 回ロック、
+ * 無ければ tcpip スレッドへ 1 回だけ依頼して終わりを待つ */
+#if LWIP_TCPIP_CORE_LOCKING
+template<class F> static void inLwipCore(F&& f){
+  LOCK_TCPIP_CORE();
+  f();
+  UNLOCK_TCPIP_CORE();
+}
+#else
+struct CoreCall { tcpip_api_call_data base; void (*fn)(void*); void* arg; };
+static err_t coreCallTramp(tcpip_api_call_data* c){
+  CoreCall* cc = (CoreCall*)c;
+  cc->fn(cc->arg);
+  return ERR_OK;
+}
+template<class F> static void inLwipCore(F&& f){
+  using Fn = std::remove_reference_t<F>;
+  CoreCall c{};
+  c.fn  = [](void* a){ (*(Fn*)a)(); };
+  c.arg = (void*)&f;
+  tcpip_api_call(coreCallTramp, &c.base);
+}
+#endif
+#endif
+
+bool UdpAgent::begin(const char* ip, uint16_t port, Mode mode, const char* extra, uint16_t local_port){
   if(_sock>=0) { close(_sock); _sock=-1; }
   _mode = mode;
 
@@ -14,82 +64,338 @@ bool UdpAgent::begin(const char* ip, uint16_t port, Mode mode){
   int tos = 0x10; // IPTOS_LOWDELAY
   setsockopt(_sock, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
 
-  memset(&_peer, 0, sizeof(_peer));
-  _peer.sin_family = AF_INET;
-  _peer.sin_port   = htons(port);
-  _peer.sin_addr.s_addr = inet_addr(ip);
+  if(local_port){
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(local_port);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(bind(_sock, (sockaddr*)&local, sizeof(local)) < 0){
+      LOGE("UDP","bind %u failed", (unsigned)local_port);
+      close(_sock); _sock = -1; return false;
+    }
+  }
+
+  _nDest = 0;
+  if (addDest(ip, port) != 0) { close(_sock); _sock = -1; return false; }
+  _dest[0].ssrc = kRtpSsrc;
+  _dest[0].seq  = 1;
+  _peer = _dest[0].addr;
+  addExtraDests(extra);
+  _copy.begin();                   // GDMA が無くても memcpy で動く
+  if(!_pool.begin(RTP_POOL_PKTS, rtpjpeg::pkt_buf_size(RTP_PAYLOAD_MTU), PacketPool::Mem::DMA, ASYNC_COPY_ALIGN)){
+    close(_sock); _sock = -1; return false;
+  }
+  if(RTP_HIST_PKTS > 0)
+    _hist.begin(RTP_HIST_PKTS, rtpjpeg::pkt_buf_size(RTP_PAYLOAD_MTU), PacketPool::Mem::PSRAM, ASYNC_COPY_ALIGN);
+#if RTP_BATCH_SEND
+  /* 送信元ポートを固定するとき（RTSP の server_port）は bind したソケットから送る。
+   * pcb は任意ポートになり、SETUP で伝えたポートと合わなくなるので使わない */
+  if(local_port && _pcb){
+    udp_pcb* pcb = (udp_pcb*)_pcb;
+    inLwipCore([&]{ udp_remove(pcb); });
+    _pcb = nullptr;
+  }
+  if(!_pcb && !local_port){
+    udp_pcb* pcb = nullptr;
+    uint8_t ttl = _mcastTtl;
+    inLwipCore([&]{
+      pcb = udp_new();
+      if(pcb){ pcb->tos = 0x10; udp_set_multicast_ttl(pcb, ttl); }
+    });
+    _pcb = pcb;
+    if(!_pcb) LOGW("UDP","udp_new fail, per-packet sendto");
+  }
+  _nBatch = 0;
+#endif
 
-  _seq = 1;
   _ts  = 0;
+  _last_cap_us = 0;
   _t_last_report = millis();
   _pkt_in_1s = _drop_in_1s = 0;
+  _cap_in_1s = _frm_in_1s = 0;
 
-  LOGI("UDP","dst=%s:%u mode=%s", ip, (unsigned)port,
+  LOGI("UDP","dst=%s:%u (+%u) mode=%s", ip, (unsigned)port, (unsigned)(_nDest - 1),
        (_mode==Mode::RTP_JPEG) ? "RTP/JPEG" : "RAW-JPEG");
   return true;
 }
 
+int UdpAgent::addDest(const char* ip, uint16_t port){
+  sockaddr_in a;
+  if(_sock<0 || !parseAddr(ip, port, a)) { LOGW("UDP","bad dest %s:%u", ip, (unsigned)port); return -1; }
+  for(uint8_t i=0;i<_nDest;i++){
+    if(_dest[i].addr.sin_addr.s_addr==a.sin_addr.s_addr && _dest[i].addr.sin_port==a.sin_port) return i;
+  }
+  if(_nDest >= RTP_MAX_DESTS){ LOGW("UDP","dest table full (%u)", (unsigned)RTP_MAX_DESTS); return -1; }
+  if(isMulticast(a)) setMulticastTtl(_mcastTtl);
+
+  Dest& d = _dest[_nDest];
+  d.addr    = a;
+  d.ssrc    = esp_random();
+  d.seq     = (uint16_t)esp_random();
+  d.ts_base = esp_random();
+  LOGI("UDP","dest[%u] %s:%u ssrc=%08x%s", (unsigned)_nDest, ip, (unsigned)port,
+       (unsigned)d.ssrc, isMulticast(a) ? " (multicast)" : "");
+  return _nDest++;
+}
+
+bool UdpAgent::removeDest(const char* ip, uint16_t port){
+  sockaddr_in a;
+  if(!parseAddr(ip, port, a)) return false;
+  for(uint8_t i=1;i<_nDest;i++){                 // 0 番（begin の宛先）は外さない
+    if(_dest[i].addr.sin_addr.s_addr!=a.sin_addr.s_addr || _dest[i].addr.sin_port!=a.sin_port) continue;
+    for(uint8_t k=i;k+1<_nDest;k++) _dest[k] = _dest[k+1];
+    _nDest--;
+    LOGI("UDP","dest %s:%u removed", ip, (unsigned)port);
+    return true;
+  }
+  return false;
+}
+
+void UdpAgent::setMulticastTtl(uint8_t ttl){
+  _mcastTtl = ttl;
+  if(_sock>=0) setsockopt(_sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+#if RTP_BATCH_SEND
+  if(_pcb) inLwipCore([&]{ udp_set_multicast_ttl((udp_pcb*)_pcb, ttl); });
+#endif
+}
+
+/* "ip:port,ip:port" */
+void UdpAgent::addExtraDests(const char* list){
+  char ip[16];
+  for(const char* p = list; p && *p; ){
+    const char* c = strchr(p, ':');
+    const char* e = strchr(p, ',');
+    if(!e) e = p + strlen(p);
+    if(c && c < e && size_t(c - p) < sizeof(ip)){
+      memcpy(ip, p, c - p); ip[c - p] = 0;
+      addDest(ip, (uint16_t)atoi(c + 1));
+    }
+    p = *e ? e + 1 : e;
+  }
+}
+
 bool UdpAgent::sendFrame(const uint8_t* jpg, size_t len, uint32_t){
   if(_sock<0) return false;
   if(_mode==Mode::RTP_JPEG){
     // Protect against misuse
-    return sendRtpJpegFrame(jpg, len, CAM_WIDTH, CAM_HEIGHT);
+    return sendRtpJpegFrame(jpg, len, CAM_WIDTH, CAM_HEIGHT, 0);
   }
-  ssize_t n = sendto(_sock, (const char*)jpg, len, 0, (sockaddr*)&_peer, sizeof(_peer));
-  if(n<0){ _drop_in_1s++; return false; }
-  _pkt_in_1s++; return true;
+  bool any = false;
+  for(uint8_t i=0;i<_nDest;i++){
+    ssize_t n = sendto(_sock, (const char*)jpg, len, 0, (sockaddr*)&_dest[i].addr, sizeof(sockaddr_in));
+    if(n<0){ _drop_in_1s++; continue; }
+    _pkt_in_1s++; any = true;
+  }
+  return any;
 }
 
 bool UdpAgent::sendRtpJpegFrame(const uint8_t* jpg, size_t len,
-                                uint16_t w, uint16_t h, uint32_t){
+                                uint16_t w, uint16_t h,
+                                uint64_t cap_us, uint32_t){
   if(_sock<0) return false;
 
-  if(_ts==0){
-    // First TS arbitrary. Then advance by 90k/fps each frame.
-    _ts = millis() * 90;
-  }else{
-    _ts += (uint32_t)(90000 / CAM_FPS);
+  // RTP TS = 撮像時刻を 90kHz に換算（+宛先ごとのランダム初期値）。
+  // 欠落・遅延フレームがあっても受信側の時間軸とずれない。
+  if(cap_us==0) cap_us = (uint64_t)esp_timer_get_time();
+  _ts = (uint32_t)(cap_us * 9 / 100);
+
+  if(_last_cap_us && cap_us > _last_cap_us){
+    uint32_t ifi = (uint32_t)(cap_us - _last_cap_us);
+    if(ifi < _ifi_min_us) _ifi_min_us = ifi;
+    if(ifi > _ifi_max_us) _ifi_max_us = ifi;
+    _ifi_sum_us += ifi; _ifi_cnt++;
   }
+  _last_cap_us = cap_us;
+  _frm_in_1s++;
 
-  auto emit = [&](const uint8_t* payload, size_t paylen, bool marker_last)->bool {
-    uint8_t rtp[12];
-    rtp[0] = 0x80;                              // V=2,P=0,X=0,CC=0
-    rtp[1] = (uint8_t)((marker_last ? 0x80 : 0) | 26);
-    rtp[2] = (uint8_t)(_seq >> 8);
-    rtp[3] = (uint8_t)(_seq & 0xFF);
-    rtp[4] = (uint8_t)(_ts >> 24);
-    rtp[5] = (uint8_t)(_ts >> 16);
-    rtp[6] = (uint8_t)(_ts >> 8);
-    rtp[7] = (uint8_t)(_ts);
-    // SSRC: fixed or configurable
-    uint32_t ssrc = 0x13572468u;
-    rtp[8]  = (uint8_t)((ssrc >> 24) & 0xFF);
-    rtp[9]  = (uint8_t)((ssrc >> 16) & 0xFF);
-    rtp[10] = (uint8_t)((ssrc >> 8)  & 0xFF);
-    rtp[11] = (uint8_t)((ssrc      ) & 0xFF);
-
-    uint8_t buf[1600];
-    if (12 + paylen > sizeof(buf)) { _drop_in_1s++; return false; }
-    memcpy(buf, rtp, 12);
-    memcpy(buf+12, payload, paylen);
-
-    ssize_t n = sendto(_sock, (const char*)buf, 12 + paylen, 0, (sockaddr*)&_peer, sizeof(_peer));
-    if(n<0){ _drop_in_1s++; return false; }
-    _seq++; _pkt_in_1s++; return true;
+  uint32_t send_us = 0;
+  /* パケット化は 1 回。payload の直前の headroom に RTP ヘッダを宛先ごとに
+   * 上書きして送る（payload のコピーは packetize 内の 1 回だけ。スキャン片は
+   * 前のパケットの sendto 中に _copy が GDMA で先読みする）。
+   * 一部の宛先で失敗しても他へは送り続ける（全滅したときだけフレームを打ち切る） */
+  auto emit = [&](uint8_t* payload, size_t paylen, bool marker_last)->bool {
+    uint8_t* pkt = payload - rtpjpeg::RTP_HDR_LEN;
+    bool any = false;
+    for (uint8_t i = 0; i < _nDest; i++) {
+      Dest& d = _dest[i];
+      rtpjpeg::write_rtp_header(pkt, marker_last, RTP_PT_JPEG, d.seq, d.ts_base + _ts, d.ssrc);
+      int64_t t0 = Metrics::nowUs();
+      TRACE_BEGIN("sendto");
+      ssize_t n = sendto(_sock, (const char*)pkt, rtpjpeg::RTP_HDR_LEN + paylen, 0, (sockaddr*)&d.addr, sizeof(d.addr));
+      TRACE_END("sendto");
+      uint32_t dt = (uint32_t)(Metrics::nowUs() - t0);
+      Metrics::observe(Metrics::SEND_US, dt);
+      send_us += dt;
+      if(n<0){ _drop_in_1s++; Metrics::inc(Metrics::RTP_DROPS); continue; }
+      d.seq++; _pkt_in_1s++; Metrics::inc(Metrics::RTP_PKTS); any = true;
+    }
+    return any;
   };
 
   // OV2640 is typically 4:2:2 → Type=0
-  return rtpjpeg::packetize(jpg, len, w, h,
-                            rtpjpeg::JpegType::YUV422,
-                            /*type_specific=*/0,
-                            _ts, RTP_PAYLOAD_MTU, emit);
+  int64_t t0 = Metrics::nowUs();
+  TRACE_SCOPE("rtp.packetize");
+  bool ok;
+#if RTP_BATCH_SEND
+  if (_pcb) {
+    /* emit は溜めるだけ。packetize が面を使い切るかフレーム末尾で flush を呼ぶ */
+    _nBatch = 0;
+    auto hold = [&](uint8_t* payload, size_t paylen, bool marker_last)->bool {
+      if (_nBatch >= RTP_BATCH_PKTS) return false;
+      _batch[_nBatch++] = BatchPkt{ payload, (uint16_t)paylen, marker_last };
+      return true;
+    };
+    ok = rtpjpeg::packetize(jpg, len, w, h, rtpjpeg::JpegType::YUV422, /*type_specific=*/0,
+                            _ts, RTP_PAYLOAD_MTU, hold, _pool, &_copy,
+                            [&]{ return flushBatch(send_us); });
+    _nBatch = 0;
+  } else
+#endif
+  ok = rtpjpeg::packetize(jpg, len, w, h,
+                          rtpjpeg::JpegType::YUV422,
+                          /*type_specific=*/0,
+                          _ts, RTP_PAYLOAD_MTU, emit, _pool, &_copy);
+  // packetize 自体のコスト = 全体 - sendto 分
+  Metrics::observe(Metrics::PACKETIZE_US, (uint32_t)(Metrics::nowUs() - t0) - send_us);
+  if (ok) Metrics::inc(Metrics::RTP_FRAMES);
+  return ok;
+}
+
+#if RTP_BATCH_SEND
+/* 溜めたパケットを全宛先へ。lwIP コアには 1 回だけ入り、パケットごとのロック・
+ * ソケット層の往復を省く。pbuf は PBUF_REF（payload を参照するだけ。lwIP が
+ * キューに積む必要があれば自分で複製する）。宛先ごとに headroom の RTP ヘッダを
+ * 書き換えるのはソケット経路と同じ。一部の宛先で失敗しても他へは送る */
+bool UdpAgent::flushBatch(uint32_t& send_us){
+  if (!_nBatch) return true;
+  const uint8_t nPkt = _nBatch;
+  uint32_t sent = 0, drops = 0;
+  bool any = false;
+
+  int64_t t0 = Metrics::nowUs();
+  TRACE_BEGIN("udp_batch");
+  inLwipCore([&]{
+    udp_pcb* pcb = (udp_pcb*)_pcb;
+    for (uint8_t i = 0; i < _nDest; i++) {
+      Dest& d = _dest[i];
+      ip_addr_t dst = IPADDR4_INIT(d.addr.sin_addr.s_addr);
+      uint16_t port = ntohs(d.addr.sin_port);
+      for (uint8_t k = 0; k < nPkt; k++) {
+        const BatchPkt& b = _batch[k];
+        uint8_t* pkt = b.payload - rtpjpeg::RTP_HDR_LEN;
+        uint16_t n = (uint16_t)(rtpjpeg::RTP_HDR_LEN + b.len);
+        rtpjpeg::write_rtp_header(pkt, b.marker, RTP_PT_JPEG, d.seq, d.ts_base + _ts, d.ssrc);
+        pbuf* p = pbuf_alloc(PBUF_TRANSPORT, n, PBUF_REF);
+        if (!p) { drops++; continue; }
+        p->payload = pkt;
+        err_t e = udp_sendto(pcb, p, &dst, port);
+        pbuf_free(p);
+        if (e != ERR_OK) { drops++; continue; }
+        d.seq++; sent++; any = true;
+      }
+    }
+  });
+  TRACE_END("udp_batch");
+  uint32_t dt = (uint32_t)(Metrics::nowUs() - t0);
+  send_us += dt;
+
+  uint32_t tries = sent + drops;
+  if (tries) Metrics::observe(Metrics::SEND_US, dt / tries);   // パケットあたり（sendto 経路と比べられるように）
+  _pkt_in_1s += sent;  Metrics::inc(Metrics::RTP_PKTS, sent);
+  _drop_in_1s += drops; if (drops) Metrics::inc(Metrics::RTP_DROPS, drops);
+  _nBatch = 0;
+  return any;
+}
+#endif
+
+/* RTCP APP (RFC3550 6.7): V=2 subtype=0 PT=204 | SSRC | name(4) | data（4B 境界に 0 詰め）
+ * 宛先は RTP 宛先ポート+1（RTCP の慣例）。pkt は先頭 RTCP_APP_HDR バイトを空けて data を置いた
+ * RTCP_APP_HDR + RTCP_APP_MAX バイトのバッファ（ヘッダをその場で書くので写さない）。 */
+bool UdpAgent::sendRtcpApp(const char name[4], uint8_t* pkt, size_t len){
+  if(_sock<0) return false;
+  size_t padded = (len + 3) & ~size_t(3);
+  if(padded > RTCP_APP_MAX) {
+    LOGW("UDP","rtcp app %.4s %u B > %u, not sent", name, (unsigned)len, (unsigned)RTCP_APP_MAX);
+    return false;
+  }
+  size_t words = (RTCP_APP_HDR + padded) / 4 - 1;
+  pkt[0] = 0x80; pkt[1] = 204;
+  pkt[2] = (uint8_t)(words >> 8); pkt[3] = (uint8_t)words;
+  const uint32_t ssrc = _dest[0].ssrc;
+  pkt[4] = (uint8_t)(ssrc >> 24); pkt[5] = (uint8_t)(ssrc >> 16);
+  pkt[6] = (uint8_t)(ssrc >> 8);  pkt[7] = (uint8_t)ssrc;
+  memcpy(pkt + 8, name, 4);
+  memset(pkt + RTCP_APP_HDR + len, 0, padded - len);
+
+  sockaddr_in rtcp = _peer;
+  rtcp.sin_port = htons(ntohs(_peer.sin_port) + 1);
+  if(sendto(_sock, (const char*)pkt, RTCP_APP_HDR + padded, 0, (sockaddr*)&rtcp, sizeof(rtcp)) < 0) {
+    LOGW("UDP","rtcp app %.4s send failed errno=%d", name, errno);
+    return false;
+  }
+  return true;
+}
+
+void UdpAgent::tickMetrics(){
+#if METRICS_EXPORT_MS
+  if(_sock<0 || millis() - _t_last_metrics < METRICS_EXPORT_MS) return;
+  _t_last_metrics = millis();
+  Metrics::sampleSystem();
+  Metrics::set(Metrics::PKT_POOL_HWM, _pool.highWater());
+  Metrics::set(Metrics::PKT_POOL_FAILS, _pool.fails());   // プール側の累計をそのまま
+  uint8_t pkt[RTCP_APP_HDR + RTCP_APP_MAX];   // 全 ID が載る大きさ（足りなければ末尾の ID から省かれる）
+  size_t n = Metrics::encode(pkt + RTCP_APP_HDR, RTCP_APP_MAX);
+  if(n) sendRtcpApp("WXMT", pkt, n);
+#endif
+}
+
+/* Trace のダンプを RTP 宛先 IP の TRACE_UDP_PORT へ。行単位で ~1400B に詰めて送る。
+ * 受信: src/trace_tools/trace2chrome.py --udp TRACE_UDP_PORT */
+void UdpAgent::sendTrace(){
+  if(_sock<0) return;
+  sockaddr_in dst = _peer;
+  dst.sin_port = htons(TRACE_UDP_PORT);
+  char   buf[1400];
+  size_t n = 0;
+  auto flush = [&]{
+    if(n) sendto(_sock, buf, n, 0, (sockaddr*)&dst, sizeof(dst));
+    n = 0;
+    vTaskDelay(1);                       // 受信側/AP のバッファを溢れさせない
+  };
+  Trace::dump([&](const char* line, size_t len){
+    if(n + len > sizeof(buf)) flush();
+    memcpy(buf + n, line, len); n += len;
+  });
+  flush();
+  LOGI("TRACE","dumped to UDP :%u", (unsigned)TRACE_UDP_PORT);
+}
+
+void UdpAgent::noteCapture(){
+  _cap_in_1s++;
 }
 
 void UdpAgent::tick1sReport(){
-  if(millis() - _t_last_report >= 1000){
-    LOGI("RTP","fps~%u, pkt=%u, drop=%u",
-         (unsigned)CAM_FPS, (unsigned)_pkt_in_1s, (unsigned)_drop_in_1s);
+  uint32_t el = millis() - _t_last_report;
+  if(el >= 1000){
+    // fps は 0.1 単位、フレーム間隔は送出フレームの撮像時刻差 [ms]
+    uint32_t cap10  = _cap_in_1s * 10000u / el;
+    uint32_t send10 = _frm_in_1s * 10000u / el;
+    uint32_t ifiAvg = _ifi_cnt ? (uint32_t)(_ifi_sum_us / _ifi_cnt) : 0;
+    uint32_t ifiMin = _ifi_cnt ? _ifi_min_us : 0;
+    // スキャン片コピーのうち GDMA に乗った割合 [%]
+    uint32_t dmaB = _copy.dmaBytes() - _copyDma0, cpuB = _copy.cpuBytes() - _copyCpu0;
+    uint32_t dmaPct = (dmaB + cpuB) ? (uint32_t)((uint64_t)dmaB * 100 / (dmaB + cpuB)) : 0;
+    _copyDma0 = _copy.dmaBytes(); _copyCpu0 = _copy.cpuBytes();
+    LOGI("RTP","cap=%u.%u fps, send=%u.%u fps, ifi avg/min/max=%u.%u/%u.%u/%u.%u ms, pkt=%u, drop=%u, dma=%u%%",
+         (unsigned)(cap10/10), (unsigned)(cap10%10),
+         (unsigned)(send10/10), (unsigned)(send10%10),
+         (unsigned)(ifiAvg/1000), (unsigned)(ifiAvg%1000/100),
+         (unsigned)(ifiMin/1000), (unsigned)(ifiMin%1000/100),
+         (unsigned)(_ifi_max_us/1000), (unsigned)(_ifi_max_us%1000/100),
+         (unsigned)_pkt_in_1s, (unsigned)_drop_in_1s, (unsigned)dmaPct);
     _pkt_in_1s=_drop_in_1s=0;
+    _cap_in_1s=_frm_in_1s=0;
+    _ifi_min_us=UINT32_MAX; _ifi_max_us=0; _ifi_sum_us=0; _ifi_cnt=0;
     _t_last_report = millis();
   }
 }
@@ -3,37 +3,96 @@
 #include <lwip/sockets.h>
 #include <netinet/in.h>
 #include "config.h"
+#include "AsyncCopy.h"
+#include "PacketPool.h"
 
 class UdpAgent {
 public:
   enum class Mode { RAW_JPEG_DATAGRAM, RTP_JPEG };
 
+  /* extra: 追加の宛先（RTP_EXTRA_DESTS の書式、nullptr で無し）
+   * local_port: 送信元ポートを固定するとき（RTSP の server_port）。0 なら任意。
+   *             固定したときは RTP_BATCH_SEND でもソケットから 1 パケットずつ送る */
   bool begin(const char* dst_ip, uint16_t dst_port,
-             Mode mode = Mode::RTP_JPEG);
+             Mode mode = Mode::RTP_JPEG,
+             const char* extra = RTP_EXTRA_DESTS, uint16_t local_port = 0);
   bool ready() const { return _sock >= 0; }
 
+  /* 宛先セット: 1 回パケット化したものを各宛先へ sendto する。
+   * 宛先ごとに SSRC / シーケンス番号 / RTP TS の初期値を持つので、途中で
+   * 加わった受信側も独立した RTP ストリームとして受けられる。
+   * begin() の宛先が 0 番（RTCP・トレースの送り先）。マルチキャストアドレスは
+   * RTP_MCAST_TTL（setMulticastTtl）で送る。 */
+  int    addDest(const char* ip, uint16_t port);   // 戻り値: 宛先番号 / -1
+  bool   removeDest(const char* ip, uint16_t port);
+  size_t destCount() const { return _nDest; }
+  void   setMulticastTtl(uint8_t ttl);
+
   // 旧来互換（RAW用）
   bool sendFrame(const uint8_t* jpg, size_t len, uint32_t backoffMs=0);
 
   // RTP/JPEG（RFC2435）
+  // cap_us: 撮像時刻（esp_timer 基準 µs）。0 なら送出時刻で代用。
   bool sendRtpJpegFrame(const uint8_t* jpg, size_t len,
                         uint16_t w, uint16_t h,
+                        uint64_t cap_us = 0,
                         uint32_t backoffMs=0);
 
   // 統計
+  void noteCapture(); // 撮像ごと（送らなかったフレームも含む）
   void tick1sReport(); // 1秒毎にログ出力
+  void tickMetrics();  // METRICS_EXPORT_MS 毎に RTCP APP で Metrics を送出
+
+  /* パケットバッファ。packetize のほか送出待ち・再送履歴もここから取る */
+  PacketPool& packetPool()  { return _pool; }
+  PacketPool& historyPool() { return _hist; }
+  void sendTrace();    // Trace リングを宛先 IP:TRACE_UDP_PORT へダンプ
 
 private:
+  struct Dest {
+    sockaddr_in addr{};
+    uint32_t    ssrc    = 0;
+    uint16_t    seq     = 1;
+    uint32_t    ts_base = 0;      // 90kHz 時計のランダム初期オフセット
+  };
+
   int         _sock = -1;
-  sockaddr_in _peer{};
+  sockaddr_in _peer{};            // = _dest[0].addr
   Mode        _mode = Mode::RTP_JPEG;
+  Dest        _dest[RTP_MAX_DESTS];
+  uint8_t     _nDest = 0;
+  uint8_t     _mcastTtl = RTP_MCAST_TTL;
+  /* まとめ送り（RTP_BATCH_SEND）: packetize が組んだパケットを溜め、flush で
+   * lwIP のコアロックを 1 回だけ取って raw API（udp_sendto）で全宛先へ出す */
+  struct BatchPkt { uint8_t* payload; uint16_t len; bool marker; };
+  BatchPkt    _batch[RTP_BATCH_PKTS];
+  uint8_t     _nBatch = 0;
+  void*       _pcb = nullptr;     // struct udp_pcb*（RTP 専用。RTCP 等はソケット側）
+  bool        flushBatch(uint32_t& send_us);
+
+  AsyncCopy   _copy;              // packetize のスキャン片先読み（GDMA）
+  PacketPool  _pool;              // 送出用パケットバッファ（DMA 可能な内部 RAM）
+  PacketPool  _hist;              // 再送履歴用（PSRAM、RTP_HIST_PKTS > 0 のとき）
+  uint32_t    _copyDma0 = 0, _copyCpu0 = 0;   // 1 秒レポート用の前回値
 
   // RTP state
-  uint16_t _seq = 1;
-  uint32_t _ts  = 0;
+  uint32_t _ts  = 0;              // 現フレームの 90kHz 時刻（宛先ごとの初期値は送出時に足す）
   uint32_t _pkt_in_1s = 0;
   uint32_t _drop_in_1s = 0;
   uint32_t _t_last_report = 0;
 
-  bool sendRtpPacket(const uint8_t* payload, size_t payload_len, bool marker);
+  // 実測フレームレート（撮像時刻ベース）
+  uint32_t _cap_in_1s = 0;
+  uint32_t _frm_in_1s = 0;
+  uint64_t _last_cap_us  = 0;     // 直前に送ったフレームの撮像時刻
+  uint32_t _ifi_min_us = UINT32_MAX, _ifi_max_us = 0;
+  uint64_t _ifi_sum_us = 0;
+  uint32_t _ifi_cnt    = 0;
+
+  uint32_t _t_last_metrics = 0;
+  static constexpr size_t RTCP_APP_HDR = 12;     // V/PT/length + SSRC + name
+  static constexpr size_t RTCP_APP_MAX = 1024;   // APP data の上限（Metrics の全 ID が載る）
+
+  void addExtraDests(const char* list);
+  bool sendRtcpApp(const char name[4], uint8_t* pkt, size_t len);
 };
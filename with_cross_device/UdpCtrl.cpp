@@ -0,0 +1,134 @@
+#include "UdpCtrl.h"
+#include "NetDebug.h"
+#include "Hardware.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include <esp_timer.h>
+
+using namespace ctrlproto;
+
+static inline uint32_t nowUs32(){ return (uint32_t)esp_timer_get_time(); }
+
+bool UdpCtrl::begin(const char* ip, uint16_t port){
+  if (!_mtx) _mtx = xSemaphoreCreateMutex();
+  xSemaphoreTake(_mtx, portMAX_DELAY);
+  if (_sock >= 0) { close(_sock); _sock = -1; }
+
+  int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (s < 0) { xSemaphoreGive(_mtx); LOGE("CTRL","udp socket failed"); return false; }
+  sockaddr_in local{};
+  local.sin_family = AF_INET;
+  local.sin_port = htons(port);
+  local.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(s, (sockaddr*)&local, sizeof(local)) < 0) {
+    close(s);
+    xSemaphoreGive(_mtx);
+    LOGE("CTRL","udp bind %u failed", (unsigned)port);
+    return false;
+  }
+  int fl = fcntl(s, F_GETFL, 0);
+  fcntl(s, F_SETFL, fl | O_NONBLOCK);
+
+  _peer = {};
+  _peer.sin_family = AF_INET;
+  _peer.sin_port = htons(port);
+  _peer.sin_addr.s_addr = inet_addr(ip);
+
+  _cp.begin([this](const uint8_t* d, size_t n){
+              sendto(_sock, (const char*)d, n, 0, (sockaddr*)&_peer, sizeof(_peer));
+            },
+            CTRL_UDP_RTO_MS * 1000, CTRL_UDP_MAX_TRIES, _nonce = esp_random());
+  _sock  = s;
+  sendHello(true);
+  xSemaphoreGive(_mtx);
+  LOGI("CTRL","udp ctrl %s:%u", ip, (unsigned)port);
+  return true;
+}
+
+void UdpCtrl::sendHello(bool reliable){
+  uint8_t b[4] = { uint8_t(_nonce >> 24), uint8_t(_nonce >> 16), uint8_t(_nonce >> 8), uint8_t(_nonce) };
+  _cp.send(Type::HELLO, b, 4, nowUs32(), reliable);
+  _tHello = millis();
+}
+
+bool UdpCtrl::sendMode(uint16_t v){
+  if (_sock < 0) return false;
+  xSemaphoreTake(_mtx, portMAX_DELAY);
+  bool ok = _cp.sendU16(Type::MODE, v, nowUs32());
+  xSemaphoreGive(_mtx);
+  return ok;
+}
+
+bool UdpCtrl::sendButton(uint8_t act, int64_t press_us, uint16_t event){
+  if (_sock < 0) return false;
+  uint32_t p = (uint32_t)press_us;
+  uint8_t b[7] = { act, uint8_t(p >> 24), uint8_t(p >> 16), uint8_t(p >> 8), uint8_t(p),
+                   uint8_t(event >> 8), uint8_t(event) };
+  xSemaphoreTake(_mtx, portMAX_DELAY);
+  bool ok = _cp.send(Type::BUTTON, b, sizeof(b), nowUs32());
+  xSemaphoreGive(_mtx);
+  return ok;
+}
+
+void UdpCtrl::onMsg(const Msg& m, int64_t rxUs){
+  switch (m.type) {
+    case Type::MOTOR: {
+      /* 再送で古い指令が新しい指令の後に届くことがある（ON の再送が OFF を追い越す）。
+       * モータは状態なので新しい seq だけ適用する（ACK は CtrlPeer が返し済み） */
+      if (m.epoch != _motorEpoch) { _motorEpoch = m.epoch; _motorSeen = false; }   // 対向の再起動
+      if (_motorSeen && (int16_t)(m.seq - _motorSeq) <= 0) {
+        LOGD("CTRL","udp motor seq=%u stale (last %u), ignored", m.seq, _motorSeq);
+        break;
+      }
+      _motorSeq  = m.seq;
+      _motorSeen = true;
+      uint16_t v = m.u16();
+      if      (v == 0x0001) setMotor(true);
+      else if (v == 0x0000) setMotor(false);
+      uint32_t dt = rxUs ? (uint32_t)(esp_timer_get_time() - rxUs) : 0;
+      TRACE_INSTANT("ctrl.udp", v);
+      Metrics::inc(Metrics::CTRL_CMDS);
+      Metrics::observe(Metrics::CTRL_TO_MOTOR_US, dt);
+      LOGI("CTRL","udp motor=0x%04X seq=%u (%u us)", v, m.seq, (unsigned)dt);
+    } break;
+    case Type::HELLO:
+      break;
+    default:
+      LOGD("CTRL","udp type=%u ignored", (unsigned)m.type);
+      break;
+  }
+}
+
+void UdpCtrl::service(int64_t rxUs){
+  if (_sock < 0) return;
+  xSemaphoreTake(_mtx, portMAX_DELAY);
+  uint8_t buf[64];
+  sockaddr_in from{}; socklen_t fl = sizeof(from);
+  for (;;) {
+    ssize_t n = recvfrom(_sock, (char*)buf, sizeof(buf), 0, (sockaddr*)&from, &fl);
+    if (n <= 0) break;
+    if (from.sin_addr.s_addr != _peer.sin_addr.s_addr) continue;
+    Msg m;
+    if (_cp.onDatagram(buf, (size_t)n, nowUs32(), m)) onMsg(m, rxUs);
+  }
+  _cp.tick(nowUs32());
+  if (millis() - _tHello >= CTRL_UDP_HELLO_MS) sendHello(false);   // keepalive（アドレス学習用）
+
+  const auto& st = _cp.stats();
+  if (st.retransmits != _last.retransmits) Metrics::inc(Metrics::CTRL_RETX, st.retransmits - _last.retransmits);
+  if (st.acked != _last.acked) Metrics::observe(Metrics::CTRL_RTT_US, st.rtt_last_us);
+  if (st.gave_up != _last.gave_up) LOGW("CTRL","udp gave up %u msgs", (unsigned)(st.gave_up - _last.gave_up));
+  _last = st;
+  xSemaphoreGive(_mtx);
+}
+
+uint32_t UdpCtrl::nextDeadlineMs(){
+  if (_sock < 0) return UINT32_MAX;
+  xSemaphoreTake(_mtx, portMAX_DELAY);
+  uint32_t us = _cp.nextDeadlineUs(nowUs32());
+  xSemaphoreGive(_mtx);
+  uint32_t el = millis() - _tHello;
+  uint32_t hello = el >= CTRL_UDP_HELLO_MS ? 0 : CTRL_UDP_HELLO_MS - el;
+  uint32_t ms = (us == UINT32_MAX) ? UINT32_MAX : (us + 999) / 1000;
+  return ms < hello ? ms : hello;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <Arduino.h>
+#include <lwip/sockets.h>
+#include <netinet/in.h>
+#include "config.h"
+#include "CtrlProto.h"
+
+/**
+ * UdpCtrl : UDP 制御チャネル（CtrlProto）の端末側
+ *  - 受信・再送は ctrlTask が service() で回す（fd() を select 待ち）
+ *  - 送信（モード / ボタン）はどのタスクからでも可。mutex 内で即 sendto する
+ *  - 宛先は RTP と同じ IP の CTRL_UDP_PORT。ローカルも同じポートで bind
+ */
+class UdpCtrl {
+public:
+  bool begin(const char* dst_ip, uint16_t port = CTRL_UDP_PORT);
+  bool ready() const { return _sock >= 0; }
+  int  fd()    const { return _sock; }
+
+  bool sendMode(uint16_t v);
+  bool sendButton(uint8_t act, int64_t press_us, uint16_t event);   // event: FetchServer EVENT で引く番号
+
+  void     service(int64_t rxUs);            // rxUs: select が受信を検出した時刻（0=なし）
+  uint32_t nextDeadlineMs();                 // 次の再送 / HELLO まで
+
+private:
+  int               _sock = -1;
+  sockaddr_in       _peer{};
+  SemaphoreHandle_t _mtx = nullptr;
+  ctrlproto::CtrlPeer _cp;
+  uint32_t          _nonce = 0;
+  uint32_t          _tHello = 0;
+  ctrlproto::CtrlPeer::Stats _last;          // Metrics へ差分で積むため
+  uint16_t          _motorSeq  = 0;          // 最後に適用した MOTOR の seq（古い再送を捨てる）
+  bool              _motorSeen = false;
+  uint32_t          _motorEpoch = 0;         // 対向の epoch（変わったら _motorSeq を忘れる）
+
+  void onMsg(const ctrlproto::Msg& m, int64_t rxUs);
+  void sendHello(bool reliable);
+};
@@ -1,9 +1,15 @@
 #include "WsAgent.h"
 #include "NetDebug.h"
 #include "Hardware.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "rtp_jpeg.h"
+#include <lwip/sockets.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <esp_heap_caps.h>
 
 static WsAgent* gSelf = nullptr;
-static bool motorState = false;
 
 void wsCb(WStype_t t, uint8_t* p, size_t l)
 {
@@ -11,17 +17,23 @@ void wsCb(WStype_t t, uint8_t* p, size_t l)
     switch (t) {
         case WStype_CONNECTED:
             LOGI("WS", "CONNECTED");
-            gSelf->_busy = false; 
-            gSelf->_connecting = false;
+            gSelf->_evUp = true;
+            gSelf->resetCredit();
+#if WS_MUX
+            gSelf->_stream.setNoDelay();
+#else
             gSelf->start(gSelf->_host.c_str(), gSelf->_port);
+#endif
             break;
 
         case WStype_DISCONNECTED:
         case WStype_ERROR:
             LOGW("WS", "DISC/ERR, code=%u", (l >= 2) ? ((p[0] << 8) | p[1]) : 0);
-            gSelf->_busy = false;  
-            gSelf->_connecting = false;
-            gSelf->_needReconnect = true;
+            gSelf->_evDown = true;
+            break;
+
+        case WStype_BIN:                     // /stream のサーバ→端末は CREDIT / CAPS / LOSS
+            gSelf->onStreamRx(p, l);
             break;
 
         default:
@@ -29,94 +41,645 @@ void wsCb(WStype_t t, uint8_t* p, size_t l)
     }
 }
 
-void ctrlCb(WStype_t t, uint8_t* p, size_t l)
+/* /control 受信（ctrlTask 上で実行）
+ *   cmd(2)            : 0x0001=ON / 0x0000=OFF（従来）
+ *   cmd(2) token(4)   : 同上 + 応答 ACK を返す
+ *     ACK = 0xAC 0x4B | cmd(2) | token(4) | rx→モータ駆動 µs(4)  （big-endian）
+ *   サーバは token で往復時間を測り、端末内の遅延は ACK の末尾で分かる。
+ * 端末→サーバにはもう一つ BUTTON = 0xAC 0x42 | act(1) | press_us(4) | event(2) がある
+ *   （CtrlProto の BUTTON と同じ中身。event は FetchServer の EVENT で引く番号） */
+void WsAgent::onCtrl(const uint8_t* p, size_t l)
 {
-    if (t != WStype_BIN || l < 2) return;
+    if (l < 2) return;
     uint16_t cmd = (uint16_t(p[0]) << 8) | uint16_t(p[1]);
-    if(cmd==0x0001 && !motorState){  
-        motorState = true;
-        digitalWrite(PIN_MOTOR, HIGH);
-        LOGI("CTRL","Motor ON");
-    }
-    else if(cmd==0x0000 && motorState){
-        motorState = false;
-        digitalWrite(PIN_MOTOR, LOW);
-        LOGI("CTRL","Motor OFF");
+    if      (cmd==0x0001) setMotor(true);
+    else if (cmd==0x0000) setMotor(false);
+    uint32_t dt = _ctrlRxUs ? (uint32_t)(esp_timer_get_time() - _ctrlRxUs) : 0;
+    TRACE_INSTANT("ctrl.cmd", cmd);
+    Metrics::inc(Metrics::CTRL_CMDS);
+    Metrics::observe(Metrics::CTRL_TO_MOTOR_US, dt);
+
+    if (l >= 6) {
+        uint8_t a[12] = { 0xAC, 0x4B, p[0], p[1], p[2], p[3], p[4], p[5],
+                          uint8_t(dt >> 24), uint8_t(dt >> 16), uint8_t(dt >> 8), uint8_t(dt) };
+        sendCtrlRaw(a, sizeof(a));
     }
+    LOGI("CTRL","Motor cmd=0x%04X (%u us)", cmd, (unsigned)dt);
 }
 
-bool WsAgent::begin(const char* host, uint16_t port)
+void WsAgent::sendCtrlRaw(uint8_t* b, size_t l)
 {
-    if (_busy || _connecting || _stream.isConnected()) {
-        // LOGD("WS","begin() skipped – busy/connected");
-        return false;
+#if WS_MUX
+    sendMux(MUX_CTRL, b, l);
+#else
+    _ctrl.sendBIN(b, l);
+#endif
+}
+
+void ctrlCb(WStype_t t, uint8_t* p, size_t l)
+{
+    if (!gSelf) return;
+    switch (t) {
+        case WStype_CONNECTED:    gSelf->_ctrl.setNoDelay(); break;
+        case WStype_DISCONNECTED:
+        case WStype_ERROR:        gSelf->onAuxDown(gSelf->_ctrlAux); break;
+        case WStype_BIN:          gSelf->onCtrl(p, l); break;
+        default: break;
     }
+}
 
-    if (millis() - _lastTry < 5000) return false;  // クールダウン
-    _lastTry = millis();
-    _busy    = true;
-    _connecting = true;
+void modeCb(WStype_t t, uint8_t* p, size_t l)
+{
+    (void)p; (void)l;
+    if (!gSelf) return;
+    if (t == WStype_DISCONNECTED || t == WStype_ERROR) gSelf->onAuxDown(gSelf->_modeAux);
+}
 
+#if WS_MUX
+/* 多重化コネクションのイベント（ctrlTask 上、_muxLock 保持中） */
+void muxCb(WStype_t t, uint8_t* p, size_t l)
+{
+    if (t != WStype_BIN) { wsCb(t, p, l); return; }
+    if (!gSelf || l < 2) return;
+    if      (p[0] == MUX_CTRL)   gSelf->onCtrl(p + 2, l - 2);
+    else if (p[0] == MUX_STREAM) gSelf->onStreamRx(p + 2, l - 2);
+    // MUX_MODE はサーバ→端末の用途なし
+}
+
+void WsAgent::lock()   { xSemaphoreTakeRecursive(_muxLock, portMAX_DELAY); }
+void WsAgent::unlock() { xSemaphoreGiveRecursive(_muxLock); }
+
+bool WsAgent::sendMux(uint8_t chan, const uint8_t* p, size_t l)
+{
+    uint8_t b[WEBSOCKETS_MAX_HEADER_SIZE + 2 + 16];
+    if (l > 16) return false;
+    uint8_t* h = b + WEBSOCKETS_MAX_HEADER_SIZE;
+    h[0] = chan; h[1] = 0;
+    memcpy(h + 2, p, l);
+    lock();
+    bool ok = _stream.isConnected() && _stream.sendBIN(b, 2 + l, true);
+    unlock();
+    return ok;
+}
+#endif
+
+/* ===== 接続管理（netcamTask）=============================================
+ * IDLE → BACKOFF →(期限)→ PROBING: 非ブロッキング connect を select(0) で確認
+ *      → HANDSHAKE: 到達を確認してから WebSocketsClient を begin（connect は即座に返る）
+ *      → UP。失敗・切断は BACKOFF に戻る。
+ * 待ち時間は WS_BACKOFF_MIN_MS からの指数（上限 WS_BACKOFF_MAX_MS）の半分 + 一様乱数。
+ * ライブラリは HANDSHAKE / UP の間しか loop() しないので、サーバ不在時に
+ * ブロッキング connect を繰り返すこともない。/mode・/control の切断も _evDown に集めて
+ * ここから張り直す（それぞれのライブラリの自動再接続は loopAux が使わせない）。 */
+bool WsAgent::begin(const char* host, uint16_t port)
+{
+    if (_conn != Conn::IDLE) return false;   // 以後の再試行は loop() が行う
+    _host = host;  _port = port;
+    gSelf = this;
+#if WS_MUX
+    if (!_muxLock) _muxLock = xSemaphoreCreateRecursiveMutex();
+#endif
     LOGI("WS","host=%s port=%u", host, port);
+    _tDown    = millis();
+    _attempts = 0;
+    _nextTry  = millis();
+    _conn     = Conn::BACKOFF;
+    return true;
+}
 
-    WiFiClient probe;
-    if (!probe.connect(host, port, 1000)) {
-        LOGE("WS","TCP port unreachable");
-        _needReconnect = true;
-        _busy = false; _connecting = false;
+bool WsAgent::startProbe()
+{
+    sockaddr_in sa{};
+    sa.sin_family = AF_INET;
+    sa.sin_port   = htons(_port);
+    if (inet_pton(AF_INET, _host.c_str(), &sa.sin_addr) != 1) {
+        IPAddress ip;                        // ホスト名指定時のみ。DNS 解決はブロッキング
+        if (!WiFi.hostByName(_host.c_str(), ip)) return false;
+        sa.sin_addr.s_addr = (uint32_t)ip;
+    }
+    _probe = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (_probe < 0) return false;
+    fcntl(_probe, F_SETFL, fcntl(_probe, F_GETFL, 0) | O_NONBLOCK);
+    if (connect(_probe, (sockaddr*)&sa, sizeof(sa)) < 0 && errno != EINPROGRESS) {
+        closeProbe();
         return false;
     }
-    probe.stop();
+    _tConn = millis();
+    _conn  = Conn::PROBING;
+    return true;
+}
 
-    if (_stream.isConnected()) _stream.disconnect();
+/* 1=接続できた / 0=まだ / -1=拒否など */
+int WsAgent::checkProbe()
+{
+    fd_set wr; FD_ZERO(&wr); FD_SET(_probe, &wr);
+    timeval tv{0, 0};
+    int r = select(_probe + 1, nullptr, &wr, nullptr, &tv);
+    if (r <= 0) return r;
+    int err = 0; socklen_t el = sizeof(err);
+    getsockopt(_probe, SOL_SOCKET, SO_ERROR, &err, &el);
+    return err ? -1 : 1;
+}
 
-    _host = host;  _port = port;
-    gSelf = this;
+void WsAgent::closeProbe()
+{
+    if (_probe >= 0) { close(_probe); _probe = -1; }
+}
 
+void WsAgent::startClient()
+{
+    _libActive = true;
+#if WS_MUX
+    lock();
+    _stream.onEvent(muxCb);
+    _stream.begin(_host.c_str(), _port, WS_MUX_PATH);
+    _stream.setReconnectInterval(WS_HANDSHAKE_TIMEOUT_MS);   // HANDSHAKE 中の再 connect は 1 回まで
+    unlock();
+#else
     _stream.onEvent(wsCb);
-    _stream.begin(host, port, "/stream");
-    _stream.setReconnectInterval(3000);
-    return true;
+    _stream.begin(_host.c_str(), _port, "/stream");
+    _stream.setReconnectInterval(WS_HANDSHAKE_TIMEOUT_MS);
+#endif
+}
+
+void WsAgent::stopClient()
+{
+    _libActive = false;
+#if WS_MUX
+    lock(); _stream.disconnect(); unlock();
+#else
+    _stream.disconnect();
+    _modeAux = Aux{};                    // 閉じるのはこちらの都合（_evDown にしない）
+    _mode.disconnect();
+    _ctrlStopGen = ++_ctrlReqGen;        // /control は ctrlTask 側で閉じる
+#endif
+    _evUp = false;
+    _evDown = false;
 }
 
+void WsAgent::retry(const char* why)
+{
+    closeProbe();
+    uint32_t d = (uint32_t)WS_BACKOFF_MIN_MS << (_attempts < 16 ? _attempts : 16);
+    if (d > WS_BACKOFF_MAX_MS || d < WS_BACKOFF_MIN_MS) d = WS_BACKOFF_MAX_MS;
+    d = d / 2 + esp_random() % (d / 2 + 1);     // jitter（一斉に再起動した端末を散らす）
+    _attempts++;
+    _nextTry = millis() + d;
+    _conn    = Conn::BACKOFF;
+    LOGW("WS","%s – retry in %u ms (#%u)", why, (unsigned)d, (unsigned)_attempts);
+}
+
+void WsAgent::tickConn()
+{
+    uint32_t now = millis();
+    bool up = _evUp.exchange(false), down = _evDown.exchange(false);
+
+    switch (_conn) {
+    case Conn::IDLE:
+        break;
+
+    case Conn::BACKOFF:
+        if ((int32_t)(now - _nextTry) < 0) break;
+        if (_attempts) Metrics::inc(Metrics::WS_RECONNECTS);
+        if (!startProbe()) retry("socket");
+        break;
+
+    case Conn::PROBING: {
+        int r = checkProbe();
+        if (r > 0) {
+            closeProbe();
+            startClient();
+            _tConn = now;
+            _conn  = Conn::HANDSHAKE;
+        } else if (r < 0) {
+            retry("TCP port unreachable");
+        } else if (now - _tConn > WS_CONNECT_TIMEOUT_MS) {
+            retry("connect timeout");
+        }
+    } break;
+
+    case Conn::HANDSHAKE:
+        if (down || now - _tConn > WS_HANDSHAKE_TIMEOUT_MS) {
+            stopClient();
+            retry("handshake failed");
+        } else if (up) {
+            Metrics::observe(Metrics::WS_RECONNECT_MS, now - _tDown);
+            LOGI("WS","up after %u ms, %u attempt(s)", (unsigned)(now - _tDown), (unsigned)_attempts + 1);
+            _attempts = 0;
+            _conn = Conn::UP;
+        }
+        break;
+
+    case Conn::UP:
+        if (_offerState == 1 && !txPending()) sendOffer();
+        if (down) {
+            _tDown = now;
+            stopClient();
+            retry("disconnected");
+        }
+        break;
+    }
+}
 
 void WsAgent::start(const char* host, uint16_t port)
 {
-    _ctrl.begin(host, port, "/control");
-    _ctrl.onEvent(ctrlCb);
+    _ctrlStartGen = ++_ctrlReqGen;       // /control の begin は ctrlTask 側で
+    _mode.onEvent(modeCb);
     _mode.begin(host, port, "/mode");
+    _mode.setReconnectInterval(0);       // 最初の connect を待たせない（再接続は loopAux が止める）
+    _modeAux.armed = true;
+}
+
+/* 張り直しは /stream と同じ BACKOFF → PROBING に任せる（ライブラリの loop() は
+ * 未接続だとブロッキング connect で再接続するので、TCP が生きている間しか回さない） */
+void WsAgent::loopAux(WsClient& c, Aux& a)
+{
+    if (a.armed) {                       // begin 直後の 1 回（到達は /stream の PROBING で確認済み）
+        a.armed = false;
+        c.loop();
+        a.live = c.fd() >= 0;
+        if (!a.live) _evDown = true;
+        return;
+    }
+    if (!a.live) return;
+    if (c.fd() < 0) { onAuxDown(a); return; }   // ハンドシェイク失敗はイベントが来ない
+    c.loop();
+}
+
+void WsAgent::onAuxDown(Aux& a)
+{
+    if (!a.live) return;
+    a.live = false;
+    _evDown = true;
 }
 
 void WsAgent::loop()
 {
-    _stream.loop(); _ctrl.loop(); _mode.loop();
+#if !WS_MUX
+    // 送出途中は _stream を回さない（ping への pong 等が書きかけのフレームに混ざるため）
+    if (_libActive) {
+        if (!txPending()) _stream.loop();
+        loopAux(_mode, _modeAux);
+    }
+#endif                                   // WS_MUX: 受信・接続処理は ctrlTask（serviceCtrl）
+    tickConn();
+}
 
-    if (_needReconnect && !_connecting && (millis() - _lastTry) > 5000) {
-        _needReconnect = false;
-        begin(_host.c_str(), _port);      // ガード付き再試行
+size_t WsAgent::fds(int* out, size_t max){
+    size_t n = 0;
+#if WS_MUX
+    (void)out; (void)max;                // 多重化時は ctrlTask 側で待つ
+    return n;
+#endif
+    for (WsClient* c : { &_stream, &_mode }) {          // _ctrl は ctrlTask 側で待つ
+        int fd = c->fd();
+        if (fd >= 0 && n < max) out[n++] = fd;
     }
+    return n;
 }
 
 void WsAgent::sendMode(uint16_t v){
     uint8_t b[2]={uint8_t(v>>8),uint8_t(v)};
     LOGD("WS","sendMode=0x%04X", v);                      /// LOG
+#if WS_MUX
+    sendMux(MUX_MODE, b, 2);
+#else
     _mode.sendBIN(b,2);
+#endif
 }
 
 void WsAgent::sendMotor(uint16_t v){
-    uint8_t b[2]={uint8_t(v>>8),uint8_t(v)};
     LOGD("WS","sendMotor=0x%04X", v);                     /// LOG
-    _ctrl.sendBIN(b,2);
+    CtrlTx m{2, {uint8_t(v >> 8), uint8_t(v)}};
+    if (_ctrlTxQ) xQueueSend(_ctrlTxQ, &m, 0);
+}
+
+void WsAgent::sendButton(uint8_t act, int64_t press_us, uint16_t event){
+    uint32_t p = (uint32_t)press_us;
+    CtrlTx m{9, {0xAC, 0x42, act, uint8_t(p >> 24), uint8_t(p >> 16), uint8_t(p >> 8), uint8_t(p),
+                 uint8_t(event >> 8), uint8_t(event)}};
+    if (_ctrlTxQ) xQueueSend(_ctrlTxQ, &m, 0);
 }
 
-bool WsAgent::sendFrame(const uint8_t* buf, size_t len, uint32_t backoffMs)
+/* ===== /control 専用の受信処理 ==========================================
+ * 映像送出（netcamTask）の sendBIN/sendto に引きずられないよう、ctrlTask が
+ * ctrlFd() を select 待ちし、届いたらすぐここで _ctrl.loop() → モータ駆動。 */
+int WsAgent::ctrlFd()
 {
-    if(!_stream.isConnected()) return false;
+#if WS_MUX
+    if (!_muxLock) return -1;
+    lock();
+    int fd = _stream.fd();
+    unlock();
+    return fd;
+#else
+    return _ctrl.fd();
+#endif
+}
 
-    if(!_stream.sendBIN(buf, len)){        // キュー満杯
-        LOGW("WS","queue full – drop");
-        _nextOkAfter = millis() + backoffMs;   // 50〜100 ms など
-        return false;
+void WsAgent::serviceCtrl(int64_t rxUs)
+{
+    if (!_ctrlTxQ) _ctrlTxQ = xQueueCreate(8, sizeof(CtrlTx));
+    _ctrlRxUs = rxUs;
+#if WS_MUX
+    if (_muxLock && _libActive) { lock(); _stream.loop(); unlock(); }
+#else
+    /* 停止より前の開始要求だけを捨てる（停止 → 開始の順なら閉じてから張り直す） */
+    uint32_t stopG = _ctrlStopGen, startG = _ctrlStartGen;
+    bool stopped = false;
+    if (stopG != _ctrlStopDone) {
+        _ctrlStopDone = stopG;
+        _ctrlAux = Aux{};                // 要求した切断（_evDown にしない）
+        _ctrl.disconnect();
+        stopped = true;
     }
+    if ((int32_t)(startG - stopG) > 0 && (startG != _ctrlStartDone || stopped)) {
+        _ctrlStartDone = startG;
+        gSelf = this;
+        _ctrl.onEvent(ctrlCb);
+        _ctrl.begin(_host.c_str(), _port, "/control");
+        _ctrl.setReconnectInterval(0);
+        _ctrlAux.armed = true;
+    }
+    if (_libActive) loopAux(_ctrl, _ctrlAux);
+#endif
+    _ctrlRxUs = 0;
+
+    CtrlTx m;
+    while (xQueueReceive(_ctrlTxQ, &m, 0) == pdTRUE) sendCtrlRaw(m.b, m.len);
+}
+
+/* ===== クレジット ===================================================== */
+void WsAgent::resetCredit()
+{
+    _txSeq = 0;
+    _ackSeq = 0;
+    _window = 0;
+    _tCredit = millis();
+    _connGen++;
+    _offerState = 0;
+}
+
+void WsAgent::onStreamRx(const uint8_t* p, size_t l)
+{
+    if (l < 2 || p[0] != CREDIT_MAGIC0) return;
+    if (p[1] == CREDIT_MAGIC1) onCredit(p, l);
+    else if ((p[1] == CAPS_MAGIC1 || p[1] == LOSS_MAGIC1) && l >= 4) {
+        uint8_t none = 0;
+        if (p[1] == CAPS_MAGIC1 && _offer[2]) _offerState.compare_exchange_strong(none, 1);
+        if (_feedback) _feedback(p[1], p + 2, l - 2);
+    }
+}
+
+/* 端末の送れる経路を伝える（サーバの最初の CAPS への応答） */
+void WsAgent::sendOffer()
+{
+    _offerState = 2;
+#if WS_MUX
+    sendMux(MUX_STREAM, _offer, sizeof(_offer));
+#else
+    _stream.sendBIN(_offer, sizeof(_offer));
+#endif
+    LOGD("WS","offer caps=0x%02X default=%u", _offer[2], _offer[3]);
+}
+
+void WsAgent::onCredit(const uint8_t* p, size_t l)
+{
+    if (l < 8) return;
+    uint32_t recv = (uint32_t(p[2]) << 24) | (uint32_t(p[3]) << 16) | (uint32_t(p[4]) << 8) | p[5];
+    uint16_t win  = (uint16_t(p[6]) << 8) | p[7];
+    // 補充（canSend）と競合しても戻らないよう、前進するときだけ書く
+    uint32_t cur = _ackSeq.load();
+    while ((int32_t)(recv - cur) > 0 && !_ackSeq.compare_exchange_weak(cur, recv)) {}
+    _window   = win ? win : 1;
+    _tCredit  = millis();
+    LOGD("WS","credit recv=%u win=%u", (unsigned)recv, (unsigned)win);
+}
+
+bool WsAgent::canSend()
+{
+    if (!_stream.isConnected() || txPending() || millis() < _nextOkAfter) return false;
+    uint16_t win = _window;
+    if (!win) return true;                           // CREDIT を返さないサーバ
+    uint32_t inflight = _txSeq - _ackSeq.load();
+    Metrics::set(Metrics::WS_INFLIGHT, inflight);
+    if (inflight < win) return true;
+
+    /* CREDIT が途絶えた（サーバ側の詰まり・取りこぼし）。1 フレーム分だけ
+     * 補充して送り、応答が戻るかを見る */
+    if (millis() - _tCredit > WS_CREDIT_TIMEOUT_MS) {
+        LOGW("WS","credit timeout – refill (inflight=%u)", (unsigned)inflight);
+        uint32_t cur = _ackSeq.load(), want = _txSeq - win + 1;
+        while ((int32_t)(want - cur) > 0 && !_ackSeq.compare_exchange_weak(cur, want)) {}
+        _tCredit = millis();
+        return true;
+    }
+    return false;
+}
+
+/* ===== 映像の非ブロッキング送出 ========================================= */
+bool WsAgent::beginFrame(const uint8_t* buf, size_t len, uint32_t backoffMs)
+{
+    return beginTx(buf, len, backoffMs, nullptr, 0);
+}
+
+/* JPEG を送る。WS_JPEG_ELIDE=1 なら接続ごと・変化時だけヘッダを載せ、
+ * それ以外はスキャン以降と 20 B の JF ヘッダのみ（fb からは無コピー） */
+bool WsAgent::beginJpeg(const uint8_t* jpg, size_t len, uint16_t w, uint16_t h,
+                        uint64_t capUs, uint32_t backoffMs)
+{
+#if WS_JPEG_ELIDE
+    if (!canSend()) return false;
+    size_t hl = rtpjpeg::header_len(jpg, len);
+    if (!hl || hl > WS_JPEG_HDR_MAX) return beginFrame(jpg, len, backoffMs);   // そのまま送る
+
+    bool changed = (hl != _jhdrLen) || memcmp(jpg, _jhdr, hl) != 0;
+    if (changed) {
+        memcpy(_jhdr, jpg, hl);
+        _jhdrLen = hl;
+        _jhdrVer++;
+        LOGI("WS","jpeg header v%u (%u B)", (unsigned)_jhdrVer, (unsigned)hl);
+    }
+    bool withHdr = changed || _jhdrGen != _connGen;
+
+    uint32_t seq = ++_jseq, ts = (uint32_t)capUs;
+    uint8_t p[JF_PREFIX_LEN] = {
+        JF_MAGIC0, JF_MAGIC1, JF_FMT, uint8_t(withHdr ? JF_HAS_HDR : 0),
+        uint8_t(_jhdrVer >> 8), uint8_t(_jhdrVer),
+        uint8_t(seq >> 24), uint8_t(seq >> 16), uint8_t(seq >> 8), uint8_t(seq),
+        uint8_t(ts >> 24),  uint8_t(ts >> 16),  uint8_t(ts >> 8),  uint8_t(ts),
+        uint8_t(w >> 8), uint8_t(w), uint8_t(h >> 8), uint8_t(h),
+        uint8_t(hl >> 8), uint8_t(hl) };
+    const uint8_t* data = withHdr ? jpg : jpg + hl;
+    size_t         dlen = withHdr ? len : len - hl;
+    if (!beginTx(data, dlen, backoffMs, p, sizeof(p))) return false;
+    if (withHdr) _jhdrGen = _connGen;
     return true;
-}
\ No newline at end of file
+#else
+    (void)w; (void)h; (void)capUs;
+    return beginFrame(jpg, len, backoffMs);
+#endif
+}
+
+bool WsAgent::beginTx(const uint8_t* buf, size_t len, uint32_t backoffMs,
+                      const uint8_t* pre, size_t preLen)
+{
+    if (!canSend() || !buf || !len || preLen > JF_PREFIX_LEN) return false;
+    _tx.buf = buf; _tx.len = len; _tx.off = 0;
+    _tx.t0 = millis(); _tx.backoffMs = backoffMs; _tx.gen = _connGen;
+    uint8_t* h = _tx.hdr;
+    uint8_t  n = 0;
+#if !WS_MUX && WS_ZERO_MASK
+    /* mask キー 0 の WS ヘッダを自前で書き、payload は fb から直接送る */
+    size_t pl = preLen + len;
+    h[n++] = 0x82;                                   // FIN | BIN
+    if (pl < 126)        { h[n++] = 0x80 | (uint8_t)pl; }
+    else if (pl < 65536) { h[n++] = 0x80 | 126; h[n++] = uint8_t(pl >> 8); h[n++] = uint8_t(pl); }
+    else {
+        h[n++] = 0x80 | 127;
+        for (int i = 7; i >= 0; --i) h[n++] = (i < 4) ? uint8_t(pl >> (i * 8)) : 0;
+    }
+    for (int i = 0; i < 4; ++i) h[n++] = 0;          // masking key
+#endif
+    if (preLen) { memcpy(h + n, pre, preLen); n += preLen; }
+    _tx.hdrLen = n; _tx.hdrOff = 0;
+    return true;
+}
+
+int WsAgent::txFail(const char* why)
+{
+    LOGW("WS","frame send failed (%s) – drop", why);
+    Metrics::inc(Metrics::WS_DROPS);
+    _nextOkAfter = millis() + _tx.backoffMs;
+    _tx.buf = nullptr;
+    return -1;
+}
+
+#if WS_MUX && WS_ZERO_MASK
+/* iovec を最後まで書く（途中で切れるとフレームが壊れるので書き切るまで待つ）。
+ * 待つ間は _muxLock を持ったままなので deadlineMs（millis）で打ち切る。
+ * 1: 完了 / 0: 期限切れ（チャンクは書きかけ） / -1: ソケットエラー */
+static int sendAll(int fd, iovec* iov, int cnt, uint32_t deadlineMs)
+{
+    while (cnt > 0) {
+        msghdr m{};
+        m.msg_iov = iov; m.msg_iovlen = cnt;
+        ssize_t w = sendmsg(fd, &m, MSG_DONTWAIT);
+        if (w < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+            if ((int32_t)(millis() - deadlineMs) >= 0) return 0;
+            vTaskDelay(1);
+            continue;
+        }
+        while (cnt > 0 && (size_t)w >= iov->iov_len) { w -= iov->iov_len; iov++; cnt--; }
+        if (cnt > 0) { iov->iov_base = (uint8_t*)iov->iov_base + w; iov->iov_len -= w; }
+    }
+    return 1;
+}
+#endif
+
+int WsAgent::pump()
+{
+    if (!txPending()) return 1;
+    if (!_stream.isConnected() || _tx.gen != _connGen) return txFail("disconnected");
+    TRACE_SCOPE("ws.send");
+
+    int fd = _stream.fd();
+    if (fd < 0) return txFail("no socket");
+
+#if WS_MUX
+    /* WS_MUX_CHUNK ごとに送る。書ける間だけ進め、ロックはチャンク単位なので
+     * その合間に優先度の高い ctrlTask の受信・制御送信が割り込める */
+    while (_tx.hdrOff < _tx.hdrLen || _tx.off < _tx.len) {
+        fd_set wr; FD_ZERO(&wr); FD_SET(fd, &wr);
+        timeval tv{0, 0};
+        if (select(fd + 1, nullptr, &wr, nullptr, &tv) <= 0) break;
+        bool   first = (_tx.hdrOff == 0 && _tx.off == 0);
+        size_t hn = _tx.hdrLen - _tx.hdrOff;
+        if (hn > WS_MUX_CHUNK) hn = WS_MUX_CHUNK;
+        size_t dn = _tx.len - _tx.off;
+        if (dn > WS_MUX_CHUNK - hn) dn = WS_MUX_CHUNK - hn;
+        bool   last = (_tx.hdrOff + hn == _tx.hdrLen) && (_tx.off + dn == _tx.len);
+
+#if WS_ZERO_MASK
+        /* WS ヘッダ（mask キー 0）+ chan/flags を別に作り、fb とは iovec で繋いで sendmsg */
+        size_t  pl = 2 + hn + dn;
+        uint8_t h[10];
+        size_t  n = 0;
+        h[n++] = 0x82;                                   // FIN | BIN
+        if (pl < 126) { h[n++] = 0x80 | (uint8_t)pl; }
+        else          { h[n++] = 0x80 | 126; h[n++] = uint8_t(pl >> 8); h[n++] = uint8_t(pl); }
+        for (int i = 0; i < 4; ++i) h[n++] = 0;          // masking key
+        h[n++] = MUX_STREAM;
+        h[n++] = (first ? MUX_FIRST : 0) | (last ? MUX_LAST : 0);
+        iovec iov[3] = { { h, n },
+                         { (void*)(_tx.hdr + _tx.hdrOff), hn },
+                         { (void*)(_tx.buf + _tx.off),    dn } };
+        lock();
+        int r = (_stream.isConnected() && _tx.gen == _connGen)
+              ? sendAll(fd, iov, 3, _tx.t0 + WS_TX_TIMEOUT_MS) : -1;
+        if (r == 0) _stream.disconnect();                // 書きかけのチャンクは取り消せない
+        unlock();
+        if (r <= 0) return txFail(r < 0 ? "mux chunk" : "stalled");
+#else
+        /* チャンクバッファへ集め、ライブラリに mask させて送る */
+        uint8_t* c = _chunk + WEBSOCKETS_MAX_HEADER_SIZE;
+        c[0] = MUX_STREAM;
+        c[1] = (first ? MUX_FIRST : 0) | (last ? MUX_LAST : 0);
+        memcpy(c + 2, _tx.hdr + _tx.hdrOff, hn);
+        memcpy(c + 2 + hn, _tx.buf + _tx.off, dn);
+        lock();
+        bool ok = _stream.isConnected() && _tx.gen == _connGen
+               && _stream.sendBIN(_chunk, 2 + hn + dn, true);
+        unlock();
+        if (!ok) return txFail("mux chunk");
+#endif
+        _tx.hdrOff += hn; _tx.off += dn;
+    }
+#elif !WS_ZERO_MASK
+    /* ライブラリの sendBIN で送る。mask で書き換えるのでフレームをコピーする
+     * （書き切るまで戻らない） */
+    size_t pl = _tx.hdrLen + _tx.len;
+    if (WEBSOCKETS_MAX_HEADER_SIZE + pl > _copyCap) {
+        heap_caps_free(_copy);
+        size_t cap = (WEBSOCKETS_MAX_HEADER_SIZE + pl + 0xFFFF) & ~(size_t)0xFFFF;   // 64 KB 単位で伸ばす
+        _copy    = (uint8_t*)heap_caps_malloc(cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        _copyCap = _copy ? cap : 0;
+        if (!_copy) return txFail("copy alloc");
+    }
+    uint8_t* p = _copy + WEBSOCKETS_MAX_HEADER_SIZE;
+    memcpy(p, _tx.hdr, _tx.hdrLen);
+    memcpy(p + _tx.hdrLen, _tx.buf, _tx.len);
+    if (!_stream.sendBIN(_copy, pl, true)) return txFail("sendBIN");
+    _tx.hdrOff = _tx.hdrLen; _tx.off = _tx.len;
+#else
+    /* ヘッダ → payload の順に、ソケットが受け取れる分だけ書く */
+    while (_tx.hdrOff < _tx.hdrLen || _tx.off < _tx.len) {
+        bool hdr = _tx.hdrOff < _tx.hdrLen;
+        const uint8_t* p = hdr ? _tx.hdr + _tx.hdrOff : _tx.buf + _tx.off;
+        size_t n = hdr ? size_t(_tx.hdrLen - _tx.hdrOff) : _tx.len - _tx.off;
+        int w = send(fd, p, n, MSG_DONTWAIT);
+        if (w < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return txFail("socket");
+        }
+        if (hdr) _tx.hdrOff += w; else _tx.off += w;
+    }
+#endif
+
+    if (_tx.hdrOff < _tx.hdrLen || _tx.off < _tx.len) {
+        if (millis() - _tx.t0 <= WS_TX_TIMEOUT_MS) return 0;
+        /* 書きかけのフレームは取り消せないので接続ごと張り直す */
+        txFail("stalled");
+#if WS_MUX
+        lock(); _stream.disconnect(); unlock();
+#else
+        _stream.disconnect();
+#endif
+        return -1;                       // 切断イベントで接続状態機械が張り直す
+    }
+    _tx.buf = nullptr;
+    _txSeq++;
+    Metrics::inc(Metrics::WS_FRAMES);
+    return 1;
+}
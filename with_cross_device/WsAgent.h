@@ -1,28 +1,189 @@
 #pragma once
 #include <WebSocketsClient.h>
 #include <WiFi.h>
+#include <atomic>
+#include <functional>
+#include "config.h"
+
+/* ソケットに触れるようにした WebSocketsClient（select 待ちと TCP_NODELAY 用） */
+class WsClient : public WebSocketsClient {
+public:
+    int  fd() { return (_client.tcp && _client.tcp->connected()) ? _client.tcp->fd() : -1; }
+    void setNoDelay() { if (_client.tcp) _client.tcp->setNoDelay(true); }
+};
+
+/* WS_MUX=1: 1 本の WebSocket（WS_MUX_PATH）に 3 チャネルを載せる
+ *   各 BIN メッセージ = chan(1) | flags(1) | payload
+ *     chan : MUX_STREAM / MUX_CTRL / MUX_MODE
+ *     flags: 映像のみ。1 フレームを WS_MUX_CHUNK ごとに分け FIRST / LAST を立てる
+ *   payload は従来の各パスと同じ（/control の ACK も MUX_CTRL で返す）。
+ *   チャンクの合間に制御が割り込めるよう、送信はチャンク単位でロックする。 */
+enum : uint8_t { MUX_STREAM = 0, MUX_CTRL = 1, MUX_MODE = 2 };
+enum : uint8_t { MUX_FIRST = 0x01, MUX_LAST = 0x02 };
+
+/* 映像のクレジット制御（サーバ→端末、/stream または MUX_STREAM）
+ *   CREDIT = 0xCD 0x01 | 受信済みフレーム数(4) | window(2)   （big-endian）
+ *   フレーム数は接続ごとに 0 から数える。端末は「送出済み − 受信済み < window」
+ *   のときだけ撮像・送出するので、TCP バッファに古いフレームが溜まらない。
+ *   一度も CREDIT を返さないサーバ（従来）には従来どおり制限なしで送る。 */
+enum : uint8_t { CREDIT_MAGIC0 = 0xCD, CREDIT_MAGIC1 = 0x01 };
+
+/* 送出経路の選択（/stream または MUX_STREAM、CREDIT と同じ経路）
+ *   CAPS  = 0xCD 0x02 | caps(1) | prefer(1)    サーバ→端末（接続直後、以後いつでも可）
+ *   OFFER = 0xCD 0x02 | caps(1) | default(1)   端末→サーバ、接続ごとに最初の CAPS への応答
+ *     caps          : 受けられる / 送れる経路のビット（STREAM_CAP_*）
+ *     prefer/default: 経路の番号（ビット位置）。prefer = 0xFF は端末に任せる
+ *   LOSS  = 0xCD 0x03 | loss_permille(2)        サーバ→端末、UDP 経路の直近の損失率
+ *   CAPS を送らないサーバ（従来）には OFFER も送らず、既定の経路（STREAM_MODE）だけで送る。 */
+enum : uint8_t { CAPS_MAGIC1 = 0x02, LOSS_MAGIC1 = 0x03 };
+enum : uint8_t { STREAM_CAP_RTP = 0x01, STREAM_CAP_WS = 0x02, STREAM_CAP_RTSP = 0x04, STREAM_CAP_RAW = 0x08 };
+
+/* WS_JPEG_ELIDE=1: JPEG ヘッダ（SOI..SOS）を省略した映像メッセージ（端末→サーバ）
+ *   'J' 'F' fmt(1)=1 flags(1) hdr_ver(2) seq(4) ts_us(4) w(2) h(2) hdr_len(2) | data
+ *     flags bit0 HAS_HDR : data は JPEG 全体。先頭 hdr_len バイトを hdr_ver として保持する
+ *     それ以外           : data はスキャン以降のみ。保持中のヘッダ + data で JPEG に戻る
+ *   ヘッダは接続ごとの最初のフレームと、内容が変わったとき（hdr_ver+1）だけ載せる。
+ *   ts_us は撮像時刻（esp_timer）の下位 32bit。数値は big-endian。
+ *   従来の JPEG（FF D8 始まり）とは先頭 2 バイトで区別できる。 */
+enum : uint8_t { JF_MAGIC0 = 'J', JF_MAGIC1 = 'F', JF_FMT = 1, JF_HAS_HDR = 0x01 };
+constexpr size_t JF_PREFIX_LEN = 20;
 
 class WsAgent {
 public:
-    bool  begin(const char* host, uint16_t port);   // ガード付き
-    void  loop();                                   // 再試行管理
+    bool  begin(const char* host, uint16_t port);   // 接続管理を開始（初回のみ true、以後は loop() が再接続）
+    void  loop();                                   // /stream /mode + 接続状態機械（netcamTask、ブロックしない）
+    int   ctrlFd();                                 // /control 専用（以下 ctrlTask から呼ぶ）
+    void  serviceCtrl(int64_t rxUs);                // rxUs: select が受信を検出した時刻（0=なし）
     bool  ready() { return _stream.isConnected(); }
 
     void  sendMode(uint16_t);
-    void  sendMotor(uint16_t);
-    bool sendFrame(const uint8_t* buf, size_t len, uint32_t backoffMs = 0);
+    void  sendMotor(uint16_t);                      // ctrlTask の送信キュー経由
+    void  sendButton(uint8_t act, int64_t press_us, uint16_t event);   // 同上（BUTTON、CtrlProto と同じ中身）
+
+    /* 映像送出（netcamTask）。beginFrame() で登録し、pump() を呼ぶたびに
+     * ソケットが受け取れる分だけ書く（ブロックしない）。buf は pump() が
+     * 0 以外を返すまで保持すること */
+    bool  canSend();                                // 接続中・送出中でない・クレジットあり
+    bool  beginFrame(const uint8_t* buf, size_t len, uint32_t backoffMs = 0);
+    bool  beginJpeg(const uint8_t* jpg, size_t len, uint16_t w, uint16_t h,
+                    uint64_t capUs, uint32_t backoffMs = 0);   // WS_JPEG_ELIDE に従う
+    int   pump();                                   // 1=完了 / 0=送出中 / -1=失敗
+    bool  txPending() const { return _tx.buf != nullptr; }
+
+    /* 経路選択（StreamSelector）とのやりとり。feedback は CAPS / LOSS を受けたとき
+     * loop() を回すタスク（WS_MUX なら ctrlTask）から呼ばれる */
+    using StreamFeedback = std::function<void(uint8_t type, const uint8_t* p, size_t l)>;
+    void  onStreamFeedback(StreamFeedback cb) { _feedback = cb; }
+    void  setStreamOffer(uint8_t caps, uint8_t def) { _offer[2] = caps; _offer[3] = def; }
+
+    // 接続中ソケットの fd（loop() と同じタスクから呼ぶこと）。戻り値は個数
+    size_t fds(int* out, size_t max);
 
 private:
-    void  start(const char* host, uint16_t port);   // 実際の begin()
+    void  start(const char* host, uint16_t port);   // /stream 接続後に /mode /control を開始
 
-    WebSocketsClient _stream, _ctrl, _mode;
+    /* 接続状態機械（netcamTask のみ）。WsAgent.cpp の「接続管理」参照 */
+    enum class Conn : uint8_t { IDLE, BACKOFF, PROBING, HANDSHAKE, UP };
+    void  tickConn();
+    bool  startProbe();
+    int   checkProbe();
+    void  closeProbe();
+    void  startClient();
+    void  stopClient();
+    void  retry(const char* why);
+    /* /mode・/control（非多重化時）。ライブラリの自動再接続（ブロッキング connect）は使わず、
+     * begin 直後の 1 回だけ connect させる。落ちたら _evDown で接続状態機械に任せる */
+    struct Aux { bool armed = false, live = false; };
+    void  loopAux(WsClient& c, Aux& a);
+    void  onAuxDown(Aux& a);
+    void  onCtrl(const uint8_t* p, size_t l);       // /control（MUX_CTRL）受信
+    void  sendCtrlRaw(uint8_t* b, size_t l);
+    void  onStreamRx(const uint8_t* p, size_t l);   // /stream 受信（loop() を回すタスク）
+    void  onCredit(const uint8_t* p, size_t l);
+    void  sendOffer();
+    void  resetCredit();
+    int   txFail(const char* why);
+
+    WsClient _stream, _ctrl, _mode;
     String  _host;  
     uint16_t _port = 0;
-    uint32_t _lastTry = 0;
     uint32_t _nextOkAfter = 0;
-    bool     _busy     = false;
-    bool     _connecting = false;
-    bool  _needReconnect = false;
+
+    Conn     _conn     = Conn::IDLE;
+    int      _probe    = -1;            // 到達確認用の非ブロッキングソケット
+    uint32_t _nextTry  = 0;
+    uint32_t _tConn    = 0;             // PROBING / HANDSHAKE の開始時刻
+    uint32_t _tDown    = 0;             // 切断（または begin）時刻 → WS_RECONNECT_MS
+    uint16_t _attempts = 0;
+    std::atomic<bool> _evUp{false}, _evDown{false};   // ライブラリのイベント（loop() を回すタスク）
+    std::atomic<bool> _libActive{false};              // HANDSHAKE / UP の間だけライブラリを回す
+
+    bool  beginTx(const uint8_t* buf, size_t len, uint32_t backoffMs,
+                  const uint8_t* pre, size_t preLen);
+
+    /* 送出中フレーム（netcamTask のみ）。hdr → buf の順に送る。
+     * hdr = [WS フレームヘッダ（WS_ZERO_MASK で非多重化時）] + payload 前置部（JF ヘッダ等） */
+    struct Tx {
+        const uint8_t* buf = nullptr;
+        size_t   len = 0, off = 0;
+        uint8_t  hdr[14 + JF_PREFIX_LEN];
+        uint8_t  hdrLen = 0, hdrOff = 0;
+        uint32_t t0 = 0, backoffMs = 0, gen = 0;
+    } _tx;
+
+    /* クレジット。送出は netcamTask、CREDIT 受信と接続時の初期化は loop() を回すタスク */
+    std::atomic<uint32_t> _txSeq{0};        // 送り終えたフレーム数
+    std::atomic<uint32_t> _ackSeq{0};       // サーバが受け取ったフレーム数
+    std::atomic<uint16_t> _window{0};       // 0 = CREDIT 未受信（制限なし）
+    std::atomic<uint32_t> _tCredit{0};      // 最後に CREDIT を受けた / 補充した millis
+    std::atomic<uint32_t> _connGen{0};      // 接続ごとに +1（送出中フレームの無効化用）
+
+    /* 経路選択。OFFER は最初の CAPS を受けた後、netcamTask が送出中でないときに送る */
+    StreamFeedback    _feedback;
+    uint8_t           _offer[4] = { CREDIT_MAGIC0, CAPS_MAGIC1, 0, 0 };
+    std::atomic<uint8_t> _offerState{0};    // 0 = CAPS 待ち / 1 = 送る / 2 = 送った（接続ごと）
+
+#if WS_JPEG_ELIDE
+    /* 最後に送った JPEG ヘッダ（netcamTask のみ） */
+    uint8_t  _jhdr[WS_JPEG_HDR_MAX];
+    size_t   _jhdrLen = 0;
+    uint16_t _jhdrVer = 0;
+    uint32_t _jhdrGen = 0;                  // ヘッダを送った接続（_connGen）
+    uint32_t _jseq    = 0;
+#endif
+
+    /* /control は ctrlTask だけが触る。begin 要求と送信はここを経由。
+     * 開始・停止の要求は共通の通し番号を持ち、ctrlTask は要求された順に処理する */
+    std::atomic<uint32_t> _ctrlReqGen{0}, _ctrlStartGen{0}, _ctrlStopGen{0};
+    uint32_t          _ctrlStartDone = 0, _ctrlStopDone = 0;   // ctrlTask が処理済みの番号
+    struct CtrlTx { uint8_t len; uint8_t b[9]; };
+    QueueHandle_t     _ctrlTxQ = nullptr;     // CtrlTx
+    int64_t           _ctrlRxUs = 0;        // select が受信を検出した時刻
+    Aux               _ctrlAux;             // ctrlTask のみ
+    Aux               _modeAux;             // netcamTask のみ
+
+#if !WS_ZERO_MASK
+    /* sendBIN(…, true) に渡す mask 用の作業領域（先頭に WEBSOCKETS_MAX_HEADER_SIZE の空き）。
+     * 多重化時はチャンク 1 個分、非多重化時はフレーム全体（PSRAM、足りなければ伸ばす） */
+#if WS_MUX
+    uint8_t  _chunk[WEBSOCKETS_MAX_HEADER_SIZE + WS_MUX_CHUNK];
+#else
+    uint8_t* _copy    = nullptr;
+    size_t   _copyCap = 0;
+#endif
+#endif
+
+#if WS_MUX
+    /* _stream を多重化コネクションとして使う。loop() は ctrlTask、送信は各タスクから
+     * なので、WebSocketsClient への操作はすべてこの再帰 mutex の内側で行う */
+    SemaphoreHandle_t _muxLock = nullptr;
+    void lock();
+    void unlock();
+    bool sendMux(uint8_t chan, const uint8_t* p, size_t l);
+    friend void muxCb(WStype_t, uint8_t*, size_t);
+#endif
     
     friend void wsCb(WStype_t, uint8_t*, size_t);
+    friend void ctrlCb(WStype_t, uint8_t*, size_t);
+    friend void modeCb(WStype_t, uint8_t*, size_t);
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 // ===== Streaming mode =====
+// 既定の送出経路（サーバの CAPS があれば実行時に切り替わる。StreamSink.h 参照）
 // 0: RTP(JPEG) over UDP   [推奨: 既定]
 // 1: RTSP(UDP) server
 // 2: Legacy WebSocket (既存機能維持)
@@ -11,13 +12,56 @@
 
 // ===== Camera =====
 #ifndef CAM_WIDTH
-#define CAM_WIDTH   640
+#define CAM_WIDTH   640         // RAW 送出（UdpAgent::sendFrame）の RTP/JPEG ヘッダに載せる画素数
 #endif
 #ifndef CAM_HEIGHT
 #define CAM_HEIGHT  480
 #endif
+#ifndef CAM_FB_FRAMESIZE
+#define CAM_FB_FRAMESIZE FRAMESIZE_UXGA  // fb はこの大きさで確保。プロファイル・静止画はこれ以下に限る
+#endif
 #ifndef CAM_FPS
-#define CAM_FPS     10
+#define CAM_FPS     10          // プロファイル適用前の撮像周期
+#endif
+#ifndef CAM_HOME_STANDBY
+#define CAM_HOME_STANDBY 0      // 1: HOME ではセンサを standby にし、OK を押し始めた時点で起こす
+#endif
+#ifndef CAM_FRESH_US
+#define CAM_FRESH_US 100000     // CamGrab::LATEST でこれより古い fb は捨てて撮り直す
+#endif
+
+// モードごとのカメラプロファイル { frame_size, jpeg_quality, fps, grab }
+// AppStateMachine の状態に付き、遷移時に sensor_t のセッタで切り替える（再初期化しない）
+#ifndef CAM_PROFILE_HOME
+#define CAM_PROFILE_HOME      { FRAMESIZE_240X240, 36, 10, CamGrab::LATEST }   // HOME / 接続待ち
+#endif
+#ifndef CAM_PROFILE_SIG
+#define CAM_PROFILE_SIG       { FRAMESIZE_240X240, 36, 20, CamGrab::LATEST }   // 信号: fps 優先
+#endif
+#ifndef CAM_PROFILE_STRAIGHT
+#define CAM_PROFILE_STRAIGHT  { FRAMESIZE_QVGA,    32, 15, CamGrab::LATEST }
+#endif
+#ifndef CAM_PROFILE_OBJ
+#define CAM_PROFILE_OBJ       { FRAMESIZE_VGA,     24,  8, CamGrab::QUEUED }   // 物体: 画素優先
+#endif
+#ifndef CAM_PROFILE_SNAP
+#define CAM_PROFILE_SNAP      { FRAMESIZE_UXGA,    12,  0, CamGrab::QUEUED }   // 静止画（fps は使わない）
+#endif
+#ifndef CAM_SNAP_TRIES
+#define CAM_SNAP_TRIES 6        // 解像度を変えた後、目的の大きさの fb が来るまで撮り直す上限
+#endif
+// 直近のフレーム履歴（FrameHistory）: ボタンを押した時に見えていたフレームを後から引く
+#ifndef HISTORY_BYTES
+#define HISTORY_BYTES (1536 * 1024)   // PSRAM リングの大きさ（0 で無効）
+#endif
+#ifndef HISTORY_MS
+#define HISTORY_MS 3000         // これより古いフレームは容量に余裕があっても捨てる
+#endif
+#ifndef HISTORY_FRAMES
+#define HISTORY_FRAMES 96       // 索引の数（最大 fps × HISTORY_MS より多く）
+#endif
+#ifndef HISTORY_EVENTS
+#define HISTORY_EVENTS 16       // 押下時刻を覚えておくボタンイベントの数
 #endif
 #ifndef CAM_JPEG_QUALITY   // esp32-camera の "小さいほど高画質"
 #define CAM_JPEG_QUALITY  70   // 目安: 25~35 ≒ Baseline 70前後
@@ -36,6 +80,129 @@
 #ifndef RTP_PORT
 #define RTP_PORT 5540
 #endif
+#ifndef RTP_MAX_DESTS
+#define RTP_MAX_DESTS 4         // 同じパケット列を送る宛先の上限（begin の宛先を含む）
+#endif
+#ifndef RTP_EXTRA_DESTS
+#define RTP_EXTRA_DESTS ""      // 追加の宛先 "ip:port,ip:port"（マルチキャスト可）
+#endif
+#ifndef RTP_MCAST_TTL
+#define RTP_MCAST_TTL 1         // マルチキャスト宛先の TTL（1 = 同一セグメントのみ）
+#endif
+#ifndef RTP_POOL_PKTS
+#define RTP_POOL_PKTS 10        // 送出用パケットバッファ（DMA 可能な内部 RAM）。packetize が 2〜RTP_BATCH_PKTS 面使う
+#endif
+#ifndef RTP_BATCH_SEND
+#define RTP_BATCH_SEND 1        // 1: フレームのパケットを lwIP raw API へまとめて渡す（コアロック 1 回）
+#endif
+#ifndef RTP_BATCH_PKTS
+#define RTP_BATCH_PKTS 8        // まとめ送り 1 回のパケット数上限（<= 32）
+#endif
+#ifndef RTP_HIST_PKTS
+#define RTP_HIST_PKTS 0         // 再送履歴用パケットバッファ（PSRAM）。0 = 確保しない
+#endif
+#ifndef ASYNC_COPY_ENABLE
+#define ASYNC_COPY_ENABLE 1     // スキャン片の PSRAM→DRAM コピーを GDMA で先読み（0 = CPU memcpy）
+#endif
+#ifndef ASYNC_COPY_ALIGN
+#define ASYNC_COPY_ALIGN 16     // GDMA の PSRAM 側アドレス・長さの境界（16/32/64）
+#endif
+#ifndef ASYNC_COPY_MIN
+#define ASYNC_COPY_MIN 256      // これより短いコピーは DMA を起こさず memcpy
+#endif
+#ifndef NET_POLL_MS
+#define NET_POLL_MS 20          // netcamTask の最長待ち（イベントが無くても WS/接続処理を回す）
+#endif
+#ifndef UI_IDLE_MS
+#define UI_IDLE_MS 1000         // uiTask の最長待ち（ボタン/LED/モータの期限が無いとき）
+#endif
+#ifndef CTRL_TASK_PRIO
+#define CTRL_TASK_PRIO 4        // /control 受信とモータ駆動の専用タスク（netcam/ui より上）
+#endif
+#ifndef CTRL_TASK_CORE
+#define CTRL_TASK_CORE 0        // 映像送出（core1）と分ける
+#endif
+#ifndef CTRL_POLL_MS
+#define CTRL_POLL_MS 5          // /control ソケットの select 待ち上限（送信キューの処理間隔）
+#endif
+#ifndef FRAME_SLOTS
+#define FRAME_SLOTS 3           // 同時に sink が握れる fb 数（fb_count 以上にしても増えない）
+#endif
+
+// WebSocket 多重化: 1 なら /stream /control /mode を 1 本の WS_MUX_PATH に載せる
+// （サーバ側の対応が必要。参照実装: src/ws_mux_server）
+#ifndef WS_MUX
+#define WS_MUX 0
+#endif
+#ifndef WS_MUX_PATH
+#define WS_MUX_PATH "/mux"
+#endif
+#ifndef WS_MUX_CHUNK
+#define WS_MUX_CHUNK 2048       // 映像をこの単位で分割し、間に制御を割り込ませる（< 65534）
+#endif
+#ifndef WS_BACKOFF_MIN_MS
+#define WS_BACKOFF_MIN_MS 500   // WS 再接続の待ち（指数 + jitter）の初期値
+#endif
+#ifndef WS_BACKOFF_MAX_MS
+#define WS_BACKOFF_MAX_MS 30000
+#endif
+#ifndef WS_CONNECT_TIMEOUT_MS
+#define WS_CONNECT_TIMEOUT_MS 1000   // 非ブロッキング connect の待ち上限
+#endif
+#ifndef WS_HANDSHAKE_TIMEOUT_MS
+#define WS_HANDSHAKE_TIMEOUT_MS 3000
+#endif
+#ifndef WS_CREDIT_TIMEOUT_MS
+#define WS_CREDIT_TIMEOUT_MS 1000   // CREDIT が途絶えたら 1 フレーム分補充するまでの時間
+#endif
+#ifndef WS_JPEG_ELIDE
+#define WS_JPEG_ELIDE 0         // 1: JPEG ヘッダ（SOI..SOS）を接続ごと・変化時だけ送る
+#endif
+#ifndef WS_JPEG_HDR_MAX
+#define WS_JPEG_HDR_MAX 1024    // これより長いヘッダはそのまま（省略せず）送る
+#endif
+#ifndef WS_TX_TIMEOUT_MS
+#define WS_TX_TIMEOUT_MS 2000   // 1 フレームを書き切れなければ接続を張り直す
+#endif
+// 映像の WS フレームを mask キー 0 で自前に組み、fb から無コピーで送る（既定 0）。
+// 0: ライブラリの sendBIN が毎フレーム乱数キーで mask する。mask で書き換えるため
+//    フレーム（WS_MUX ならチャンク）をコピーし、全バイトを XOR する（src/copy_bench 参照）。
+// 1: コピーと XOR が消えるが、キーが予測可能になり RFC 6455 §5.3 に反する。
+//    mask は中間プロキシのキャッシュ汚染対策なので、プロキシを挟まない閉じた LAN で、
+//    キー 0 を受け付けるサーバとだけ使うこと。
+#ifndef WS_ZERO_MASK
+#define WS_ZERO_MASK 0
+#endif
+
+// UDP 制御チャネル（CtrlProto）: 0=WS のみ(既定) / 1=UDP のみ / 2=両方
+#ifndef CTRL_TRANSPORT
+#define CTRL_TRANSPORT 0
+#endif
+#ifndef CTRL_UDP_PORT
+#define CTRL_UDP_PORT 5542      // 送受とも（RTP=5540, RTCP=5541）
+#endif
+#ifndef CTRL_UDP_RTO_MS
+#define CTRL_UDP_RTO_MS 30
+#endif
+#ifndef CTRL_UDP_MAX_TRIES
+#define CTRL_UDP_MAX_TRIES 5
+#endif
+#ifndef CTRL_UDP_HELLO_MS
+#define CTRL_UDP_HELLO_MS 1000  // HELLO keepalive（対向が端末アドレスを学習する）
+#endif
+// 静止画などの取り出し（FetchServer）: サーバが要求し、チャンクを GET で引く
+#ifndef FETCH_UDP_PORT
+#define FETCH_UDP_PORT 5544     // 送受とも（5543 はトレース）
+#endif
+#ifndef FETCH_CHUNK
+#define FETCH_CHUNK 1200        // DATA 1 個の payload（MTU 以下）
+#endif
+#ifndef FETCH_WINDOW
+#define FETCH_WINDOW 16         // GET 1 回で返すチャンク数の上限
+#endif
+#ifndef METRICS_EXPORT_MS
+#define METRICS_EXPORT_MS 2000  // RTCP APP "WXMT" を RTP宛先ポート+1 へ（0 で無効）
+#endif
 
 
 // ===== RTSP =====
@@ -45,6 +212,27 @@
 #ifndef RTSP_PATH
 #define RTSP_PATH "/stream"
 #endif
+#ifndef RTSP_SESSION_TIMEOUT_S
+#define RTSP_SESSION_TIMEOUT_S 60    // 要求（keepalive）がこの時間無ければ再生を止める
+#endif
+#ifndef RTSP_RTP_PORT
+#define RTSP_RTP_PORT 5546      // RTSP 再生の RTP 送信元（端末側で bind、SETUP の server_port）
+#endif
+#ifndef RTSP_ENABLE
+#define RTSP_ENABLE (STREAM_MODE == 1)   // 1: Wi-Fi 接続後に RTSP サーバを常時待ち受け（経路の候補に入れる）
+#endif
+
+// ===== Stream path selection (StreamSelector) ========================
+// STREAM_MODE は既定の経路。サーバが CAPS を返せば実行時に経路を選び直す
+#ifndef STREAM_LOSS_HI_PERMILLE
+#define STREAM_LOSS_HI_PERMILLE 50   // UDP 経路の損失率がこれを超えたら WS へ落とす候補 [‰]
+#endif
+#ifndef STREAM_LOSS_HOLD_MS
+#define STREAM_LOSS_HOLD_MS 3000     // 超えた状態がこの時間続いたら切り替える
+#endif
+#ifndef STREAM_RETRY_MS
+#define STREAM_RETRY_MS 30000        // UDP 経路を外しておく時間（過ぎたら元の経路を試す）
+#endif
 
 // ===== Auto stream (no BLE, no WS) ===================================
 // 0: 既存どおり（BLEで接続情報を受け取り、WS経由で状態同期）
@@ -70,3 +258,47 @@
   #define RTP_DEST_PORT RTP_PORT          // 既定 5540
   #endif
 #endif
+
+// ===== Static-scene dedup ============================================
+// 直前に送ったフレームとほぼ同一（スキャン長差が閾値以内 かつ 区間ハッシュの不一致が
+// DEDUP_MAX_DIFF_SEGS 以下）のフレームは送らない。静止中も DEDUP_KEEPALIVE_MS ごとに 1 枚は送る。
+// 実機のセンサノイズでの判定が確かめられるまで既定は無効。
+#ifndef DEDUP_ENABLE
+#define DEDUP_ENABLE 0
+#endif
+#ifndef DEDUP_KEEPALIVE_MS
+#define DEDUP_KEEPALIVE_MS 1000
+#endif
+#ifndef DEDUP_LEN_TOL_PERMILLE
+#define DEDUP_LEN_TOL_PERMILLE 6     // スキャン長の許容差 [‰]
+#endif
+#ifndef DEDUP_MAX_DIFF_SEGS
+#define DEDUP_MAX_DIFF_SEGS 1        // ハッシュが違ってよい区間数（FrameDedup::SEGMENTS=16 のうち）
+#endif
+
+// ===== Logging (NetDebug) ============================================
+// LOG_LEVEL: 0=D 1=I 2=W 3=E。未満のマクロはコンパイル時に除去
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 1
+#endif
+// 0: drain タスクが整形してテキスト出力 / 1: バイナリ出力（src/log_decoder）
+#ifndef LOG_OUTPUT_BINARY
+#define LOG_OUTPUT_BINARY 0
+#endif
+#ifndef LOG_RING_SLOTS
+#define LOG_RING_SLOTS 64            // コアごと、2のべき乗（1 slot = 96B）
+#endif
+#ifndef LOG_DRAIN_MS
+#define LOG_DRAIN_MS 10
+#endif
+
+// ===== Trace (Chrome/Perfetto 形式に変換可能なイベント記録) ==========
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE 1
+#endif
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 16384           // PSRAM リング（1 event = 16B）、2のべき乗
+#endif
+#ifndef TRACE_UDP_PORT
+#define TRACE_UDP_PORT 5543          // UDP ダンプ先（RTP 宛先 IP）
+#endif
@@ -1,4 +1,6 @@
 #include "rtp_jpeg.h"
+#include "AsyncCopy.h"
+#include "PacketPool.h"
 #include "NetDebug.h"
 #include <string.h>
 
@@ -90,6 +92,25 @@ bool extract_qtables_and_scan(const uint8_t* b, size_t L,
   return false;
 }
 
+/*** SOI..SOS ヘッダ長 ****************************************************/
+size_t header_len(const uint8_t* b, size_t L){
+  if (!b || L < 4 || !(b[0] == 0xFF && b[1] == 0xD8)) return 0;
+  size_t i = 2;
+  while (i + 3 < L) {
+    if (b[i] != 0xFF) { i++; continue; }
+    uint8_t m = b[i+1];
+    if (m == 0xD8 || (m>=0xD0 && m<=0xD7) || m==0x01) { i += 2; continue; }
+    if (m == 0xD9) return 0;
+
+    uint16_t seglen; if(!be16(b, L, i+2, seglen)) return 0;
+    size_t seg_end = i + 2 + seglen;
+    if (seg_end > L) return 0;
+    if (m == 0xDA /*SOS*/) return seg_end;
+    i = seg_end;
+  }
+  return 0;
+}
+
 /*** SOF0 のサンプリング係数→RTP/JPEG Type 自動判定 *********************/
 struct Samp { uint8_t yH=1,yV=1, cbH=1,cbV=1, crH=1,crV=1; bool ok=false; };
 static bool parse_sof0_sampling(const uint8_t* b, size_t L, Samp& s){
@@ -149,6 +170,77 @@ static bool find_dri(const uint8_t* b, size_t L, uint16_t& dri){
 
 static inline size_t umin(size_t a, size_t b){ return (a<b)?a:b; }
 
+/*** 断片化送出 ***********************************************************
+ * パケットは pool のバッファ上で組む（スタックに 1 パケット分を置かない）。
+ * n 面のバッファを順に使い、パケット k の emit（sendto）の間に k+1 のスキャン片を
+ * copier（GDMA）で先読みする。次の面が空いていなければ emit の後に組む。
+ *  - flush 無し: emit が返れば面は再利用できる（2 面で交互）
+ *  - flush あり: emit した面は flush() まで保持する（まとめ送り）。全面が埋まったら
+ *    flush() してから次を組む。最後のパケットの後にも flush() する
+ * パケット先頭はバッファ上で「スキャン片の書き込み位置が送り元と同じ
+ * ASYNC_COPY_ALIGN 位相」になるようずらす（GDMA の境界条件、AsyncCopy 参照）。 */
+struct Frag { uint8_t* payload; size_t off, chunk, len; };
+
+static bool emit_fragments(const uint8_t main8[8],
+                           const uint8_t* rmhdr, size_t rm_len,
+                           const uint8_t* qthdr, size_t q_len,
+                           const uint8_t* scan, size_t scan_len,
+                           size_t max_payload,
+                           const std::function<bool(uint8_t*, size_t, bool)>& emit,
+                           const std::function<bool()>& flush,
+                           uint8_t* const* buf, size_t n, AsyncCopy* cp)
+{
+  auto prepare = [&](size_t bi, size_t off, Frag& f)->bool {
+    const bool first = (off == 0);
+    size_t overhead = 8 + (first ? rm_len + q_len : 0);
+    if (overhead >= max_payload) return false;
+    size_t chunk = umin(scan_len - off, max_payload - overhead);
+
+    uint8_t* at = buf[bi] + PKT_HEADROOM + overhead;
+    uint8_t* payload = buf[bi] + AsyncCopy::alignShift(at, scan + off) + PKT_HEADROOM;
+
+    // main8B with Fragment Offset
+    uint8_t* p = payload;
+    memcpy(p, main8, 8);
+    p[1] = (uint8_t)(off>>16);
+    p[2] = (uint8_t)(off>>8);
+    p[3] = (uint8_t)(off);
+    p += 8;
+    // Restart（DRIあり時、先頭のみ）→ QTable（Q=255：先頭のみ）
+    if (first && rm_len) { memcpy(p, rmhdr, rm_len); p += rm_len; }
+    if (first)           { memcpy(p, qthdr, q_len);  p += q_len; }
+
+    // scan chunk
+    if (cp) cp->start(p, scan + off, chunk);
+    else    memcpy(p, scan + off, chunk);
+    f = Frag{ payload, off, chunk, overhead + chunk };
+    return true;
+  };
+  auto wait = [&]{ if (cp) cp->wait(); };
+
+  Frag cur, nxt;
+  size_t bi = 0, held = 0;                     // held: emit 済みで flush 待ちの面数
+  if (!prepare(bi, 0, cur)) return false;
+  for (;;) {
+    wait();                                      // cur のスキャン片が揃った
+    size_t next = cur.off + cur.chunk;
+    bool is_last = next >= scan_len;             // 最後のパケットのみ marker=true
+    size_t nb = (bi + 1) % n;
+    bool pre = !is_last && (flush ? held + 1 : 1) < n;   // 次の面が空いている
+    if (pre && !prepare(nb, next, nxt)) return false;
+    bool ok = emit(cur.payload, cur.len, is_last);   // この間に nxt を DMA
+    if (!ok) { wait(); return false; }
+    if (flush) held++;
+    if (is_last) return flush ? flush() : true;
+    if (!pre) {
+      if (flush) { if (!flush()) return false; held = 0; }
+      if (!prepare(nb, next, nxt)) return false;
+    }
+    bi = nb;
+    cur = nxt;
+  }
+}
+
 /*** 公開API: packetize **************************************************/
 bool packetize(const uint8_t* jpg, size_t jpg_len,
                uint16_t width, uint16_t height,
@@ -156,9 +248,16 @@ bool packetize(const uint8_t* jpg, size_t jpg_len,
                uint8_t type_specific,
                uint32_t /*ts90k*/,
                size_t max_payload,
-               std::function<bool(const uint8_t*, size_t, bool)> emit)
+               std::function<bool(uint8_t*, size_t, bool)> emit,
+               PacketPool& pool,
+               AsyncCopy* copier,
+               std::function<bool()> flush)
 {
-  if (!jpg || jpg_len<4 || max_payload<8 || !emit) return false;
+  if (!jpg || jpg_len<4 || max_payload<=8 || !emit) return false;
+  if (pool.bufSize() < pkt_buf_size(max_payload)) {
+    LOGW("RTP/JPEG","pool buf %u < %u", (unsigned)pool.bufSize(), (unsigned)pkt_buf_size(max_payload));
+    return false;
+  }
 
   // 1) Q-table + scan
   const uint8_t* scan=nullptr; size_t scan_len=0;
@@ -213,49 +312,19 @@ bool packetize(const uint8_t* jpg, size_t jpg_len,
   memcpy(&qthdr[68], qt.cqt, 64);
   const size_t q_len = sizeof(qthdr);
 
-  // 6) 断片化送出（最後のパケットのみ marker=true）
-  size_t off = 0;
-  while (off < scan_len) {
-    const bool first = (off == 0);
-
-    if (max_payload <= 8) return false;
-    size_t overhead = 8 + (first?rm_len:0) + (first?q_len:0);
-    if (overhead >= max_payload) return false;
-
-    size_t room  = max_payload - overhead;
-    size_t chunk = (scan_len - off < room) ? (scan_len - off) : room;
-
-    // ★ emit前に「今回が最後か」を確定
-    bool is_last = (off + chunk) >= scan_len;
-
-    // ★ Fragment Offset は “今回の off” を固定して使う
-    uint32_t fo_val = (uint32_t)off;
-    if (first && fo_val != 0) fo_val = 0; // 安全弁（先頭は必ず0）
-
-    uint8_t payload[1800];
-    size_t pos = 0;
-
-    // main8B with Fragment Offset
-    uint8_t mh[8]; memcpy(mh, main8, 8);
-    mh[1] = (uint8_t)(fo_val>>16);
-    mh[2] = (uint8_t)(fo_val>>8);
-    mh[3] = (uint8_t)(fo_val);
-    memcpy(payload+pos, mh, 8); pos += 8;
-
-    // Restart（DRIあり時、先頭のみ）
-    if (first && rm_len) { memcpy(payload+pos, rmhdr, rm_len); pos += rm_len; }
-    // QTable（Q=255：先頭のみ）
-    if (first) { memcpy(payload+pos, qthdr, q_len); pos += q_len; }
-
-    // scan chunk
-    memcpy(payload+pos, scan+off, chunk); pos += chunk;
-
-    if (pos > max_payload) return false;
-    if (!emit(payload, pos, is_last)) return false;
-
-    off += chunk;     // ★ 最後に増やす
+  // 6) 断片化送出
+  uint8_t* buf[PKT_BATCH_MAX];
+  size_t want = flush ? umin(RTP_BATCH_PKTS, PKT_BATCH_MAX) : 2;
+  size_t n = 0;
+  while (n < want && (buf[n] = pool.alloc()) != nullptr) n++;   // 足りなければ取れた分で
+  if (!n) {
+    LOGW("RTP/JPEG","packet pool exhausted");
+    return false;
   }
-  return true;
+  bool ok = emit_fragments(main8, rmhdr, rm_len, qthdr, q_len, scan, scan_len,
+                           max_payload, emit, flush, buf, n, copier);
+  while (n) pool.free(buf[--n]);
+  return ok;
 }
 
 } // namespace rtpjpeg
@@ -1,8 +1,14 @@
 #pragma once
+#if defined(ARDUINO)
 #include <Arduino.h>
+#endif
 #include <functional>
 #include <stddef.h>
 #include <stdint.h>
+#include "config.h"
+
+class AsyncCopy;
+class PacketPool;
 
 namespace rtpjpeg {
 
@@ -19,17 +25,56 @@ bool extract_qtables_and_scan(const uint8_t* jpg, size_t len,
                               const uint8_t*& scan, size_t& scan_len,
                               Qtables& qt);
 
+// SOI から SOS セグメント末尾までのバイト数（= エントロピー符号化データの開始位置）。
+// 0 なら SOS が見つからない。WS のヘッダ省略送出（WS_JPEG_ELIDE）で使う。
+size_t header_len(const uint8_t* jpg, size_t len);
+
+// RTP 固定ヘッダ（RFC3550 5.1: V=2, P=0, X=0, CC=0）
+// UdpAgent とホスト側ツール（src/swarm_loadgen）で共用する。
+constexpr size_t RTP_HDR_LEN = 12;
+inline void write_rtp_header(uint8_t* rtp, bool marker, uint8_t pt,
+                             uint16_t seq, uint32_t ts, uint32_t ssrc){
+  rtp[0]  = 0x80;
+  rtp[1]  = (uint8_t)((marker ? 0x80 : 0) | (pt & 0x7F));
+  rtp[2]  = (uint8_t)(seq >> 8);
+  rtp[3]  = (uint8_t)(seq);
+  rtp[4]  = (uint8_t)(ts >> 24);
+  rtp[5]  = (uint8_t)(ts >> 16);
+  rtp[6]  = (uint8_t)(ts >> 8);
+  rtp[7]  = (uint8_t)(ts);
+  rtp[8]  = (uint8_t)(ssrc >> 24);
+  rtp[9]  = (uint8_t)(ssrc >> 16);
+  rtp[10] = (uint8_t)(ssrc >> 8);
+  rtp[11] = (uint8_t)(ssrc);
+}
+
 // JPEG type: 0=4:2:2, 1=4:2:0 (RFC2435 3.1.3/4.1)
 enum class JpegType : uint8_t { YUV422 = 0, YUV420 = 1 };
 
 // Build RTP/JPEG payloads (without RTP header) and emit them one by one.
 // emit(payload_ptr, payload_size, marker_is_last_packet)
+// payload_ptr の直前 PKT_HEADROOM バイトは emit 側で書き込んでよい（headroom）。
+// RTP ヘッダをそこへ書けば payload_ptr - RTP_HDR_LEN から 1 datagram として送れる
+// （payload を別バッファへ詰め直すコピーが要らない）。
+// パケットは pool のバッファ（bufSize >= pkt_buf_size(max_payload)）で組み、フレームを
+// 送り終えたら返す。2 面取れれば交互に使い、copier を渡すとパケット k を emit している間に
+// パケット k+1 のスキャン片を copier（デバイスでは GDMA）で先読みする。
+// flush を渡すと emit した payload は flush() が呼ばれるまで有効で、emit では溜めるだけにして
+// flush() でまとめて送れる（1 回に最大 RTP_BATCH_PKTS 個。フレーム末尾でも呼ばれる）。
+constexpr size_t PKT_HEADROOM = RTP_HDR_LEN;
+constexpr size_t PKT_BATCH_MAX = 32;                 // flush 1 回に溜められる上限
+constexpr size_t pkt_buf_size(size_t max_payload){   // + GDMA 位相合わせのずらし分
+  return PKT_HEADROOM + max_payload + ASYNC_COPY_ALIGN;
+}
 bool packetize(const uint8_t* jpg, size_t jpg_len,
                uint16_t width, uint16_t height,
                JpegType type,
                uint8_t type_specific,         // usually 0 (progressive)
                uint32_t ts90k,                // same timestamp for all packets of a frame
                size_t max_payload,            // max payload size excluding 12B RTP header
-               std::function<bool(const uint8_t*, size_t, bool)> emit);
+               std::function<bool(uint8_t*, size_t, bool)> emit,
+               PacketPool& pool,
+               AsyncCopy* copier = nullptr,
+               std::function<bool()> flush = nullptr);
 
 } // namespace rtpjpeg
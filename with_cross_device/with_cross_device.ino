@@ -17,6 +17,7 @@ AppStateMachine fsm;
 
 void setup(){
   Serial.begin(115200);
+  NetDebug::begin();                            /// LOG drain task
   LOGI("MAIN","setup start");
   registerWiFiDebug();                          /// LOG
   AppStateMachine::instance().begin();